@@ -0,0 +1,565 @@
+/*
+ * oggaio.c
+ *
+ * Read ahead and write behind, with io_uring where there is one, see
+ * oggaio.h.
+ */
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define	HAVE_IO_URING
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#endif
+
+#include "oggaio.h"
+
+#ifdef HAVE_IO_URING
+struct oggaio_ring {
+	int	fd;
+	unsigned	*sq_tail, *sq_mask, *sq_array;
+	unsigned	*cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe	*sqes;
+	struct io_uring_cqe	*cqes;
+	void	*sq, *cq;
+	size_t	sq_len, cq_len, sqes_len;
+	struct iovec	*iov;	/* one per buffer, alive until completion */
+};
+
+
+static void
+ring_close(struct oggaio_ring *r)
+{
+
+	if (r->sqes != MAP_FAILED)
+		(void)munmap(r->sqes, r->sqes_len);
+	if (r->cq != MAP_FAILED && r->cq != r->sq)
+		(void)munmap(r->cq, r->cq_len);
+	if (r->sq != MAP_FAILED)
+		(void)munmap(r->sq, r->sq_len);
+	if (r->fd != -1)
+		(void)close(r->fd);
+	free(r->iov);
+	free(r);
+}
+
+
+/**
+ * set up a ring for depth requests in flight on fd, if it is a regular file.
+ *
+ * return it and the current offset of fd, or NULL when there is no ring.
+ */
+static struct oggaio_ring *
+ring_open(int fd, int depth, ogg_int64_t *offset)
+{
+	struct io_uring_params p;
+	struct oggaio_ring *r;
+	struct stat st;
+	char *sq, *cq;
+
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) ||
+	    (*offset = lseek(fd, 0, SEEK_CUR)) == -1)
+		return (NULL);
+	if ((r = calloc(1, sizeof(struct oggaio_ring))) == NULL)
+		return (NULL);
+	r->sq = r->cq = r->sqes = MAP_FAILED;
+	(void)memset(&p, 0, sizeof(p));
+	if ((r->fd = syscall(__NR_io_uring_setup, depth, &p)) == -1)
+		goto fail_label;
+	if ((r->iov = calloc(depth, sizeof(struct iovec))) == NULL)
+		goto fail_label;
+
+	r->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if ((p.features & IORING_FEAT_SINGLE_MMAP) && r->cq_len > r->sq_len)
+		r->sq_len = r->cq_len;
+	r->sq = mmap(NULL, r->sq_len, PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	if (r->sq == MAP_FAILED)
+		goto fail_label;
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		r->cq = r->sq;
+	else {
+		r->cq = mmap(NULL, r->cq_len, PROT_READ | PROT_WRITE,
+		    MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+		if (r->cq == MAP_FAILED)
+			goto fail_label;
+	}
+	r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+	if (r->sqes == MAP_FAILED)
+		goto fail_label;
+
+	sq = r->sq;
+	cq = r->cq;
+	r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+	r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+	r->sq_array = (unsigned *)(sq + p.sq_off.array);
+	r->cq_head = (unsigned *)(cq + p.cq_off.head);
+	r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+	r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+	return (r);
+
+fail_label:
+	ring_close(r);
+	return (NULL);
+}
+
+
+/**
+ * queue a read or write of len bytes at off for buffer i, and tell the
+ * kernel. There is always room: no more than depth are ever in flight.
+ *
+ * return 0 on success and -1 on error.
+ */
+static int
+ring_submit(struct oggaio_ring *r, int writing, int fd, int i, void *buf,
+    long len, ogg_int64_t off)
+{
+	struct io_uring_sqe *sqe;
+	unsigned tail, index;
+	int n;
+
+	r->iov[i].iov_base = buf;
+	r->iov[i].iov_len = len;
+	tail = *r->sq_tail;
+	index = tail & *r->sq_mask;
+	sqe = &r->sqes[index];
+	(void)memset(sqe, 0, sizeof(struct io_uring_sqe));
+	sqe->opcode = (writing ? IORING_OP_WRITEV : IORING_OP_READV);
+	sqe->fd = fd;
+	sqe->addr = (unsigned long)&r->iov[i];
+	sqe->len = 1;
+	sqe->off = off;
+	sqe->user_data = i;
+	r->sq_array[index] = index;
+	__atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+	do
+		n = syscall(__NR_io_uring_enter, r->fd, 1, 0, 0, NULL, 0);
+	while (n == -1 && errno == EINTR);
+	return (n == 1 ? 0 : -1);
+}
+
+
+/**
+ * wait for the next request to complete.
+ *
+ * return 0 and its buffer and result (bytes or -errno), or -1 on error.
+ */
+static int
+ring_wait(struct oggaio_ring *r, int *i, long *res)
+{
+	struct io_uring_cqe *cqe;
+	unsigned head;
+
+	head = *r->cq_head;
+	while (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))
+		if (syscall(__NR_io_uring_enter, r->fd, 0, 1,
+		    IORING_ENTER_GETEVENTS, NULL, 0) == -1 && errno != EINTR)
+			return (-1);
+	cqe = &r->cqes[head & *r->cq_mask];
+	*i = (int)cqe->user_data;
+	*res = cqe->res;
+	__atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+	return (0);
+}
+#else
+struct oggaio_ring {
+	int	fd;
+};
+
+
+static struct oggaio_ring *
+ring_open(int fd, int depth, ogg_int64_t *offset)
+{
+
+	(void)fd; (void)depth; (void)offset;
+	return (NULL);
+}
+
+
+static void
+ring_close(struct oggaio_ring *r)
+{
+
+	(void)r;
+}
+
+
+static int
+ring_submit(struct oggaio_ring *r, int writing, int fd, int i, void *buf,
+    long len, ogg_int64_t off)
+{
+
+	(void)r; (void)writing; (void)fd; (void)i; (void)buf; (void)len;
+	(void)off;
+	errno = ENOSYS;
+	return (-1);
+}
+
+
+static int
+ring_wait(struct oggaio_ring *r, int *i, long *res)
+{
+
+	(void)r; (void)i; (void)res;
+	errno = ENOSYS;
+	return (-1);
+}
+#endif
+
+
+static void
+release(struct oggaio *a)
+{
+	int i;
+
+	if (a->ring != NULL)
+		ring_close(a->ring);
+	for (i = 0; a->bufs != NULL && i < a->depth; i++)
+		free(a->bufs[i]);
+	free(a->bufs);
+	free(a->lens);
+	free(a->busy);
+	(void)memset(a, 0, sizeof(struct oggaio));
+	a->fd = -1;
+}
+
+
+/**
+ * set a up on fd, with a ring when depth > 0, fd is a regular file and
+ * the kernel has io_uring.
+ *
+ * return 0 on success and -1 on error (out of memory).
+ */
+static int
+aio_open(struct oggaio *a, int fd, int depth, int writing)
+{
+	int i;
+
+	(void)memset(a, 0, sizeof(struct oggaio));
+	a->fd = fd;
+	a->writing = writing;
+	a->offset = -1;
+	if (depth > 0)
+		a->ring = ring_open(fd, depth, &a->offset);
+	if (a->ring == NULL)
+		a->offset = -1;
+	a->depth = (a->ring != NULL ? depth : 1);
+
+	a->bufs = calloc(a->depth, sizeof(unsigned char *));
+	a->lens = calloc(a->depth, sizeof(long));
+	a->busy = calloc(a->depth, sizeof(int));
+	if (a->bufs == NULL || a->lens == NULL || a->busy == NULL)
+		goto fail_label;
+	for (i = 0; i < a->depth; i++)
+		if ((a->bufs[i] = malloc(OGGAIO_BUFSIZE)) == NULL)
+			goto fail_label;
+	return (0);
+
+fail_label:
+	release(a);
+	return (-1);
+}
+
+
+/**
+ * wait until buffer i is back from the kernel, taking the completions of
+ * the others on the way.
+ *
+ * return 0 on success and -1 on error.
+ */
+static int
+wait_for(struct oggaio *a, int i)
+{
+	long res;
+	int j;
+
+	while (a->busy[i]) {
+		if (ring_wait(a->ring, &j, &res) != 0) {
+			a->error = 1;
+			return (-1);
+		}
+		a->busy[j] = 0;
+		if (!a->writing)
+			a->lens[j] = res;
+		else if (res != a->lens[j]) {
+			/* a short write to a regular file means no space */
+			errno = (res < 0 ? -res : ENOSPC);
+			a->error = 1;
+		} else
+			a->lens[j] = 0;
+	}
+	return (a->error ? -1 : 0);
+}
+
+
+/**
+ * start reading the next OGGAIO_BUFSIZE bytes into buffer i.
+ *
+ * return 0 on success and -1 on error.
+ */
+static int
+submit_read(struct oggaio *a, int i)
+{
+
+	a->lens[i] = 0;
+	if (ring_submit(a->ring, 0, a->fd, i, a->bufs[i], OGGAIO_BUFSIZE,
+	    a->offset) != 0)
+		return (-1);
+	a->busy[i] = 1;
+	a->offset += OGGAIO_BUFSIZE;
+	return (0);
+}
+
+
+/**
+ * read fd from its current offset with a. The reads run ahead of the
+ * caller, the offset of fd is left wherever.
+ *
+ * return 0 on success and -1 on error.
+ */
+int
+oggaio_open_read(struct oggaio *a, int fd, int depth)
+{
+	int i;
+
+	if (aio_open(a, fd, depth, 0) != 0)
+		return (-1);
+	for (i = 0; a->ring != NULL && i < a->depth; i++)
+		if (submit_read(a, i) != 0) {
+			a->error = 1;
+			break;
+		}
+	return (0);
+}
+
+
+/**
+ * write to fd from its current offset with a. Nothing must be written to fd
+ * by other means until oggaio_close(), which leaves its offset after the
+ * last byte written.
+ *
+ * return 0 on success and -1 on error.
+ */
+int
+oggaio_open_write(struct oggaio *a, int fd, int depth)
+{
+
+	return (aio_open(a, fd, depth, 1));
+}
+
+
+/**
+ * move on to the next buffer once the current one is drained.
+ *
+ * return 0 on success and -1 on error.
+ */
+static int
+next_read(struct oggaio *a)
+{
+	long n;
+
+	if (a->ring == NULL) {
+		a->pos = 0;
+		do
+			n = read(a->fd, a->bufs[0], OGGAIO_BUFSIZE);
+		while (n == -1 && errno == EINTR);
+		if (n == -1)
+			return (-1);
+		if (n == 0)
+			a->eof = 1;
+		a->lens[0] = n;
+		return (0);
+	}
+	/* regular files only come short at their end */
+	if (a->lens[a->cur] < OGGAIO_BUFSIZE) {
+		a->eof = 1;
+		return (0);
+	}
+	if (submit_read(a, a->cur) != 0)
+		return (-1);
+	a->cur = (a->cur + 1) % a->depth;
+	a->pos = 0;
+	return (wait_for(a, a->cur));
+}
+
+
+/**
+ * copy the next len bytes, or what is left of them, into buf.
+ *
+ * return how many, 0 at the end of the file, or -1 on error.
+ */
+long
+oggaio_read(struct oggaio *a, void *buf, long len)
+{
+	long done, n;
+
+	if (a->error)
+		return (-1);
+	for (done = 0; done < len; done += n) {
+		if (a->busy[a->cur] && wait_for(a, a->cur) != 0)
+			goto fail_label;
+		if (a->lens[a->cur] < 0) {
+			errno = -a->lens[a->cur];
+			goto fail_label;
+		}
+		if (a->pos == a->lens[a->cur]) {
+			if (a->eof)
+				break;
+			if (next_read(a) != 0)
+				goto fail_label;
+			n = 0;
+			continue;
+		}
+		n = a->lens[a->cur] - a->pos;
+		if (n > len - done)
+			n = len - done;
+		(void)memcpy((char *)buf + done, a->bufs[a->cur] + a->pos, n);
+		a->pos += n;
+	}
+	return (done);
+
+fail_label:
+	a->error = 1;
+	return (-1);
+}
+
+
+/**
+ * write len bytes from buf with a blocking write(2).
+ *
+ * return 0 on success and -1 on error.
+ */
+static int
+write_all(int fd, const unsigned char *buf, long len)
+{
+	long n;
+
+	while (len > 0) {
+		if ((n = write(fd, buf, len)) == -1) {
+			if (errno == EINTR)
+				continue;
+			return (-1);
+		}
+		buf += n;
+		len -= n;
+	}
+	return (0);
+}
+
+
+/**
+ * hand the current buffer to the kernel, and wait for the next one to be
+ * free.
+ *
+ * return 0 on success and -1 on error.
+ */
+static int
+push(struct oggaio *a)
+{
+	long len;
+
+	len = a->lens[a->cur];
+	if (a->ring == NULL) {
+		a->lens[0] = 0;
+		return (write_all(a->fd, a->bufs[0], len));
+	}
+	if (ring_submit(a->ring, 1, a->fd, a->cur, a->bufs[a->cur], len,
+	    a->offset) != 0)
+		return (-1);
+	a->busy[a->cur] = 1;
+	a->offset += len;
+	a->cur = (a->cur + 1) % a->depth;
+	return (wait_for(a, a->cur));
+}
+
+
+/**
+ * queue the len bytes of buf for writing.
+ *
+ * return 0 on success and -1 on error.
+ */
+int
+oggaio_write(struct oggaio *a, const void *buf, long len)
+{
+	const unsigned char *p = buf;
+	long n;
+
+	if (a->error)
+		return (-1);
+	while (len > 0) {
+		n = OGGAIO_BUFSIZE - a->lens[a->cur];
+		if (n > len)
+			n = len;
+		(void)memcpy(a->bufs[a->cur] + a->lens[a->cur], p, n);
+		a->lens[a->cur] += n;
+		p += n;
+		len -= n;
+		if (a->lens[a->cur] == OGGAIO_BUFSIZE && push(a) != 0) {
+			a->error = 1;
+			return (-1);
+		}
+	}
+	return (0);
+}
+
+
+/**
+ * write what is left, wait for all of it and release a.
+ *
+ * return 0 on success and -1 if any read or write failed.
+ */
+int
+oggaio_close(struct oggaio *a)
+{
+	int i, ret;
+
+	if (a->writing && !a->error && a->lens[a->cur] > 0 && push(a) != 0)
+		a->error = 1;
+	/* even after an error, the kernel may still be using the buffers */
+	for (i = 0; i < a->depth; i++)
+		if (a->busy[i] && wait_for(a, i) != 0 && a->busy[i])
+			break;	/* the ring itself failed */
+	if (a->writing && a->ring != NULL && !a->error &&
+	    lseek(a->fd, a->offset, SEEK_SET) == -1)
+		a->error = 1;
+	ret = (a->error ? -1 : 0);
+	release(a);
+	return (ret);
+}
+
+
+size_t
+oggaio_fread(void *ptr, size_t size, size_t nmemb, void *a)
+{
+	long n;
+
+	if (size == 0 || (n = oggaio_read(a, ptr, size * nmemb)) <= 0)
+		return (0);
+	return (n / size);
+}
+
+
+size_t
+oggaio_fwrite(const void *ptr, size_t size, size_t nmemb, void *a)
+{
+
+	return (oggaio_write(a, ptr, size * nmemb) == 0 ? nmemb : 0);
+}
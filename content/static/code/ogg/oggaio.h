@@ -0,0 +1,66 @@
+/*
+ * oggaio.h
+ *
+ * Read ahead and write behind for the tools streaming a whole file through
+ * libogg. A reader keeps depth buffers of OGGAIO_BUFSIZE bytes in flight
+ * ahead of the one being parsed, and a writer hands full buffers to the
+ * kernel and goes on filling the next one, so the disk works while the
+ * pages are being rewritten instead of in turns with it.
+ *
+ * On Linux this is done with io_uring, on its raw system calls so that
+ * nothing more has to be linked in. Where there is no io_uring (older
+ * kernels, seccomp filters, other systems), when depth is 0, or when the
+ * descriptor is not a regular file, the same calls do plain blocking
+ * read(2) and write(2) of OGGAIO_BUFSIZE bytes.
+ *
+ * oggaio_fread() and oggaio_fwrite() are shaped like fread(3) and
+ * fwrite(3), so a reader and a writer can be given to
+ * vcedit_open_callbacks() and vcedit_write().
+ *
+ * Compile oggaio.c along with the tool using it.
+ */
+#ifndef OGGAIO_H
+#define	OGGAIO_H
+
+#include <stddef.h>
+
+#include "ogg/ogg.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define	OGGAIO_DEPTH	4		/* buffers in flight by default */
+#define	OGGAIO_BUFSIZE	(256 * 1024)
+
+struct oggaio_ring;
+
+struct oggaio {
+	int	fd;
+	int	depth;			/* buffers, 1 for blocking I/O */
+	unsigned char	**bufs;
+	long	*lens;			/* bytes in each, or -errno */
+	int	*busy;			/* in the kernel's hands */
+	int	cur;			/* buffer being drained or filled */
+	long	pos;			/* in it */
+	ogg_int64_t	offset;		/* of the next read or write with a
+					   ring, -1 without */
+	int	writing;
+	int	eof;
+	int	error;
+	struct oggaio_ring	*ring;	/* NULL for blocking I/O */
+};
+
+int	oggaio_open_read(struct oggaio *a, int fd, int depth);
+int	oggaio_open_write(struct oggaio *a, int fd, int depth);
+long	oggaio_read(struct oggaio *a, void *buf, long len);
+int	oggaio_write(struct oggaio *a, const void *buf, long len);
+int	oggaio_close(struct oggaio *a);
+size_t	oggaio_fread(void *ptr, size_t size, size_t nmemb, void *a);
+size_t	oggaio_fwrite(const void *ptr, size_t size, size_t nmemb, void *a);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* OGGAIO_H */
@@ -0,0 +1,241 @@
+/*
+ * oggcrc.c
+ *
+ * Ogg page checksum kernels, see oggcrc.h.
+ */
+#include <string.h>
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+#include "oggcrc.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64)
+#define	OGGCRC_PCLMUL	1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define	PCLMUL_TARGET
+#else
+#define	PCLMUL_TARGET	__attribute__((target("pclmul,ssse3")))
+#endif
+#endif
+
+#define	OGGCRC_POLY	0x04c11db7UL
+
+static ogg_uint32_t crc_table[16][256];
+static ogg_uint32_t (*crc_kernel)(ogg_uint32_t, const unsigned char *, size_t);
+
+
+static ogg_uint32_t
+crc_bytes(ogg_uint32_t crc, const unsigned char *p, size_t len)
+{
+
+	while (len-- > 0)
+		crc = (crc << 8) ^ crc_table[0][(crc >> 24) ^ *p++];
+	return (crc);
+}
+
+
+/*
+ * slice-by-16: the table k gives the checksum contribution of a byte
+ * followed by k zero bytes, so 16 input bytes take 16 independent lookups.
+ */
+static ogg_uint32_t
+crc_slice16(ogg_uint32_t crc, const unsigned char *p, size_t len)
+{
+	const ogg_uint32_t (*t)[256] = (const ogg_uint32_t (*)[256])crc_table;
+
+	for (; len >= 16; p += 16, len -= 16) {
+		crc ^= ((ogg_uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) |
+		    p[3];
+		crc = t[15][crc >> 24] ^ t[14][(crc >> 16) & 0xff] ^
+		    t[13][(crc >> 8) & 0xff] ^ t[12][crc & 0xff] ^
+		    t[11][p[4]] ^ t[10][p[5]] ^ t[9][p[6]] ^ t[8][p[7]] ^
+		    t[7][p[8]] ^ t[6][p[9]] ^ t[5][p[10]] ^ t[4][p[11]] ^
+		    t[3][p[12]] ^ t[2][p[13]] ^ t[1][p[14]] ^ t[0][p[15]];
+	}
+	return (crc_bytes(crc, p, len));
+}
+
+
+#ifdef OGGCRC_PCLMUL
+/* fold constants, x^n mod P for the n below */
+static ogg_uint32_t k_128, k_192, k_512, k_576;
+
+
+/*
+ * PCLMULQDQ folding. Blocks are loaded byte swapped, so that the bit i of
+ * the register is the coefficient of x^i. A block A = H.x^64 + L is moved n
+ * bits further with H.(x^(n+64) mod P) + L.(x^n mod P), which is at most 95
+ * bits long. Four accumulators are carried 512 bits at a time, then folded
+ * into one. What remains is a 128 bit polynomial whose checksum is the one
+ * of the data, the table kernel takes it from there.
+ */
+static PCLMUL_TARGET ogg_uint32_t
+crc_pclmul(ogg_uint32_t crc, const unsigned char *p, size_t len)
+{
+	const __m128i swap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10,
+	    11, 12, 13, 14, 15);
+	const __m128i k1 = _mm_set_epi64x(k_192, k_128);
+	const __m128i k4 = _mm_set_epi64x(k_576, k_512);
+	__m128i a0, a1, a2, a3;
+	unsigned char rest[16];
+	int i;
+
+#define	LOAD(q)		_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(q)), swap)
+#define	FOLD(a, k, b)	_mm_xor_si128(_mm_xor_si128( \
+			    _mm_clmulepi64_si128((a), (k), 0x11), \
+			    _mm_clmulepi64_si128((a), (k), 0x00)), (b))
+
+	if (len < 64)
+		return (crc_slice16(crc, p, len));
+
+	/* the running checksum goes over the first four bytes */
+	a0 = _mm_xor_si128(LOAD(p), _mm_set_epi32((int)crc, 0, 0, 0));
+	a1 = LOAD(p + 16);
+	a2 = LOAD(p + 32);
+	a3 = LOAD(p + 48);
+	for (p += 64, len -= 64; len >= 64; p += 64, len -= 64) {
+		a0 = FOLD(a0, k4, LOAD(p));
+		a1 = FOLD(a1, k4, LOAD(p + 16));
+		a2 = FOLD(a2, k4, LOAD(p + 32));
+		a3 = FOLD(a3, k4, LOAD(p + 48));
+	}
+	a0 = FOLD(a0, k1, a1);
+	a0 = FOLD(a0, k1, a2);
+	a0 = FOLD(a0, k1, a3);
+	for (; len >= 16; p += 16, len -= 16)
+		a0 = FOLD(a0, k1, LOAD(p));
+
+#undef	LOAD
+#undef	FOLD
+
+	_mm_storeu_si128((__m128i *)rest, _mm_shuffle_epi8(a0, swap));
+	crc = 0;
+	for (i = 0; i < 16; i++)
+		crc = (crc << 8) ^ crc_table[0][(crc >> 24) ^ rest[i]];
+	return (crc_slice16(crc, p, len));
+}
+
+
+/* x^n mod P */
+static ogg_uint32_t
+xpow(int n)
+{
+	ogg_uint32_t r = 1;
+
+	while (n-- > 0)
+		r = (r & 0x80000000UL) ? (r << 1) ^ OGGCRC_POLY : (r << 1);
+	return (r);
+}
+
+
+static int
+have_pclmul(void)
+{
+#ifdef _MSC_VER
+	int info[4];
+
+	__cpuid(info, 1);
+	return ((info[2] & (1 << 1)) && (info[2] & (1 << 9)));
+#else
+	return (__builtin_cpu_supports("pclmul") &&
+	    __builtin_cpu_supports("ssse3"));
+#endif
+}
+#endif /* OGGCRC_PCLMUL */
+
+
+static void
+crc_init(void)
+{
+	ogg_uint32_t r;
+	int i, j;
+
+	for (i = 0; i < 256; i++) {
+		r = (ogg_uint32_t)i << 24;
+		for (j = 0; j < 8; j++)
+			r = (r & 0x80000000UL) ? (r << 1) ^ OGGCRC_POLY : (r << 1);
+		crc_table[0][i] = r;
+	}
+	for (i = 0; i < 256; i++) {
+		for (j = 1; j < 16; j++) {
+			r = crc_table[j - 1][i];
+			crc_table[j][i] = (r << 8) ^ crc_table[0][r >> 24];
+		}
+	}
+
+	crc_kernel = crc_slice16;
+#ifdef OGGCRC_PCLMUL
+	if (have_pclmul()) {
+		k_128 = xpow(128);
+		k_192 = xpow(192);
+		k_512 = xpow(512);
+		k_576 = xpow(576);
+		crc_kernel = crc_pclmul;
+	}
+#endif
+}
+
+
+/**
+ * update the checksum crc with the len bytes at p.
+ *
+ * return the new checksum.
+ */
+ogg_uint32_t
+oggcrc_update(ogg_uint32_t crc, const unsigned char *p, size_t len)
+{
+#ifdef _WIN32
+	static volatile int initialized;
+
+	if (!initialized) {
+		crc_init();
+		initialized = 1;
+	}
+#else
+	static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+	(void)pthread_once(&once, crc_init);
+#endif
+	if (len < 16)
+		return (crc_bytes(crc, p, len));
+	return (crc_kernel(crc, p, len));
+}
+
+
+/**
+ * compute the checksum of a page as stored, i.e. with its CRC field taken as
+ * zero.
+ *
+ * return the checksum.
+ */
+ogg_uint32_t
+oggcrc_page(const unsigned char *header, size_t header_len,
+    const unsigned char *body, size_t body_len)
+{
+	static const unsigned char zero[4] = { 0, 0, 0, 0 };
+	ogg_uint32_t crc;
+
+	crc = oggcrc_update(0, header, 22);
+	crc = oggcrc_update(crc, zero, 4);
+	crc = oggcrc_update(crc, header + 26, header_len - 26);
+	return (oggcrc_update(crc, body, body_len));
+}
+
+
+/**
+ * set the CRC field of the page og, like ogg_page_checksum_set().
+ */
+void
+oggcrc_page_set(ogg_page *og)
+{
+	ogg_uint32_t crc;
+
+	crc = oggcrc_page(og->header, og->header_len, og->body, og->body_len);
+	og->header[22] = crc & 0xff;
+	og->header[23] = (crc >> 8) & 0xff;
+	og->header[24] = (crc >> 16) & 0xff;
+	og->header[25] = (crc >> 24) & 0xff;
+}
@@ -0,0 +1,39 @@
+/*
+ * oggcrc.h
+ *
+ * Ogg page checksum: CRC-32 with the 0x04c11db7 polynomial, not reflected,
+ * starting from zero and without final xor.
+ *
+ * The fastest kernel the CPU supports is picked on first use: PCLMULQDQ
+ * folding on x86 when available, slice-by-16 tables otherwise, and a byte at
+ * a time for the short inputs. All of them give the same results, and they
+ * may be called from several threads.
+ *
+ * Compile oggcrc.c along with the tool using it. oggcrc_bench.c checks the
+ * kernels against each other and against libogg's ogg_page_checksum_set()
+ * over random lengths and alignments, then times them; it includes
+ * oggcrc.c itself:
+ *   cc -O2 -I/include/path oggcrc_bench.c -L/lib/path -logg -lpthread
+ */
+#ifndef OGGCRC_H
+#define	OGGCRC_H
+
+#include <stddef.h>
+
+#include "ogg/ogg.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+ogg_uint32_t	oggcrc_update(ogg_uint32_t crc, const unsigned char *p,
+		    size_t len);
+ogg_uint32_t	oggcrc_page(const unsigned char *header, size_t header_len,
+		    const unsigned char *body, size_t body_len);
+void		oggcrc_page_set(ogg_page *og);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* OGGCRC_H */
@@ -0,0 +1,181 @@
+/*
+ * oggcrc_bench.c
+ *
+ * Check the page checksum kernels of oggcrc.c against each other and
+ * against libogg, then time them. oggcrc.c is included rather than linked,
+ * so that its kernels can be called one by one.
+ *
+ * Every kernel is first given the same random data at random lengths and
+ * alignments, as the body of a page whose checksum libogg's
+ * ogg_page_checksum_set() computes too; they must all agree, otherwise the
+ * benchmark stops there. Then each of them goes over buffers of a few
+ * sizes, again and again, and its throughput is reported in MB/s.
+ *
+ * Compile with:
+ *   cc -O2 -I/include/path oggcrc_bench.c -L/lib/path -logg -lpthread
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "oggcrc.c"
+
+#define	BENCH_CHECKS	20000		/* random buffers checked */
+#define	BENCH_CHECKLEN	70000		/* longest of them */
+#define	BENCH_BYTES	(256L * 1024 * 1024)	/* timed per kernel and size */
+#define	BENCH_ALIGN	16		/* misalignments tried */
+
+typedef ogg_uint32_t (*kernel_func)(ogg_uint32_t, const unsigned char *,
+    size_t);
+
+/* the page libogg checksums, its body pointing at the data */
+static unsigned char page_header[27] = { 'O', 'g', 'g', 'S' };
+
+
+/**
+ * checksum the len bytes at p as the body of page_header with libogg.
+ *
+ * return the checksum.
+ */
+static ogg_uint32_t
+crc_libogg(ogg_uint32_t crc, const unsigned char *p, size_t len)
+{
+	ogg_page og;
+
+	(void)crc;
+	og.header = page_header;
+	og.header_len = sizeof(page_header);
+	og.body = (unsigned char *)p;
+	og.body_len = len;
+	ogg_page_checksum_set(&og);
+	return (page_header[22] | (page_header[23] << 8) |
+	    (page_header[24] << 16) | ((ogg_uint32_t)page_header[25] << 24));
+}
+
+
+static const struct kernel {
+	const char	*name;
+	kernel_func	 run;
+	int		 page;	/* checksums page_header along with the data */
+} kernels[] = {
+	{ "bytewise",	crc_bytes,	0 },
+	{ "slice16",	crc_slice16,	0 },
+#ifdef OGGCRC_PCLMUL
+	{ "pclmul",	crc_pclmul,	0 },
+#endif
+	{ "libogg",	crc_libogg,	1 },
+};
+#define	NKERNELS	(sizeof(kernels) / sizeof(kernels[0]))
+
+
+/**
+ * tell whether the kernel k can run on this CPU.
+ */
+static int
+usable(const struct kernel *k)
+{
+
+#ifdef OGGCRC_PCLMUL
+	if (k->run == crc_pclmul)
+		return (crc_kernel == crc_pclmul);
+#endif
+	(void)k;
+	return (1);
+}
+
+
+/**
+ * compute with k the checksum of the page made of page_header and the len
+ * bytes at p.
+ */
+static ogg_uint32_t
+page_crc(const struct kernel *k, const unsigned char *p, size_t len)
+{
+	ogg_uint32_t crc;
+
+	if (k->page)
+		return (k->run(0, p, len));
+	page_header[22] = page_header[23] = page_header[24] =
+	    page_header[25] = 0;
+	crc = k->run(0, page_header, sizeof(page_header));
+	return (k->run(crc, p, len));
+}
+
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+
+int
+main(void)
+{
+	static const size_t sizes[] = { 4096, 65536, 1024 * 1024 };
+	unsigned char *buf;
+	ogg_uint32_t crc, want;
+	size_t i, j, n, len, off, rounds;
+	double start, elapsed;
+	volatile ogg_uint32_t sink;
+
+	if ((buf = malloc(sizes[2] + BENCH_CHECKLEN + BENCH_ALIGN)) == NULL) {
+		(void)fprintf(stderr, "malloc\n");
+		return (EXIT_FAILURE);
+	}
+	srand((unsigned)time(NULL));
+	for (i = 0; i < sizes[2] + BENCH_CHECKLEN + BENCH_ALIGN; i++)
+		buf[i] = rand() & 0xff;
+	/* picks the kernel of this CPU, and fills the tables */
+	(void)oggcrc_update(0, buf, 0);
+
+	for (n = 0; n < BENCH_CHECKS; n++) {
+		len = rand() % (BENCH_CHECKLEN + 1);
+		off = rand() % BENCH_ALIGN;
+		want = page_crc(&kernels[0], buf + off, len);
+		for (i = 1; i < NKERNELS; i++) {
+			if (!usable(&kernels[i]))
+				continue;
+			crc = page_crc(&kernels[i], buf + off, len);
+			if (crc != want) {
+				(void)fprintf(stderr, "%s: %08lx instead of "
+				    "%08lx for %zu bytes at +%zu\n",
+				    kernels[i].name, (unsigned long)crc,
+				    (unsigned long)want, len, off);
+				return (EXIT_FAILURE);
+			}
+		}
+	}
+	(void)printf("%d random buffers: all kernels agree\n\n",
+	    BENCH_CHECKS);
+
+	(void)printf("%-10s", "size");
+	for (i = 0; i < NKERNELS; i++)
+		(void)printf("%10s", kernels[i].name);
+	(void)printf("\n");
+	for (j = 0; j < sizeof(sizes) / sizeof(sizes[0]); j++) {
+		(void)printf("%-10zu", sizes[j]);
+		rounds = BENCH_BYTES / sizes[j];
+		for (i = 0; i < NKERNELS; i++) {
+			if (!usable(&kernels[i])) {
+				(void)printf("%10s", "-");
+				continue;
+			}
+			/* the bytewise kernel gets an eighth of the work */
+			n = (kernels[i].run == crc_bytes ? rounds / 8 : rounds);
+			start = now();
+			for (off = 0; off < n; off++)
+				sink = kernels[i].run(0,
+				    buf + off % BENCH_ALIGN, sizes[j]);
+			elapsed = now() - start;
+			(void)printf("%10.0f", n * sizes[j] / elapsed / 1e6);
+		}
+		(void)printf("  MB/s\n");
+	}
+	(void)sink;
+	free(buf);
+	return (EXIT_SUCCESS);
+}
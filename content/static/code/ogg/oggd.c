@@ -0,0 +1,1500 @@
+/*
+ * oggd.c
+ *
+ * A daemon doing the work of vorbis_comment, oggfix_granulepos --fast and
+ * oggduration for pipelines going through many small files, so that they
+ * don't pay for a process and fresh libogg and libvorbis states per file.
+ * It listens on a Unix domain socket, and hands the connections to a pool
+ * of workers through a bounded queue: when it is full, new connections are
+ * told so and closed at once. Each worker keeps its sync and stream states
+ * (reset, not cleared, between jobs) and its output buffer, and the setup
+ * headers go through vorbiscache, so the codebooks of a given encoder are
+ * only parsed once.
+ *
+ * A connection sends requests, one per line with tab separated fields, and
+ * gets a line back for each, "ok" or "error" then fields of its own:
+ *
+ *   probe <file>                ok <seconds> <rate> <channels> <links>
+ *   check <file>                ok <pages with a wrong granulepos>
+ *   fix <file> <output>         ok <links> <samples of the last link>
+ *   retag <file> [TAG=value]..  ok
+ *   ingest <file> <output> [TAG=value]..
+ *                               ok <links> <samples> <md5 of output>
+ *
+ * fix recomputes the granulepos of every page from the packet blocksizes,
+ * like revorb. retag sets the comments of the first stream: every TAG
+ * given replaces the comments with the same name, or removes them when the
+ * value is empty. The file is rewritten next to itself and renamed over,
+ * its audio pages copied byte for byte; a file whose audio does not begin
+ * on a fresh page is left to vorbis_comment.
+ *
+ * ingest does the work of fix, retag and md5(1) in a single pass: the file
+ * is read once, its comments edited on the way like retag would (whatever
+ * page the audio begins on) and its granulepos recomputed like fix, and
+ * every page written to output is hashed as it goes out. This spares the
+ * two more reads and the extra write of running them one after the other.
+ *
+ * With -w, oggd also watches a drop directory (not its subdirectories)
+ * and ingests the files closed or moved into it, once they were left alone
+ * for -d ms. With -t tags, each file goes through ingest, in a single pass;
+ * without, its granulepos are fixed when check finds any wrong. Every file
+ * done is recorded by its device, inode, size and mtime in the -r record
+ * file, which is read back at start, so that a restart only picks up the
+ * files which came in or changed meanwhile. The watcher waits for room in
+ * the queue instead of being turned away. It is built on inotify(7), and
+ * only on Linux.
+ *
+ * Compile with:
+ *   cc -I/include/path oggd.c oggprobe.c oggcrc.c oggpager.c oggsink.c \
+ *       vorbiscache.c md5.c -L/lib/path -logg -lvorbis -lpthread
+ */
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+
+#include <dirent.h>
+#include <poll.h>
+#include <time.h>
+#define	HAVE_INOTIFY
+#endif
+
+#include "ogg/ogg.h"
+#include "vorbis/codec.h"
+
+#include "md5.h"
+#include "oggcrc.h"
+#include "oggpager.h"
+#include "oggprobe.h"
+#include "oggsink.h"
+#include "vorbiscache.h"
+
+#define	OGGD_WORKERS	4	/* by default */
+#define	OGGD_QUEUE	64	/* connections waiting for a worker */
+#define	OGGD_LINE	8192	/* longest request */
+#define	OGGD_ARGS	64	/* fields of a request */
+#define	OGGD_DEBOUNCE	2000	/* ms a dropped file is left alone first */
+#define	OGGD_RECORD	".oggd-record"	/* in the watched directory */
+#define	OGGD_TMP	".oggd-tmp"	/* suffix of the files being written */
+#define	READ_CHUNK	65536
+
+
+/*
+ * a connection to answer, or a dropped file to ingest.
+ */
+struct job {
+	int		 fd;
+	char		*path;		/* NULL for a connection */
+};
+
+/*
+ * the jobs not yet taken by a worker.
+ */
+struct queue {
+	struct job	*jobs;
+	int		 size, head, count;
+	pthread_mutex_t	 lock;
+	pthread_cond_t	 nonempty, nonfull;
+};
+
+/*
+ * what identifies a file and its content, as far as the watcher knows.
+ */
+struct ident {
+	dev_t		 dev;
+	ino_t		 ino;
+	off_t		 size;
+	time_t		 sec;
+	long		 nsec;
+	int		 used;
+};
+
+/*
+ * the files the watcher is done with, a hash table of their identities
+ * backed by the record file.
+ */
+struct record {
+	struct ident	*tab;
+	size_t		 size, count;	/* size is a power of two */
+	FILE		*fp;
+	pthread_mutex_t	 lock;
+};
+
+/*
+ * a file the watcher waits on.
+ */
+struct pending {
+	char		*name;
+	ogg_int64_t	 due;		/* ms, see now_ms() */
+	struct pending	*next;
+};
+
+struct watch {
+	const char	*dir;
+	char		**tags;		/* applied with retag */
+	int		 ntags;
+	long		 debounce;
+	struct record	 record;
+	struct queue	*queue;
+	struct pending	*pending;
+};
+
+/*
+ * what a worker keeps from one job to the next.
+ */
+struct worker {
+	struct queue	*queue;
+	struct watch	*watch;		/* NULL without -w */
+	pthread_t	 thread;
+	ogg_sync_state	 oy;
+	ogg_stream_state is, os;
+	struct oggsink	 sink;
+	MD5_CTX		*md5;	/* what pages_out() writes is hashed here */
+	ogg_page	 held;	/* given back by the next read_page() */
+	int		 holding;
+	int		 skeleton_serialno;
+	int		 has_skeleton;
+	char		 line[OGGD_LINE];
+	size_t		 len, used;
+};
+
+
+/**
+ * write the len bytes of buf to fd.
+ *
+ * return 0 on success and -1 on error.
+ */
+static int
+write_all(int fd, const char *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		if ((n = write(fd, buf, len)) == -1) {
+			if (errno == EINTR)
+				continue;
+			return (-1);
+		}
+		buf += n;
+		len -= n;
+	}
+	return (0);
+}
+
+
+/**
+ * format a reply line into buf.
+ *
+ * return -1 when it is an error, 0 otherwise.
+ */
+static int
+reply(char *buf, size_t size, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	(void)vsnprintf(buf, size, fmt, ap);
+	va_end(ap);
+	return (strncmp(buf, "error", 5) == 0 ? -1 : 0);
+}
+
+
+/**
+ * get the next page of the file fd into og, w->held first if there is one.
+ *
+ * return 1 for a page, 0 at the end of the file, -1 when bytes were skipped
+ * and -2 on a read error.
+ */
+static int
+read_page(struct worker *w, int fd, ogg_page *og)
+{
+	char *buf;
+	ssize_t n;
+	int res;
+
+	if (w->holding) {
+		*og = w->held;
+		w->holding = 0;
+		return (1);
+	}
+	while ((res = ogg_sync_pageout(&w->oy, og)) == 0) {
+		if ((buf = ogg_sync_buffer(&w->oy, READ_CHUNK)) == NULL)
+			return (-2);
+		if ((n = read(fd, buf, READ_CHUNK)) == -1) {
+			if (errno == EINTR)
+				continue;
+			return (-2);
+		}
+		if (n == 0)
+			return (0);
+		(void)ogg_sync_wrote(&w->oy, n);
+	}
+	return (res);
+}
+
+
+/**
+ * check whether p is the first page of an Ogg Skeleton track.
+ *
+ * return 1 if it is, 0 otherwise.
+ */
+static int
+is_fishead(const ogg_page *p)
+{
+
+	return (ogg_page_bos(p) && p->body_len >= 8 &&
+	    memcmp(p->body, "fishead", 8) == 0);
+}
+
+
+/**
+ * build into out the comments of in, with those named in the ntags
+ * TAG=value of tags replaced by them (or removed for an empty value).
+ */
+static void
+edit_comments(const vorbis_comment *in, vorbis_comment *out, char **tags,
+    int ntags)
+{
+	const char *c, *eq;
+	size_t n;
+	int i, j, keep;
+
+	vorbis_comment_init(out);
+	for (i = 0; i < in->comments; i++) {
+		c = in->user_comments[i];
+		keep = 1;
+		for (j = 0; keep && j < ntags; j++) {
+			n = strcspn(tags[j], "=");
+			keep = (strncasecmp(c, tags[j], n) != 0 ||
+			    c[n] != '=');
+		}
+		if (keep)
+			vorbis_comment_add(out, c);
+	}
+	for (j = 0; j < ntags; j++)
+		if ((eq = strchr(tags[j], '=')) != NULL && eq[1] != '\0')
+			vorbis_comment_add(out, tags[j]);
+}
+
+
+/**
+ * read the header packets of the next Vorbis stream of fd into vi and vc,
+ * and put them in w->os, the stream state of its output. With tags, the
+ * comment header goes out with them applied (see edit_comments()). The
+ * pages of a Skeleton track are skipped.
+ *
+ * When fresh is not NULL, it is set to whether the audio data begins on a
+ * page of its own.
+ *
+ * return the number of pages of the stream read, 0 at the end of the file
+ * and -1 on error.
+ */
+static int
+headers_in(struct worker *w, int fd, vorbis_info *vi, vorbis_comment *vc,
+    char **tags, int ntags, int *fresh)
+{
+	vorbis_comment edited;
+	ogg_packet op, vc_packet;
+	ogg_page og;
+	int npackets, npages, nsegs, res;
+
+	npackets = npages = 0;
+	while (npackets < 3) {
+		if ((res = read_page(w, fd, &og)) == 0 && npages == 0)
+			return (0);
+		if (res == 0 || res == -2)
+			return (-1);
+		if (res == -1)
+			continue;
+		if (npages == 0) {
+			if (is_fishead(&og)) {
+				w->skeleton_serialno = ogg_page_serialno(&og);
+				w->has_skeleton = 1;
+			}
+			if (!ogg_page_bos(&og) || og.body_len < 7 ||
+			    memcmp(og.body, "\001vorbis", 7) != 0)
+				continue;
+			(void)ogg_stream_reset_serialno(&w->is,
+			    ogg_page_serialno(&og));
+			(void)ogg_stream_reset_serialno(&w->os,
+			    ogg_page_serialno(&og));
+		} else if (ogg_page_serialno(&og) != w->is.serialno)
+			continue;
+		npages++;
+		if (ogg_stream_pagein(&w->is, &og) == -1)
+			return (-1);
+		while (npackets < 3 &&
+		    (res = ogg_stream_packetout(&w->is, &op)) != 0) {
+			if (res == -1 || vorbiscache_headerin(vi, vc, &op) != 0)
+				return (-1);
+			if (++npackets == 2 && tags != NULL) {
+				edit_comments(vc, &edited, tags, ntags);
+				res = vorbis_commentheader_out(&edited,
+				    &vc_packet);
+				vorbis_comment_clear(&edited);
+				if (res != 0)
+					return (-1);
+				(void)ogg_stream_packetin(&w->os, &vc_packet);
+				ogg_packet_clear(&vc_packet);
+			} else
+				(void)ogg_stream_packetin(&w->os, &op);
+		}
+	}
+	if (fresh != NULL) {
+		/* a last lacing value of 255: a packet goes on next page */
+		nsegs = og.header[26];
+		*fresh = (nsegs > 0 && og.header[27 + nsegs - 1] != 255 &&
+		    ogg_stream_packetpeek(&w->is, NULL) == 0);
+	}
+	return (npages);
+}
+
+
+/**
+ * set the sink of w up to write to fd, keeping its buffer.
+ */
+static void
+sink_to(struct worker *w, int fd)
+{
+
+	w->sink.fd = fd;
+	w->sink.len = 0;
+	w->sink.offset = 0;
+	w->sink.error = 0;
+}
+
+
+/**
+ * write og through the sink of the worker arg, and hash it into its md5 if
+ * it is set.
+ *
+ * return 0 on success and -1 on error.
+ */
+static int
+page_out(void *arg, const ogg_page *og)
+{
+	struct worker *w = arg;
+
+	if (oggsink_page(&w->sink, og) == -1)
+		return (-1);
+	if (w->md5 != NULL) {
+		MD5Update(w->md5, og->header, og->header_len);
+		MD5Update(w->md5, og->body, og->body_len);
+	}
+	return (0);
+}
+
+
+/**
+ * write the pages held by w->os with page_out(), all of them with flush,
+ * the full ones otherwise.
+ *
+ * return the number of pages written, or -1 on error.
+ */
+static int
+pages_out(struct worker *w, int flush)
+{
+	ogg_page og;
+	int npages = 0;
+
+	while (flush ? ogg_stream_flush_fill(&w->os, &og, OGGPAGER_MAXFILL) :
+	    ogg_stream_pageout(&w->os, &og)) {
+		if (page_out(w, &og) == -1)
+			return (-1);
+		npages++;
+	}
+	return (npages);
+}
+
+
+/**
+ * probe <file>: its duration from its first and last pages, see oggprobe.h.
+ */
+static int
+cmd_probe(struct worker *w, char **argv, int argc, char *buf, size_t size)
+{
+	struct oggprobe p;
+	FILE *fp;
+	int res;
+
+	(void)w;
+	(void)argc;
+	if ((fp = fopen(argv[0], "rb")) == NULL)
+		return (reply(buf, size, "error\t%s: can't open", argv[0]));
+	(void)setvbuf(fp, NULL, _IONBF, 0);
+	res = oggprobe_file(fp, OGGPROBE_LINKS, &p);
+	(void)fclose(fp);
+	if (res == -1)
+		return (reply(buf, size, "error\t%s: can't read as ogg/vorbis "
+		    "file", argv[0]));
+	res = reply(buf, size, "ok\t%.3f\t%ld\t%d\t%zu", oggprobe_duration(&p),
+	    p.links[0].rate, p.links[0].channels, p.nlinks);
+	oggprobe_clear(&p);
+	return (res);
+}
+
+
+/**
+ * check <file>: count the pages whose granulepos is not the one fix would
+ * write, like revorb --check. The last page of a link may hold a smaller
+ * one, this is how encoders trim the end of the stream. Damaged data, and
+ * links without an end of stream page, count as wrong pages too.
+ */
+static int
+cmd_check(struct worker *w, char **argv, int argc, char *buf, size_t size)
+{
+	vorbis_info vi;
+	vorbis_comment vc;
+	ogg_packet op;
+	ogg_page og;
+	ogg_int64_t granulepos, expected, found;
+	long links, wrong;
+	int in, res, bs, lastbs, completed, eos, failed;
+
+	(void)argc;
+	if ((in = open(argv[0], O_RDONLY)) == -1)
+		return (reply(buf, size, "error\t%s: can't open", argv[0]));
+	links = wrong = 0;
+	failed = 0;
+	for (;;) {
+		vorbis_info_init(&vi);
+		vorbis_comment_init(&vc);
+		if ((res = headers_in(w, in, &vi, &vc, NULL, 0, NULL)) <= 0) {
+			failed = (res != 0);
+			vorbis_comment_clear(&vc);
+			vorbiscache_info_clear(&vi);
+			break;
+		}
+		links++;
+		granulepos = 0;
+		lastbs = eos = 0;
+		while (!eos && !failed) {
+			if ((res = read_page(w, in, &og)) <= 0) {
+				failed = (res == -2);
+				wrong++;
+				if (res == -1)
+					continue;
+				break;
+			}
+			if (ogg_page_serialno(&og) != w->is.serialno) {
+				/* the next link, this one was cut short */
+				if (ogg_page_bos(&og)) {
+					w->held = og;
+					w->holding = 1;
+					wrong++;
+					break;
+				}
+				continue;
+			}
+			eos = ogg_page_eos(&og);
+			(void)ogg_stream_pagein(&w->is, &og);
+			completed = 0;
+			while ((res = ogg_stream_packetout(&w->is, &op)) != 0) {
+				if (res == -1) {
+					wrong++;
+					continue;
+				}
+				bs = vorbis_packet_blocksize(&vi, &op);
+				if (lastbs != 0)
+					granulepos += (lastbs + bs) / 4;
+				lastbs = bs;
+				completed++;
+			}
+			expected = (completed > 0 ? granulepos : -1);
+			found = ogg_page_granulepos(&og);
+			if (found != expected && !(eos && completed > 0 &&
+			    found >= 0 && found < expected))
+				wrong++;
+		}
+		vorbis_comment_clear(&vc);
+		vorbiscache_info_clear(&vi);
+		if (failed)
+			break;
+	}
+	w->holding = 0;
+	(void)close(in);
+	if (failed || links == 0)
+		return (reply(buf, size, "error\t%s: can't read as ogg/vorbis "
+		    "file", argv[0]));
+	return (reply(buf, size, "ok\t%ld", wrong));
+}
+
+
+/**
+ * write the links of in to the sink of w with the granulepos of every page
+ * recomputed from the packet blocksizes, and the ntags TAG=value of tags
+ * applied to the comments of the first one. links is set to the number of
+ * links written, and granulepos to the samples of the last.
+ *
+ * return 0 on success and -1 on error.
+ */
+static int
+fix_links(struct worker *w, int in, char **tags, int ntags, long *links,
+    ogg_int64_t *granulepos)
+{
+	struct oggpager pg;
+	struct oggpager_out po;
+	vorbis_info vi;
+	vorbis_comment vc;
+	ogg_packet op;
+	ogg_page og;
+	int res, bs, lastbs, eos, failed;
+
+	*links = 0;
+	*granulepos = 0;
+	failed = 0;
+	for (;;) {
+		vorbis_info_init(&vi);
+		vorbis_comment_init(&vc);
+		if ((res = headers_in(w, in, &vi, &vc, *links == 0 ? tags :
+		    NULL, ntags, NULL)) <= 0 || pages_out(w, 1) == -1) {
+			failed = (res != 0);
+			vorbis_comment_clear(&vc);
+			vorbiscache_info_clear(&vi);
+			break;
+		}
+		(*links)++;
+		oggpager_init(&pg, NULL, vi.rate, 0);
+		oggpager_out_init(&po, &w->os, &pg, page_out, NULL, w);
+		*granulepos = 0;
+		lastbs = eos = 0;
+		while (!eos && !failed) {
+			if ((res = read_page(w, in, &og)) == 0)
+				break;
+			if (res == -2)
+				failed = 1;
+			if (res < 0)
+				continue;
+			if (ogg_page_bos(&og)) {
+				/* the next link, this one was cut short */
+				w->held = og;
+				w->holding = 1;
+				break;
+			}
+			if (ogg_page_serialno(&og) != w->is.serialno)
+				continue;
+			eos = ogg_page_eos(&og);
+			(void)ogg_stream_pagein(&w->is, &og);
+			while (!failed &&
+			    (res = ogg_stream_packetout(&w->is, &op)) != 0) {
+				if (res == -1)
+					continue;
+				bs = vorbis_packet_blocksize(&vi, &op);
+				if (lastbs != 0)
+					*granulepos += (lastbs + bs) / 4;
+				lastbs = bs;
+				op.granulepos = *granulepos;
+				if (oggpager_out_packet(&po, &op) == -1)
+					failed = 1;
+			}
+		}
+		/* the last packet ends the link, even if it was cut short */
+		if (!failed && oggpager_out_end(&po, 1) == -1)
+			failed = 1;
+		oggpager_out_clear(&po);
+		vorbis_comment_clear(&vc);
+		vorbiscache_info_clear(&vi);
+		if (failed)
+			break;
+	}
+	w->holding = 0;
+	if (oggsink_flush(&w->sink) == -1)
+		failed = 1;
+	return (failed || *links == 0 ? -1 : 0);
+}
+
+
+/**
+ * fix <file> <output>: write file to output with the granulepos of every
+ * page recomputed from the packet blocksizes, link after link.
+ */
+static int
+cmd_fix(struct worker *w, char **argv, int argc, char *buf, size_t size)
+{
+	ogg_int64_t granulepos;
+	long links;
+	int in, out, failed;
+
+	(void)argc;
+	if ((in = open(argv[0], O_RDONLY)) == -1)
+		return (reply(buf, size, "error\t%s: can't open", argv[0]));
+	if ((out = open(argv[1], O_WRONLY | O_CREAT | O_TRUNC, 0666)) == -1) {
+		(void)close(in);
+		return (reply(buf, size, "error\t%s: can't open", argv[1]));
+	}
+	sink_to(w, out);
+	failed = (fix_links(w, in, NULL, 0, &links, &granulepos) == -1);
+	(void)close(in);
+	if (close(out) != 0)
+		failed = 1;
+	if (failed)
+		return (reply(buf, size, "error\t%s: can't fix", argv[0]));
+	return (reply(buf, size, "ok\t%ld\t%lld", links,
+	    (long long)granulepos));
+}
+
+
+/**
+ * ingest <file> <output> [TAG=value]...: fix and retag file into output,
+ * and hash it, in a single pass.
+ */
+static int
+cmd_ingest(struct worker *w, char **argv, int argc, char *buf, size_t size)
+{
+	MD5_CTX md5;
+	char hex[2 * sizeof(md5.digest) + 1];
+	ogg_int64_t granulepos;
+	long links;
+	size_t i;
+	int in, out, failed;
+
+	if ((in = open(argv[0], O_RDONLY)) == -1)
+		return (reply(buf, size, "error\t%s: can't open", argv[0]));
+	if ((out = open(argv[1], O_WRONLY | O_CREAT | O_TRUNC, 0666)) == -1) {
+		(void)close(in);
+		return (reply(buf, size, "error\t%s: can't open", argv[1]));
+	}
+	sink_to(w, out);
+	MD5Init(&md5);
+	w->md5 = &md5;
+	failed = (fix_links(w, in, argv + 2, argc - 2, &links,
+	    &granulepos) == -1);
+	w->md5 = NULL;
+	(void)close(in);
+	if (close(out) != 0)
+		failed = 1;
+	if (failed)
+		return (reply(buf, size, "error\t%s: can't ingest", argv[0]));
+	MD5Final(&md5);
+	for (i = 0; i < sizeof(md5.digest); i++)
+		(void)sprintf(hex + 2 * i, "%02x", md5.digest[i]);
+	return (reply(buf, size, "ok\t%ld\t%lld\t%s", links,
+	    (long long)granulepos, hex));
+}
+
+
+/**
+ * retag <file> [TAG=value]...: rewrite the comments of file.
+ */
+static int
+cmd_retag(struct worker *w, char **argv, int argc, char *buf, size_t size)
+{
+	unsigned char header[27 + 255];
+	vorbis_info vi;
+	vorbis_comment vc;
+	ogg_page og, copy;
+	char *tmp;
+	long delta, pageno;
+	int in, out, res, fresh, npages_in, npages, failed;
+
+	tmp = NULL;
+	in = out = -1;
+	failed = 1;
+	vorbis_info_init(&vi);
+	vorbis_comment_init(&vc);
+	w->has_skeleton = 0;
+	if ((in = open(argv[0], O_RDONLY)) == -1) {
+		res = reply(buf, size, "error\t%s: can't open", argv[0]);
+		goto cleanup_label;
+	}
+	npages_in = headers_in(w, in, &vi, &vc, argv + 1, argc - 1, &fresh);
+	if (npages_in <= 0) {
+		res = reply(buf, size, "error\t%s: can't read as ogg/vorbis "
+		    "file", argv[0]);
+		goto cleanup_label;
+	}
+	if (!fresh) {
+		res = reply(buf, size, "error\t%s: audio does not begin on a "
+		    "fresh page, use vorbis_comment", argv[0]);
+		goto cleanup_label;
+	}
+	if ((tmp = malloc(strlen(argv[0]) + sizeof(OGGD_TMP))) == NULL) {
+		res = reply(buf, size, "error\tout of memory");
+		goto cleanup_label;
+	}
+	(void)sprintf(tmp, "%s%s", argv[0], OGGD_TMP);
+	if ((out = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0666)) == -1) {
+		res = reply(buf, size, "error\t%s: can't open", tmp);
+		goto cleanup_label;
+	}
+	sink_to(w, out);
+	if ((npages = pages_out(w, 1)) == -1)
+		goto write_error_label;
+	delta = npages - npages_in;
+
+	/* the rest is copied, moved by delta pages in the first stream */
+	while ((res = read_page(w, in, &og)) != 0) {
+		if (res == -2)
+			goto write_error_label;
+		if (res == -1 || (w->has_skeleton &&
+		    ogg_page_serialno(&og) == w->skeleton_serialno))
+			continue;
+		if (delta != 0 && ogg_page_serialno(&og) == w->is.serialno) {
+			(void)memcpy(header, og.header, og.header_len);
+			pageno = ogg_page_pageno(&og) + delta;
+			header[18] = pageno & 0xff;
+			header[19] = (pageno >> 8) & 0xff;
+			header[20] = (pageno >> 16) & 0xff;
+			header[21] = (pageno >> 24) & 0xff;
+			copy = og;
+			copy.header = header;
+			oggcrc_page_set(&copy);
+			og = copy;
+		}
+		if (oggsink_page(&w->sink, &og) == -1)
+			goto write_error_label;
+	}
+	if (oggsink_flush(&w->sink) == -1)
+		goto write_error_label;
+	res = close(out);
+	out = -1;
+	if (res != 0 || rename(tmp, argv[0]) != 0)
+		goto write_error_label;
+	failed = 0;
+	res = reply(buf, size, "ok");
+	goto cleanup_label;
+
+write_error_label:
+	res = reply(buf, size, "error\t%s: can't write", tmp);
+	/* FALLTHROUGH */
+cleanup_label:
+	if (out != -1)
+		(void)close(out);
+	if (failed && tmp != NULL)
+		(void)unlink(tmp);
+	if (in != -1)
+		(void)close(in);
+	free(tmp);
+	vorbis_comment_clear(&vc);
+	vorbiscache_info_clear(&vi);
+	return (res);
+}
+
+
+static const struct command {
+	const char	*name;
+	int		 nargs;		/* at least */
+	int		(*run)(struct worker *, char **, int, char *, size_t);
+} commands[] = {
+	{ "probe",	1,	cmd_probe },
+	{ "check",	1,	cmd_check },
+	{ "fix",	2,	cmd_fix },
+	{ "retag",	1,	cmd_retag },
+	{ "ingest",	2,	cmd_ingest },
+};
+
+
+/**
+ * run the request named name with the argc arguments of argv, from clean
+ * states, and format its reply into buf.
+ *
+ * return 0 on success and -1 on error.
+ */
+static int
+run(struct worker *w, const char *name, char **argv, int argc, char *buf,
+    size_t size)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(commands) / sizeof(commands[0]); i++)
+		if (strcmp(name, commands[i].name) == 0)
+			break;
+	if (i == sizeof(commands) / sizeof(commands[0]))
+		return (reply(buf, size, "error\tunknown request %s", name));
+	if (argc < commands[i].nargs)
+		return (reply(buf, size, "error\t%s: missing arguments", name));
+	(void)ogg_sync_reset(&w->oy);
+	w->holding = 0;
+	return (commands[i].run(w, argv, argc, buf, size));
+}
+
+
+/**
+ * get the next request line of the connection fd into *line, without its
+ * newline.
+ *
+ * return 1 for a line, 0 at the end of the connection and -1 on error or
+ * when the line is too long.
+ */
+static int
+next_request(struct worker *w, int fd, char **line)
+{
+	char *nl;
+	ssize_t n;
+
+	/* drop the line handled last */
+	(void)memmove(w->line, w->line + w->used, w->len - w->used);
+	w->len -= w->used;
+	w->used = 0;
+	for (;;) {
+		if ((nl = memchr(w->line, '\n', w->len)) != NULL) {
+			*nl = '\0';
+			*line = w->line;
+			w->used = nl + 1 - w->line;
+			return (1);
+		}
+		if (w->len == sizeof(w->line))
+			return (-1);
+		n = read(fd, w->line + w->len, sizeof(w->line) - w->len);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return (n == 0 ? 0 : -1);
+		w->len += n;
+	}
+}
+
+
+/**
+ * answer the requests of the connection fd until it is closed.
+ */
+static void
+serve(struct worker *w, int fd)
+{
+	char reply_buf[OGGD_LINE], *argv[OGGD_ARGS], *line, *p;
+	size_t len;
+	int argc;
+
+	w->len = w->used = 0;
+	while (next_request(w, fd, &line) == 1) {
+		argc = 0;
+		for (p = line; p != NULL && argc < OGGD_ARGS; argc++)
+			argv[argc] = strsep(&p, "\t");
+		if (p != NULL)
+			(void)reply(reply_buf, sizeof(reply_buf),
+			    "error\ttoo many fields");
+		else
+			(void)run(w, argv[0], argv + 1, argc - 1, reply_buf,
+			    sizeof(reply_buf));
+		len = strlen(reply_buf);
+		reply_buf[len++] = '\n';
+		if (write_all(fd, reply_buf, len) == -1)
+			break;
+	}
+}
+
+
+/**
+ * add the job j to q, waiting for room in it with wait.
+ *
+ * return 0 on success and -1 if q is full.
+ */
+static int
+enqueue(struct queue *q, const struct job *j, int wait)
+{
+	int queued;
+
+	(void)pthread_mutex_lock(&q->lock);
+	while (wait && q->count == q->size)
+		(void)pthread_cond_wait(&q->nonfull, &q->lock);
+	queued = (q->count < q->size);
+	if (queued) {
+		q->jobs[(q->head + q->count) % q->size] = *j;
+		q->count++;
+		(void)pthread_cond_signal(&q->nonempty);
+	}
+	(void)pthread_mutex_unlock(&q->lock);
+	return (queued ? 0 : -1);
+}
+
+
+/**
+ * take the next job of q into j, waiting for one.
+ */
+static void
+dequeue(struct queue *q, struct job *j)
+{
+
+	(void)pthread_mutex_lock(&q->lock);
+	while (q->count == 0)
+		(void)pthread_cond_wait(&q->nonempty, &q->lock);
+	*j = q->jobs[q->head];
+	q->head = (q->head + 1) % q->size;
+	q->count--;
+	(void)pthread_cond_signal(&q->nonfull);
+	(void)pthread_mutex_unlock(&q->lock);
+}
+
+
+#ifdef HAVE_INOTIFY
+static ogg_int64_t
+now_ms(void)
+{
+	struct timespec ts;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((ogg_int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+
+static void
+ident_of(const struct stat *st, struct ident *id)
+{
+
+	(void)memset(id, 0, sizeof(*id));
+	id->dev = st->st_dev;
+	id->ino = st->st_ino;
+	id->size = st->st_size;
+	id->sec = st->st_mtim.tv_sec;
+	id->nsec = st->st_mtim.tv_nsec;
+	id->used = 1;
+}
+
+
+/**
+ * find the slot of id in the table of r, or the free one where it goes.
+ */
+static struct ident *
+record_slot(const struct record *r, const struct ident *id)
+{
+	struct ident *e;
+	size_t i;
+
+	i = ((ogg_uint64_t)id->dev * 0x9e3779b97f4a7c15ULL ^
+	    (ogg_uint64_t)id->ino * 0xc2b2ae3d27d4eb4fULL) >> 7;
+	for (;; i++) {
+		e = &r->tab[i & (r->size - 1)];
+		if (!e->used || (e->dev == id->dev && e->ino == id->ino &&
+		    e->size == id->size && e->sec == id->sec &&
+		    e->nsec == id->nsec))
+			return (e);
+	}
+}
+
+
+/**
+ * add id to the table of r, growing it to keep it half empty.
+ *
+ * return 0 on success and -1 on error.
+ */
+static int
+record_insert(struct record *r, const struct ident *id)
+{
+	struct ident *old, *e;
+	size_t i, size;
+
+	if (2 * (r->count + 1) > r->size) {
+		old = r->tab;
+		size = r->size;
+		if ((r->tab = calloc(2 * size, sizeof(*r->tab))) == NULL) {
+			r->tab = old;
+			return (-1);
+		}
+		r->size = 2 * size;
+		for (i = 0; i < size; i++)
+			if (old[i].used)
+				*record_slot(r, &old[i]) = old[i];
+		free(old);
+	}
+	e = record_slot(r, id);
+	if (!e->used) {
+		*e = *id;
+		r->count++;
+	}
+	return (0);
+}
+
+
+/**
+ * read the record file at path into r, and open it to add to it.
+ *
+ * return 0 on success and -1 on error.
+ */
+static int
+record_open(struct record *r, const char *path)
+{
+	struct ident id;
+	unsigned long long dev, ino;
+	long long size, sec;
+	long nsec;
+	FILE *fp;
+
+	r->size = 1024;
+	r->count = 0;
+	if ((r->tab = calloc(r->size, sizeof(*r->tab))) == NULL)
+		return (-1);
+	(void)pthread_mutex_init(&r->lock, NULL);
+	if ((fp = fopen(path, "r")) != NULL) {
+		while (fscanf(fp, "%llu %llu %lld %lld.%ld\n", &dev, &ino,
+		    &size, &sec, &nsec) == 5) {
+			(void)memset(&id, 0, sizeof(id));
+			id.dev = dev;
+			id.ino = ino;
+			id.size = size;
+			id.sec = sec;
+			id.nsec = nsec;
+			id.used = 1;
+			if (record_insert(r, &id) == -1)
+				break;
+		}
+		(void)fclose(fp);
+	}
+	return ((r->fp = fopen(path, "a")) == NULL ? -1 : 0);
+}
+
+
+/**
+ * tell whether the file of st is in r.
+ *
+ * return 1 if it is, 0 otherwise.
+ */
+static int
+record_has(struct record *r, const struct stat *st)
+{
+	struct ident id;
+	int found;
+
+	ident_of(st, &id);
+	(void)pthread_mutex_lock(&r->lock);
+	found = record_slot(r, &id)->used;
+	(void)pthread_mutex_unlock(&r->lock);
+	return (found);
+}
+
+
+/**
+ * add the file of st to r and its record file.
+ *
+ * return 0 on success and -1 on error.
+ */
+static int
+record_add(struct record *r, const struct stat *st)
+{
+	struct ident id;
+	int ret;
+
+	ident_of(st, &id);
+	(void)pthread_mutex_lock(&r->lock);
+	ret = record_insert(r, &id);
+	if (ret == 0 && (fprintf(r->fp, "%llu %llu %lld %lld.%09ld\n",
+	    (unsigned long long)id.dev, (unsigned long long)id.ino,
+	    (long long)id.size, (long long)id.sec, id.nsec) < 0 ||
+	    fflush(r->fp) == EOF))
+		ret = -1;
+	(void)pthread_mutex_unlock(&r->lock);
+	return (ret);
+}
+
+
+/**
+ * fix the granulepos of the dropped file path if need be, apply the tags
+ * of wt to it and record it. With tags the file is rewritten anyway, so it
+ * goes through ingest at once rather than check, fix and retag, each of
+ * them reading it all over again. Failures are reported on stderr, and the
+ * file is recorded all the same: it is not tried again until it changes.
+ */
+static void
+ingest(struct worker *w, struct watch *wt, char *path)
+{
+	char buf[OGGD_LINE], *argv[OGGD_ARGS], *tmp;
+	struct stat st;
+	int res;
+
+	argv[0] = path;
+	tmp = NULL;
+	res = 0;
+	if (wt->ntags == 0)
+		res = run(w, "check", argv, 1, buf, sizeof(buf));
+	if (res == 0 && (wt->ntags > 0 || strcmp(buf, "ok\t0") != 0) &&
+	    (tmp = malloc(strlen(path) + sizeof(OGGD_TMP))) == NULL)
+		res = reply(buf, sizeof(buf), "error\tout of memory");
+	if (res == 0 && tmp != NULL) {
+		/* written next to the file, and renamed over it */
+		(void)sprintf(tmp, "%s%s", path, OGGD_TMP);
+		argv[1] = tmp;
+		(void)memcpy(argv + 2, wt->tags, wt->ntags * sizeof(char *));
+		if ((res = run(w, wt->ntags > 0 ? "ingest" : "fix", argv,
+		    wt->ntags + 2, buf, sizeof(buf))) == 0 &&
+		    rename(tmp, path) != 0)
+			res = reply(buf, sizeof(buf), "error\t%s: can't rename",
+			    tmp);
+		if (res == -1)
+			(void)unlink(tmp);
+	}
+	free(tmp);
+	if (res == -1)
+		(void)fprintf(stderr, "%s\n", buf + sizeof("error"));
+	if (stat(path, &st) == 0 && record_add(&wt->record, &st) == -1)
+		(void)fprintf(stderr, "%s: can't record\n", path);
+}
+
+
+/**
+ * tell whether name is one of the files we write while working on another.
+ *
+ * return 1 if it is, 0 otherwise.
+ */
+static int
+is_tmp(const char *name)
+{
+	size_t len;
+
+	len = strlen(name);
+	return (len >= sizeof(OGGD_TMP) - 1 &&
+	    strcmp(name + len - (sizeof(OGGD_TMP) - 1), OGGD_TMP) == 0);
+}
+
+
+/**
+ * wait on the file name of the watched directory for the debounce time,
+ * from now on. Hidden files (the record among them) are left out.
+ */
+static void
+schedule(struct watch *wt, const char *name)
+{
+	struct pending *p;
+
+	if (name[0] == '.' || is_tmp(name))
+		return;
+	for (p = wt->pending; p != NULL; p = p->next)
+		if (strcmp(p->name, name) == 0)
+			break;
+	if (p == NULL) {
+		if ((p = malloc(sizeof(*p))) == NULL ||
+		    (p->name = strdup(name)) == NULL) {
+			(void)fprintf(stderr, "%s: out of memory\n", name);
+			free(p);
+			return;
+		}
+		p->next = wt->pending;
+		wt->pending = p;
+	}
+	p->due = now_ms() + wt->debounce;
+}
+
+
+/**
+ * queue the file name of the watched directory for a worker, unless it is
+ * recorded already or still being written to: then it waits once more.
+ */
+static void
+consider(struct watch *wt, const char *name)
+{
+	struct job j;
+	struct stat st;
+	struct timespec ts;
+	ogg_int64_t age;
+
+	j.fd = -1;
+	if ((j.path = malloc(strlen(wt->dir) + strlen(name) + 2)) == NULL)
+		return;
+	(void)sprintf(j.path, "%s/%s", wt->dir, name);
+	if (stat(j.path, &st) != 0 || !S_ISREG(st.st_mode) ||
+	    record_has(&wt->record, &st)) {
+		free(j.path);
+		return;
+	}
+	/* written to without being closed since the last event */
+	(void)clock_gettime(CLOCK_REALTIME, &ts);
+	age = ((ogg_int64_t)ts.tv_sec - st.st_mtim.tv_sec) * 1000 +
+	    (ts.tv_nsec - st.st_mtim.tv_nsec) / 1000000;
+	if (age < wt->debounce) {
+		free(j.path);
+		schedule(wt, name);
+		return;
+	}
+	(void)enqueue(wt->queue, &j, 1);
+}
+
+
+/**
+ * wait on every file of the watched directory.
+ */
+static void
+scan(struct watch *wt)
+{
+	struct dirent *de;
+	DIR *dir;
+
+	if ((dir = opendir(wt->dir)) == NULL)
+		return;
+	while ((de = readdir(dir)) != NULL)
+		schedule(wt, de->d_name);
+	(void)closedir(dir);
+}
+
+
+/**
+ * watch the directory of wt for ever, see above.
+ */
+static void *
+watcher(void *arg)
+{
+	char events[16 * 1024]
+	    __attribute__((aligned(__alignof__(struct inotify_event))));
+	struct watch *wt = arg;
+	struct inotify_event *ev;
+	struct pending **pp, *p;
+	struct pollfd pfd;
+	ogg_int64_t now, first;
+	uint32_t cookie;
+	ssize_t n;
+	char *e;
+
+	pfd.fd = inotify_init1(IN_CLOEXEC);
+	pfd.events = POLLIN;
+	if (pfd.fd == -1 || inotify_add_watch(pfd.fd, wt->dir,
+	    IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO) == -1) {
+		(void)fprintf(stderr, "%s: can't watch: %s\n", wt->dir,
+		    strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	/* what came in while we were not watching */
+	scan(wt);
+
+	cookie = 0;
+	for (;;) {
+		now = now_ms();
+		first = -1;
+		for (p = wt->pending; p != NULL; p = p->next)
+			if (first == -1 || p->due < first)
+				first = p->due;
+		pfd.revents = 0;
+		if (poll(&pfd, 1, first == -1 ? -1 :
+		    (int)(first > now ? first - now : 0)) > 0 &&
+		    (n = read(pfd.fd, events, sizeof(events))) > 0) {
+			for (e = events; e < events + n;
+			    e += sizeof(*ev) + ev->len) {
+				ev = (struct inotify_event *)e;
+				/* events were lost, look at everything */
+				if (ev->mask & IN_Q_OVERFLOW)
+					scan(wt);
+				if (ev->len == 0)
+					continue;
+				/* our own renames are done with already */
+				if (ev->mask & IN_MOVED_FROM) {
+					if (is_tmp(ev->name))
+						cookie = ev->cookie;
+					continue;
+				}
+				if ((ev->mask & IN_MOVED_TO) && cookie != 0 &&
+				    ev->cookie == cookie)
+					continue;
+				schedule(wt, ev->name);
+			}
+		}
+
+		now = now_ms();
+		for (pp = &wt->pending; (p = *pp) != NULL;) {
+			if (p->due > now) {
+				pp = &p->next;
+				continue;
+			}
+			*pp = p->next;
+			consider(wt, p->name);
+			free(p->name);
+			free(p);
+		}
+	}
+	/* NOTREACHED */
+}
+#endif
+
+
+static void *
+worker(void *arg)
+{
+	struct worker *w = arg;
+	struct job j;
+
+	for (;;) {
+		dequeue(w->queue, &j);
+#ifdef HAVE_INOTIFY
+		if (j.path != NULL) {
+			ingest(w, w->watch, j.path);
+			free(j.path);
+			continue;
+		}
+#endif
+		serve(w, j.fd);
+		(void)close(j.fd);
+	}
+	return (NULL);
+}
+
+
+int
+main(int argc, char **argv)
+{
+	static const char busy[] = "error\tbusy\n";
+	static char *tags[OGGD_ARGS - 2];
+	struct sockaddr_un addr;
+	struct worker *workers;
+	struct queue q;
+	struct watch wt;
+	struct job j;
+	const char *record;
+	char *path;
+	pthread_t thread;
+	long nworkers, qsize;
+	int c, i, s;
+
+	nworkers = OGGD_WORKERS;
+	qsize = OGGD_QUEUE;
+	(void)memset(&wt, 0, sizeof(wt));
+	wt.tags = tags;
+	wt.debounce = OGGD_DEBOUNCE;
+	record = NULL;
+	while ((c = getopt(argc, argv, "d:j:q:r:t:w:")) != -1) {
+		switch (c) {
+		case 'd':
+			if ((wt.debounce = strtol(optarg, NULL, 10)) < 0)
+				goto usage_label;
+			break;
+		case 'j':
+			if ((nworkers = strtol(optarg, NULL, 10)) < 1)
+				goto usage_label;
+			break;
+		case 'q':
+			if ((qsize = strtol(optarg, NULL, 10)) < 1)
+				goto usage_label;
+			break;
+		case 'r':
+			record = optarg;
+			break;
+		case 't':
+			if (strchr(optarg, '=') == NULL ||
+			    wt.ntags == OGGD_ARGS - 2)
+				goto usage_label;
+			tags[wt.ntags++] = optarg;
+			break;
+		case 'w':
+			wt.dir = optarg;
+			break;
+		default:
+			goto usage_label;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (argc > 1 || (argc == 0 && wt.dir == NULL) ||
+	    (argc == 1 && strlen(argv[0]) >= sizeof(addr.sun_path))) {
+usage_label:
+		(void)fprintf(stderr, "usage: oggd [-j workers] [-q queue] "
+		    "socket\n");
+		(void)fprintf(stderr, "       oggd [-j workers] [-q queue] "
+		    "-w dir [-d ms] [-r record]\n"
+		    "            [-t TAG=value]... [socket]\n");
+		(void)fprintf(stderr, "  -j  jobs run at once (default %d)\n",
+		    OGGD_WORKERS);
+		(void)fprintf(stderr, "  -q  jobs waiting for a worker "
+		    "(default %d)\n", OGGD_QUEUE);
+		(void)fprintf(stderr, "  -w  fix and tag the files dropped in "
+		    "dir\n");
+		(void)fprintf(stderr, "  -d  ms they are left alone first "
+		    "(default %d)\n", OGGD_DEBOUNCE);
+		(void)fprintf(stderr, "  -r  where the files done are recorded "
+		    "(default dir/%s)\n", OGGD_RECORD);
+		(void)fprintf(stderr, "  -t  a tag to set on them\n");
+		return (EXIT_FAILURE);
+	}
+#ifndef HAVE_INOTIFY
+	if (wt.dir != NULL) {
+		(void)fprintf(stderr, "-w needs inotify(7), on Linux.\n");
+		return (EXIT_FAILURE);
+	}
+#endif
+
+	/* a client going away is only an error writing to it */
+	(void)signal(SIGPIPE, SIG_IGN);
+
+	s = -1;
+	if (argc == 1) {
+		(void)memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		(void)strcpy(addr.sun_path, argv[0]);
+		if ((s = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+			(void)fprintf(stderr, "socket: %s\n", strerror(errno));
+			return (EXIT_FAILURE);
+		}
+		(void)unlink(argv[0]);
+		if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+		    listen(s, qsize) == -1) {
+			(void)fprintf(stderr, "%s: %s\n", argv[0],
+			    strerror(errno));
+			return (EXIT_FAILURE);
+		}
+	}
+
+	q.size = qsize;
+	q.head = q.count = 0;
+	workers = calloc(nworkers, sizeof(struct worker));
+	if ((q.jobs = calloc(qsize, sizeof(struct job))) == NULL ||
+	    workers == NULL) {
+		(void)fprintf(stderr, "calloc\n");
+		return (EXIT_FAILURE);
+	}
+	(void)pthread_mutex_init(&q.lock, NULL);
+	(void)pthread_cond_init(&q.nonempty, NULL);
+	(void)pthread_cond_init(&q.nonfull, NULL);
+	wt.queue = &q;
+#ifdef HAVE_INOTIFY
+	if (wt.dir != NULL) {
+		if (record == NULL) {
+			path = malloc(strlen(wt.dir) + sizeof(OGGD_RECORD) + 1);
+			if (path == NULL) {
+				(void)fprintf(stderr, "malloc\n");
+				return (EXIT_FAILURE);
+			}
+			(void)sprintf(path, "%s/%s", wt.dir, OGGD_RECORD);
+			record = path;
+		}
+		if (record_open(&wt.record, record) == -1) {
+			(void)fprintf(stderr, "%s: can't open\n", record);
+			return (EXIT_FAILURE);
+		}
+	}
+#endif
+	for (i = 0; i < nworkers; i++) {
+		workers[i].queue = &q;
+		workers[i].watch = &wt;
+		(void)ogg_sync_init(&workers[i].oy);
+		(void)ogg_stream_init(&workers[i].is, 0);
+		(void)ogg_stream_init(&workers[i].os, 0);
+		if (oggsink_open_fd(&workers[i].sink, -1,
+		    OGGSINK_BATCH) == -1 || pthread_create(&workers[i].thread,
+		    NULL, worker, &workers[i]) != 0) {
+			(void)fprintf(stderr, "can't start worker %d\n", i);
+			return (EXIT_FAILURE);
+		}
+	}
+
+#ifdef HAVE_INOTIFY
+	if (wt.dir != NULL) {
+		if (s == -1)
+			(void)watcher(&wt);
+		if (pthread_create(&thread, NULL, watcher, &wt) != 0) {
+			(void)fprintf(stderr, "can't start the watcher\n");
+			return (EXIT_FAILURE);
+		}
+	}
+#endif
+	for (;;) {
+		if ((j.fd = accept(s, NULL, NULL)) == -1) {
+			if (errno != EINTR && errno != ECONNABORTED)
+				(void)fprintf(stderr, "accept: %s\n",
+				    strerror(errno));
+			continue;
+		}
+		j.path = NULL;
+		if (enqueue(&q, &j, 0) == -1) {
+			(void)write_all(j.fd, busy, sizeof(busy) - 1);
+			(void)close(j.fd);
+		}
+	}
+	/* NOTREACHED */
+}
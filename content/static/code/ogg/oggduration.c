@@ -0,0 +1,99 @@
+/*
+ * oggduration.c
+ *
+ * Print the duration, sample rate and channels of Ogg Vorbis files, reading
+ * only their first and last pages (see oggprobe.h).
+ * Compile with:
+ *   cc -I/include/path oggduration.c oggprobe.c -L/lib/path -logg -lvorbis
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "oggprobe.h"
+
+
+/**
+ * print the duration of the file at path, and of each of its links when
+ * flags has OGGPROBE_LINKS.
+ *
+ * return 0 on success and -1 on error.
+ */
+int
+print_duration(const char *path, int flags, int verbose)
+{
+	struct oggprobe p;
+	FILE *fp;
+	size_t i;
+	int ret;
+
+	if ((fp = fopen(path, "rb")) == NULL) {
+		(void)fprintf(stderr, "%s: can't open.\n", path);
+		return (-1);
+	}
+	/* no read ahead, every read is one we asked for */
+	(void)setvbuf(fp, NULL, _IONBF, 0);
+	ret = oggprobe_file(fp, flags, &p);
+	(void)fclose(fp);
+	if (ret == -1) {
+		(void)fprintf(stderr, "%s: can't read as ogg/vorbis file.\n", path);
+		return (-1);
+	}
+	if (ret == 1) {
+		(void)fprintf(stderr, "%s: chained file, use -l.\n", path);
+		oggprobe_clear(&p);
+		return (-1);
+	}
+
+	(void)printf("%s\t%.3f\t%ld\t%d\n", path, oggprobe_duration(&p),
+	    p.links[0].rate, p.links[0].channels);
+	if (flags & OGGPROBE_LINKS) {
+		for (i = 0; i < p.nlinks; i++)
+			(void)printf("  link %zu\t%.3f\t%ld\t%d\t@%lld\n", i,
+			    (double)p.links[i].granulepos / p.links[i].rate,
+			    p.links[i].rate, p.links[i].channels,
+			    (long long)p.links[i].begin);
+	}
+	if (verbose)
+		(void)fprintf(stderr, "%s: %lld of %lld bytes read in %ld reads\n",
+		    path, (long long)p.nread, (long long)p.size, p.nreads);
+	oggprobe_clear(&p);
+	return (0);
+}
+
+
+int
+main(int argc, char **argv)
+{
+	int c, i, flags, verbose, failures;
+
+	flags = verbose = failures = 0;
+	while ((c = getopt(argc, argv, "lv")) != -1) {
+		switch (c) {
+		case 'l':
+			flags |= OGGPROBE_LINKS;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			goto usage_label;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (argc == 0) {
+usage_label:
+		(void)fprintf(stderr, "usage: oggduration [-lv] file ...\n");
+		(void)fprintf(stderr, "  -l  walk the links of chained files\n");
+		(void)fprintf(stderr, "  -v  report the bytes read\n");
+		(void)fprintf(stderr, "prints: file, seconds, rate, channels\n");
+		return (EXIT_FAILURE);
+	}
+
+	for (i = 0; i < argc; i++)
+		if (print_duration(argv[i], flags, verbose) != 0)
+			failures++;
+	return (failures > 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+}
@@ -16,9 +16,15 @@ the file at the right place with mp3splt-gtk.
 #include <unistd.h>
 #include <string.h>
 #include <stdlib.h>
+#include <pthread.h>
 #include <vorbis/vorbisenc.h>
 #include <vorbis/vorbisfile.h>
 #include <ogg/ogg.h>
+#include "oggindex.h"
+#include "oggpager.h"
+#include "oggsink.h"
+#include "oggsource.h"
+#include "vorbiscache.h"
 
 #ifdef _WIN32 /* We need the following two to set stdin/stdout to binary */
 #include <io.h>
@@ -29,35 +35,88 @@ the file at the right place with mp3splt-gtk.
 #include <console.h>      /* CodeWarrior's Mac "command-line" support */
 #endif
 
-ogg_int64_t granulepos;
+/* oggfix() flags */
+#define OGGFIX_FAST   1 /* count the samples with vorbis_packet_blocksize() */
+#define OGGFIX_VERIFY 2 /* also decode, and warn when both counts differ */
+#define OGGFIX_INDEX  4 /* write a seek index to <dest>.idx */
+#define OGGFIX_CHECK  8 /* write nothing, only compare the page granulepos */
+#define OGGFIX_PAGES 16 /* report the page overhead of every stream */
+
+/* Returns 0 on success and -1 if the output could not be written.
+   Writes all the pages of os_out, which pager accounts for if it is not
+   NULL. The pages on which a packet begins are seek points for index,
+   when it is not NULL. */
+int pagewrite
+(
+ ogg_stream_state *os_out,
+ ogg_page *og_out,
+ struct oggpager *pager,
+ struct oggsink *sink,
+ vorbis_info *vi,
+ struct oggindex_writer *index
+ )
+{
+  if(pager!=NULL)
+    oggpager_flushed(pager);
+  while(ogg_stream_flush_fill(os_out,og_out,OGGPAGER_MAXFILL))
+    {
+      if(index!=NULL && oggindex_add_page(index,vi,og_out,sink->offset)!=0)
+	return -1;
+      if(oggsink_page(sink,og_out)!=0)
+	return -1;
+    }
+  return 0;
+}
 
-void packetwrite
+/* Returns 0 on success and -1 if the output could not be written.
+   Header packets get pages of their own (pager is NULL), audio packets
+   are laid out by pager, after the policy of the stream. */
+int packetwrite
 (
  ogg_stream_state *os_out,
  ogg_page *og_out,
  ogg_packet *op_out,
- FILE *outputfile
+ ogg_int64_t granulepos,
+ struct oggpager *pager,
+ struct oggsink *sink,
+ vorbis_info *vi,
+ struct oggindex_writer *index
  )
 {
   // Correct the packet
   op_out->granulepos=granulepos;
-  
+
+  /* Close the page first if it would hold too much audio with it */
+  if(pager!=NULL && oggpager_due(pager,granulepos) &&
+     pagewrite(os_out,og_out,pager,sink,vi,index)!=0)
+    return -1;
     /* Push the packet into the stream...*/
   ogg_stream_packetin(os_out,op_out);
+  if(pager!=NULL && !oggpager_add(pager,op_out->bytes,granulepos))
+    return 0;
   /* ...and write the stream to the output file.*/
-  while(ogg_stream_flush(os_out,og_out))
-    {
-      fwrite(og_out->header,1,og_out->header_len,outputfile);
-      fwrite(og_out->body,1,og_out->body_len,outputfile);
-    }
+  return pagewrite(os_out,og_out,pager,sink,vi,index);
 }
 
 // Heavily based on
 // http://svn.xiph.org/trunk/vorbis/examples/decoder_example.c
 // from Nov1 3, 2010
-void oggfix(char *src,char *dest)
+//
+// Returns 0 on success and -1 on error, in which case dest is removed.
+// Everything lives on the stack, so oggfix() can run in several threads
+// at once. With OGGFIX_INDEX, a seek point is kept every interval ms.
+//
+// The audio pages of every logical stream are laid out after its policy
+// in pages, and reported with OGGFIX_PAGES.
+//
+// With OGGFIX_CHECK nothing is written: it returns 1 as soon as a page
+// has another granulepos than the one we would write, the last page of
+// a stream may have a smaller one (encoders trim the end this way).
+// Damaged streams fail the check as well.
+int oggfix(char *src,char *dest,int flags,long interval,
+           const struct oggpager_rules *pages)
 {
-  ogg_sync_state   oy_in; /* sync and verify incoming physical bitstream */
+  struct oggsource in; /* sync and verify incoming physical bitstream */
   ogg_stream_state os_in; /* take physical pages, weld into a logical
                           stream of packets */
   ogg_stream_state os_out; /* take physical pages, weld into a logical
@@ -72,44 +131,84 @@ void oggfix(char *src,char *dest)
   vorbis_dsp_state vd_in; /* central working state for the packet->PCM decoder */
   vorbis_block     vb_in; /* local working space for packet->PCM decode */
 
-  char *buffer;
-
-
-  int  bytes;
+  int  res;
+
+  /* The sample count of a packet only depends on its blocksize and the
+     one of the previous packet, so in OGGFIX_FAST mode we don't need
+     to run the decoder at all. */
+  int  decode=!(flags&OGGFIX_FAST) || (flags&OGGFIX_VERIFY);
+  long lastbs;
+  long mismatches=0;
+  long wrong=0; /* pages -c would rewrite */
+  int check=(flags&OGGFIX_CHECK)!=0;
+  int completed;
+  ogg_int64_t granulepos=0;
+  struct oggpager pager; /* lays out the audio pages of the stream */
+  struct oggindex_writer index;
+  struct oggindex_writer *indexp=NULL;
+  char *indexname=NULL;
+  int ret=-1;
 
   FILE *inputfile;
   FILE *outputfile;
-
-  granulepos=0;
+  struct oggsink sink; /* the pages go out through it, in batches */
 
   if((inputfile=fopen(src,"r"))==0)
     {
       fprintf (stderr,
-	       "Error: Cannot open input file.\n");
-      exit(-1);
+	       "Error: %s: Cannot open input file.\n",src);
+      return -1;
     };
 
-  if(dest==NULL)
+  if(check)
+    outputfile=NULL;
+  else if(dest==NULL)
     outputfile=stdout;
   else
     {
       if((outputfile=fopen(dest,"w"))==0)
       {
-	fprintf (stderr,"Error: Cannot open output file.\n");
-	exit(-1);
+	fprintf (stderr,"Error: %s: Cannot open output file.\n",dest);
+	fclose(inputfile);
+	return -1;
       }  
     }
+  if(!check && oggsink_open_fd(&sink,fileno(outputfile),OGGSINK_BATCH)!=0)
+    {
+      fprintf (stderr,"Error: %s: Out of memory.\n",src);
+      fclose(inputfile);
+      if(dest!=NULL)
+	{
+	  fclose(outputfile);
+	  unlink(dest);
+	}
+      return -1;
+    }
   
 
   /********** Setup ************/
 
-  /* Initialize breaking the stream into pages */
-  ogg_sync_init(&oy_in);
+  /* Initialize breaking the stream into pages, mapping the file if we can */
+  oggsource_open_fd(&in,fileno(inputfile));
+
+  /* The index describes the first link, and goes along with dest */
+  oggindex_writer_init(&index,0,0,interval);
+  if((flags&OGGFIX_INDEX) && dest!=NULL)
+    {
+      if((indexname=malloc(strlen(dest)+5))==NULL)
+	{
+	  fprintf (stderr,"Error: %s: Out of memory.\n",src);
+	  goto cleanup;
+	}
+      strcpy(indexname,dest);
+      strcat(indexname,".idx");
+    }
       
   /* Since an ogg stream can be followed by another (and so on) we now
      go into an endless loop that decodes all streams this file contains.*/
   while(1){
     int eos=0;
+    int failed=0;
     int i;
 
     /* grab some data at the head of the stream. We want the first page
@@ -117,20 +216,15 @@ void oggfix(char *src,char *dest)
        stream initial header) We need the first page to get the stream
        serialno. */
 
-    /* submit a 4k block to libvorbis' Ogg layer */
-    buffer=ogg_sync_buffer(&oy_in,4096);
-    bytes=fread(buffer,1,4096,inputfile);
-    ogg_sync_wrote(&oy_in,bytes);
-    
     /* Get the first page. */
-    if(ogg_sync_pageout(&oy_in,&og_in)!=1){
+    if((res=oggsource_page(&in,&og_in))!=1){
       /* have we simply run out of data?  If so, we're done and this
 	 was the last stream in the file. */
-      if(bytes<4096)break;
+      if(res==0 && !in.error)break;
       
       /* error case.  Must not be Vorbis data */
-      fprintf(stderr,"Input does not appear to be an Ogg bitstream.\n");
-      exit(1);
+      fprintf(stderr,"%s: Input does not appear to be an Ogg bitstream.\n",src);
+      goto cleanup;
     }
   
     /* Get the serial number and set up the rest of decode. */
@@ -153,23 +247,24 @@ void oggfix(char *src,char *dest)
     vorbis_comment_init(&vc_in);
     if(ogg_stream_pagein(&os_in,&og_in)<0){ 
       /* error; stream version mismatch perhaps */
-      fprintf(stderr,"Error reading first page of Ogg bitstream data.\n");
-      exit(1);
+      fprintf(stderr,"%s: Error reading first page of Ogg bitstream data.\n",src);
+      goto stream_error;
     }
     
     if(ogg_stream_packetout(&os_in,&op_in)!=1){ 
       /* no page? must not be vorbis */
-      fprintf(stderr,"Error reading initial header packet.\n");
-      exit(1);
+      fprintf(stderr,"%s: Error reading initial header packet.\n",src);
+      goto stream_error;
     }
     // Write out the Ogg header
-    packetwrite(&os_out,&og_out,&op_in,outputfile);
+    if(!check && packetwrite(&os_out,&og_out,&op_in,granulepos,NULL,&sink,&vi_in,NULL)!=0)
+      goto write_error;
 
-    if(vorbis_synthesis_headerin(&vi_in,&vc_in,&op_in)<0){ 
+    if(vorbiscache_headerin(&vi_in,&vc_in,&op_in)<0){ 
       /* error case; not a vorbis header */
-      fprintf(stderr,"This Ogg bitstream does not contain Vorbis "
-              "audio data.\n");
-      exit(1);
+      fprintf(stderr,"%s: This Ogg bitstream does not contain Vorbis "
+              "audio data.\n",src);
+      goto stream_error;
     }
     
     /* At this point, we're sure we're Vorbis. We've set up the logical
@@ -184,49 +279,53 @@ void oggfix(char *src,char *dest)
     
     i=0;
     while(i<2){
-      while(i<2){
-        int result=ogg_sync_pageout(&oy_in,&og_in);
-        if(result==0)break; /* Need more data */
-        /* Don't complain about missing or corrupt data yet. We'll
-           catch it at the packet output phase */
-        if(result==1){
-          ogg_stream_pagein(&os_in,&og_in); /* we can ignore any errors here
-                                         as they'll also become apparent
-                                         at packetout */
-          while(i<2){
-            result=ogg_stream_packetout(&os_in,&op_in);
-            if(result==0)break;
-            if(result<0){
-              /* Uh oh; data at some point was corrupted or missing!
-                 We can't tolerate that in a header.  Die. */
-              fprintf(stderr,"Corrupt secondary header.  Exiting.\n");
-              exit(1);
-            }
-            result=vorbis_synthesis_headerin(&vi_in,&vc_in,&op_in);
-            if(result<0){
-              fprintf(stderr,"Corrupt secondary header.  Exiting.\n");
-              exit(1);
-            }
-	    // Copy this Vorbis header packet
-	    packetwrite(&os_out,&og_out,&op_in,outputfile);
-            i++;
+      int result=oggsource_page(&in,&og_in);
+      if(result==0){
+        fprintf(stderr,"%s: End of file before finding all Vorbis headers!\n",src);
+        goto stream_error;
+      }
+      /* Don't complain about missing or corrupt data yet. We'll
+         catch it at the packet output phase */
+      if(result==1){
+        ogg_stream_pagein(&os_in,&og_in); /* we can ignore any errors here
+                                       as they'll also become apparent
+                                       at packetout */
+        while(i<2){
+          result=ogg_stream_packetout(&os_in,&op_in);
+          if(result==0)break;
+          if(result<0){
+            /* Uh oh; data at some point was corrupted or missing!
+               We can't tolerate that in a header.  Die. */
+            fprintf(stderr,"%s: Corrupt secondary header.\n",src);
+            goto stream_error;
+          }
+          result=vorbiscache_headerin(&vi_in,&vc_in,&op_in);
+          if(result<0){
+            fprintf(stderr,"%s: Corrupt secondary header.\n",src);
+            goto stream_error;
           }
+	  // Copy this Vorbis header packet
+	  if(!check && packetwrite(&os_out,&og_out,&op_in,granulepos,NULL,&sink,&vi_in,NULL)!=0)
+	    goto write_error;
+          i++;
         }
       }
-      /* no harm in not checking before adding more */
-      buffer=ogg_sync_buffer(&oy_in,4096);
-      bytes=fread(buffer,1,4096,inputfile);
-      if(bytes==0 && i<2){
-        fprintf(stderr,"End of file before finding all Vorbis headers!\n");
-        exit(1);
-      }
-      ogg_sync_wrote(&oy_in,bytes);
     }
     
+    lastbs=0;
+    oggpager_init(&pager,oggpager_lookup(pages,os_out.serialno),
+                  vi_in.rate,granulepos);
+    if(indexname!=NULL && indexp==NULL)
+      {
+	oggindex_writer_init(&index,os_out.serialno,vi_in.rate,interval);
+	indexp=&index;
+      }
+
     /* Initialize the Vorbis
        packet->PCM decoder. */
-    if(vorbis_synthesis_init(&vd_in,&vi_in)==0){ /* central decode state */
-      vorbis_block_init(&vd_in,&vb_in);          /* local state for most of the decode
+    if(!decode || vorbiscache_synthesis_init(&vd_in,&vi_in)==0){ /* central decode state */
+      if(decode)
+        vorbis_block_init(&vd_in,&vb_in);        /* local state for most of the decode
                                               so multiple block decodes can
                                               proceed in parallel. We could init
                                               multiple vorbis_block structures
@@ -235,14 +334,19 @@ void oggfix(char *src,char *dest)
       /* The rest is just a straight decode loop until end of stream */
       while(!eos){
         while(!eos){
-          int result=ogg_sync_pageout(&oy_in,&og_in);
-          if(result==0)break; /* need more data */
+          int result=oggsource_page(&in,&og_in);
+          if(result==0)break; /* end of the input */
           if(result<0){ /* missing or corrupt data at this page position */
-            fprintf(stderr,"Corrupt or missing data in bitstream; "
-                    "continuing...\n");
+            fprintf(stderr,"%s: Corrupt or missing data in bitstream; "
+                    "continuing...\n",src);
+            if(check){
+              wrong++;
+              eos=1;
+            }
           }else{
             ogg_stream_pagein(&os_in,&og_in); /* can safely ignore errors at
                                            this point */
+            completed=0;
             while(1){
               result=ogg_stream_packetout(&os_in,&op_in);
               
@@ -253,44 +357,101 @@ void oggfix(char *src,char *dest)
                 /* we have a packet.  Decode it */
                 float **pcm;
                 int samples;
-                
-                if(vorbis_synthesis(&vb_in,&op_in)==0) /* test for success! */
-                  vorbis_synthesis_blockin(&vd_in,&vb_in);
-                /* 
-		   Now decode the current ogg packets just to be able
-		   to look how long this packet really is.
-                 */
-                while((samples=vorbis_synthesis_pcmout(&vd_in,&pcm))>0){
-		  granulepos+=samples;
-		  /* tell libvorbis how many samples we actually consumed */
-		  vorbis_synthesis_read(&vd_in,samples);
+                ogg_int64_t decoded=0;
+
+                if(decode){
+                  if(vorbis_synthesis(&vb_in,&op_in)==0) /* test for success! */
+                    vorbis_synthesis_blockin(&vd_in,&vb_in);
+                  /* 
+		     Now decode the current ogg packets just to be able
+		     to look how long this packet really is.
+                   */
+                  while((samples=vorbis_synthesis_pcmout(&vd_in,&pcm))>0){
+		    decoded+=samples;
+		    /* tell libvorbis how many samples we actually consumed */
+		    vorbis_synthesis_read(&vd_in,samples);
+                  }
                 }
 
+                if(flags&OGGFIX_FAST){
+                  /* Each packet overlaps half of the previous one: it
+                     completes (lastbs+bs)/4 samples, as in revorb. */
+                  long bs=vorbis_packet_blocksize(&vi_in,&op_in);
+                  ogg_int64_t counted=0;
+
+                  if(bs>0){
+                    if(lastbs>0)
+                      counted=(lastbs+bs)/4;
+                    lastbs=bs;
+                  }
+                  if(decode && counted!=decoded){
+                    fprintf(stderr,"Warning: packet %lld: %lld samples "
+                            "decoded, %lld from the blocksizes.\n",
+                            (long long)op_in.packetno,(long long)decoded,
+                            (long long)counted);
+                    mismatches++;
+                  }
+                  granulepos+=counted;
+                }else
+                  granulepos+=decoded;
+
+		completed++;
 		/* Copy this packet to the output stream. The
 		   packetwrite function makes sure the packet is fixed
 		   before being written.*/
-		packetwrite(&os_out,&og_out,&op_in,outputfile);
-		
+		if(!check && packetwrite(&os_out,&og_out,&op_in,granulepos,&pager,&sink,&vi_in,indexp)!=0){
+		  failed=1;
+		  eos=1;
+		  break;
+		}
 	      }
             }
+            if(check){
+              ogg_int64_t found=ogg_page_granulepos(&og_in);
+              ogg_int64_t expected=completed ? granulepos : -1;
+
+              if(found!=expected &&
+                 !(ogg_page_eos(&og_in) && completed && found>=0 && found<expected)){
+                fprintf(stderr,"%s: page %ld has granulepos %lld instead "
+                        "of %lld.\n",src,ogg_page_pageno(&og_in),
+                        (long long)found,(long long)expected);
+                wrong++;
+                eos=1;
+              }
+            }
             if(ogg_page_eos(&og_in))eos=1;
           }
         }
         if(!eos){
-          buffer=ogg_sync_buffer(&oy_in,4096);
-          bytes=fread(buffer,1,4096,inputfile);
-          ogg_sync_wrote(&oy_in,bytes);
-          if(bytes==0)eos=1;
+          /* the input ended before the stream did */
+          if(check){
+            fprintf(stderr,"%s: Stream has no end of stream page.\n",src);
+            wrong++;
+          }
+          eos=1;
         }
       }
       
       /* ogg_page and ogg_packet structs always point to storage in
          libvorbis.  They're never freed or manipulated directly */
       
-      vorbis_block_clear(&vb_in);
-      vorbis_dsp_clear(&vd_in);
+      if(decode){
+        vorbis_block_clear(&vb_in);
+        vorbis_dsp_clear(&vd_in);
+      }
     }else{
-      fprintf(stderr,"Error: Corrupt header during playback initialization.\n");
+      fprintf(stderr,"Error: %s: Corrupt header during playback initialization.\n",src);
+    }
+    /* whatever is left goes into the last page, even if the input was cut */
+    if(!check && !failed && pagewrite(&os_out,&og_out,&pager,&sink,&vi_in,indexp)!=0)
+      failed=1;
+    if(failed)
+      goto write_error;
+    if(!check && (flags&OGGFIX_PAGES))
+      oggpager_report(&pager,stderr,src,os_out.serialno);
+    if(check && wrong>0){
+      ret=1;
+      goto stream_error;
     }
 
     /* clean up this logical bitstream; before exit we see if we're
@@ -299,16 +460,171 @@ void oggfix(char *src,char *dest)
     ogg_stream_clear(&os_in);
     ogg_stream_clear(&os_out);
     vorbis_comment_clear(&vc_in);
-    vorbis_info_clear(&vi_in);  /* must be called last */
+    vorbiscache_info_clear(&vi_in);  /* must be called last */
   }
   
+  if((flags&OGGFIX_VERIFY) && !check)
+    fprintf(stderr,"%s: %ld packet(s) where decoding and blocksizes "
+            "disagree.\n",src,mismatches);
+  if(indexname!=NULL)
+    {
+      FILE *indexfile=fopen(indexname,"wb");
+      int written=indexfile!=NULL && oggindex_write(&index,indexfile)==0;
+
+      if(indexfile!=NULL && fclose(indexfile)!=0)
+	written=0;
+      if(!written)
+	{
+	  fprintf(stderr,"Error: %s: Cannot write the seek index.\n",indexname);
+	  goto cleanup;
+	}
+    }
+  ret=0;
+  goto cleanup;
+
+ write_error:
+  fprintf(stderr,"Error: %s: Cannot write to output file.\n",src);
+ stream_error:
+  ogg_stream_clear(&os_in);
+  ogg_stream_clear(&os_out);
+  vorbis_comment_clear(&vc_in);
+  vorbiscache_info_clear(&vi_in);
+
+ cleanup:
   /* OK, clean up the framer */
-  ogg_sync_clear(&oy_in);
+  oggsource_close(&in);
   
   // close the files
   fclose(inputfile);
-  if(dest!=NULL)
-    fclose(outputfile);
+  if(!check && oggsink_close(&sink)!=0 && ret==0){
+    fprintf(stderr,"Error: %s: Cannot write to output file.\n",src);
+    ret=-1;
+  }
+  if(!check && dest!=NULL){
+    if(fclose(outputfile)!=0)
+      ret=-1;
+    /* don't leave a half written file behind */
+    if(ret!=0)
+      unlink(dest);
+  }
+  if(indexname!=NULL){
+    if(ret!=0)
+      unlink(indexname);
+    free(indexname);
+  }
+  oggindex_writer_clear(&index);
+  return ret;
+}
+
+/* One file of a -d or -c batch, and what became of it. */
+struct job
+{
+  char *src;
+  int status;
+};
+
+/* The -d batch: workers pick the next job until there is none left. Each
+   worker only ever holds one file, mapped or read OGGSOURCE_CHUNK bytes
+   at a time, so memory does not grow with the number of files. */
+struct pool
+{
+  struct job *jobs;
+  int njobs;
+  int next;
+  char *outputdir;
+  int flags;
+  long interval;
+  const struct oggpager_rules *pages;
+  pthread_mutex_t lock;
+};
+
+/* The base name of the input file without directory part: A file name
+   beginning with ../ may otherwise lead to writing data somewhere we
+   don't want to.*/
+static const char *base_name(const char *src)
+{
+  const char *slash=strrchr(src,'/');
+  return slash==NULL?src:slash+1;
+}
+
+static int compare_base_names(const void *a, const void *b)
+{
+  return strcmp(base_name(*(char *const *)a),base_name(*(char *const *)b));
+}
+
+/* Makes sure that no two of the njobs files of jobs are written to the
+   same output file in outputdir, which they would be with the same base name: two
+   workers would then write it at once, and the one failing would unlink
+   what the other wrote. Returns 0 if none are, -1 otherwise. */
+static int check_outputs(const struct job *jobs, int njobs,
+			 const char *outputdir)
+{
+  char **srcs;
+  int index, ret=0;
+
+  if((srcs=malloc(njobs*sizeof(char *)))==NULL)
+    {
+      fprintf (stderr, "Error: Out of memory.\n");
+      return -1;
+    }
+  for (index = 0; index < njobs; index++)
+    srcs[index]=jobs[index].src;
+  qsort(srcs,njobs,sizeof(char *),compare_base_names);
+  for (index = 1; index < njobs; index++)
+    if (compare_base_names(&srcs[index-1],&srcs[index]) == 0)
+      {
+	fprintf (stderr, "Error: %s and %s would both be written to %s/%s.\n",
+		 srcs[index-1], srcs[index], outputdir, base_name(srcs[index]));
+	ret=-1;
+      }
+  free(srcs);
+  return ret;
+}
+
+void *worker(void *arg)
+{
+  struct pool *pool=arg;
+  struct job *job;
+  const char *basename_pos;
+  char *outputfilename;
+  int index;
+
+  while(1)
+    {
+      pthread_mutex_lock(&pool->lock);
+      index=pool->next++;
+      pthread_mutex_unlock(&pool->lock);
+      if(index>=pool->njobs)
+	break;
+      job=&pool->jobs[index];
+
+      if(pool->flags&OGGFIX_CHECK)
+	{
+	  job->status=oggfix(job->src,NULL,pool->flags,pool->interval,pool->pages);
+	  continue;
+	}
+
+      basename_pos=base_name(job->src);
+
+      outputfilename=malloc(strlen(basename_pos)+strlen(pool->outputdir)+2);
+      if(outputfilename==NULL)
+	{
+	  job->status=-1;
+	  continue;
+	}
+      strcpy(outputfilename,pool->outputdir);
+      strcat(outputfilename,"/");
+      strcat(outputfilename,basename_pos);
+
+      fprintf (stderr,
+	       "%i of %i: %s => %s.\n",
+	       index+1, pool->njobs, job->src, outputfilename);
+
+      job->status=oggfix(job->src,outputfilename,pool->flags,pool->interval,
+			 pool->pages);
+      free(outputfilename);
+    }
+  return NULL;
 }
 
 
@@ -317,7 +633,21 @@ int main (int argc, char **argv)
   char *outputdir=NULL;
   int index;
   int c;
-  char *outputfilename;
+  int flags=0;
+  int nworkers=1;
+  int failures=0;
+  int mismatches=0;
+  long interval=OGGINDEX_INTERVAL;
+  struct oggpager_rules pages;
+  static struct option long_options[]={
+    {"check",  no_argument,0,'c'},
+    {"fast",   no_argument,0,'f'},
+    {"verify", no_argument,0,'v'},
+    {"index",  no_argument,0,'x'},
+    {"index-interval", required_argument,0,'t'},
+    {"pages",  required_argument,0,'p'},
+    {0,0,0,0}
+  };
 
 #ifdef _WIN32 /* We need to set stdin/stdout to binary mode. */
   _setmode( _fileno( stdin ), _O_BINARY );
@@ -326,17 +656,54 @@ int main (int argc, char **argv)
 
 
   opterr = 0;
+  pages.count = 0;
   
-  while ((c = getopt (argc, argv, "d:")) != -1)
+  while ((c = getopt_long (argc, argv, "cd:fj:p:t:vx", long_options, NULL)) != -1)
     switch (c)
       {
+      case 'j':
+	nworkers = atoi(optarg);
+	if (nworkers < 1)
+	  {
+	    fprintf (stderr, "Invalid number of jobs: %s.\n", optarg);
+	    return 1;
+	  }
+	break;
+      case 't':
+	interval = atol(optarg);
+	if (interval < 1)
+	  {
+	    fprintf (stderr, "Invalid index interval: %s.\n", optarg);
+	    return 1;
+	  }
+	break;
+      case 'p':
+	if (oggpager_parse(&pages, optarg) != 0)
+	  {
+	    fprintf (stderr, "Invalid page policy: %s.\n", optarg);
+	    return 1;
+	  }
+	flags |= OGGFIX_PAGES;
+	break;
+      case 'c':
+	flags |= OGGFIX_FAST | OGGFIX_CHECK;
+	break;
+      case 'x':
+	flags |= OGGFIX_INDEX;
+	break;
+      case 'f':
+	flags |= OGGFIX_FAST;
+	break;
+      case 'v':
+	flags |= OGGFIX_FAST | OGGFIX_VERIFY;
+	break;
       case 'd':
 	outputdir = optarg;
 	mkdir(outputdir,0777);
 	fprintf (stderr, "Setting the output directory to %s.\n", optarg);
 	break;
       case '?':
-	if (optopt == 'c')
+	if (optopt == 'd' || optopt == 'j' || optopt == 'p' || optopt == 't')
 	  fprintf (stderr, "Option -%c requires an argument.\n", optopt);
 	else if (isprint (optopt))
 	  fprintf (stderr, "Unknown option `-%c'.\n", optopt);
@@ -360,11 +727,37 @@ int main (int argc, char **argv)
       fprintf (stderr,
 	       "For to fix a bunch of ogg files and to output them into a directory:\n");
       fprintf (stderr,
-	       "%s -d <dirname> <filename> <filename> ...\n",argv[0]);
+	       "%s [-j <jobs>] -d <dirname> <filename> <filename> ...\n\n",argv[0]);
+      fprintf (stderr,
+	       "For to list the ogg files which need to be fixed:\n");
+      fprintf (stderr,
+	       "%s [-j <jobs>] -c <filename> <filename> ...\n\n",argv[0]);
+      fprintf (stderr,
+	       "Options:\n"
+	       "  -c, --check   write nothing, print the files which need a fix\n"
+	       "                and exit with 3 if there is any\n"
+	       "  -f, --fast    count samples from the packet blocksizes instead\n"
+	       "                of decoding the audio (much faster)\n"
+	       "  -v, --verify  like --fast, but decode too and report every packet\n"
+	       "                where both counts differ\n"
+	       "  -j <jobs>     fix up to <jobs> files at once with -d or -c\n"
+	       "  -p, --pages <policy>\n"
+	       "                audio page layout, and report the page overhead:\n"
+	       "                live, archive, or <bytes>[/<ms>] per page; for one\n"
+	       "                logical stream only with <serial>:<policy>\n"
+	       "  -x, --index   with -d, also write a seek index to <output>.idx\n"
+	       "  -t, --index-interval <ms>\n"
+	       "                audio between two index entries (default %d)\n",
+	       OGGINDEX_INTERVAL);
       return 1;
     }
   
-  if(outputdir == NULL)
+  if(outputdir != NULL && (flags & OGGFIX_CHECK))
+    {
+      fprintf (stderr, "Error: -c writes nothing, it takes no -d.\n");
+      return 1;
+    }
+  if(outputdir == NULL && !(flags & OGGFIX_CHECK))
     {
       if (optind != argc-1)
 	{
@@ -372,35 +765,78 @@ int main (int argc, char **argv)
 		   "Error: More than one file name given (%i) and no outputdir.\n",
 		   optind - argc);
 	  return 1;
-	} else
-	oggfix(argv[optind],NULL);
+	}
+      if (flags & OGGFIX_INDEX)
+	{
+	  fprintf (stderr, "Error: -x needs an output directory (-d).\n");
+	  return 1;
+	}
+      return oggfix(argv[optind],NULL,flags,interval,&pages)==0 ? 0 : 1;
     }
   else
     {
-      for (index = optind; index < argc; index++)
-	{
-	  char *basename_pos;
-
-	  /* Find the bae name of the input file with out directory
-	  part: A file name beginning with ../ may otherwise lead to
-	  writing data somewhere we don't want to.*/
-	  basename_pos= argv[optind];
-	  while(strchr(basename_pos,'/')!=basename_pos)
-	    basename_pos=strchr(basename_pos,'/');
+      struct pool pool;
+      pthread_t *threads;
 
-	  outputfilename=malloc(strlen(basename_pos)+strlen(outputdir)+2);
-	  strcpy(outputfilename,outputdir);
-	  strcat(outputfilename,"/");
-	  strcat(outputfilename,basename_pos);
-
-	  fprintf (stderr,
-		   "%i of %i: %s => %s.\n",
-		   index-optind+1, argc -optind ,argv[index],outputfilename);
-	  
-	  oggfix(argv[index],outputfilename);
-	  free(outputfilename);
+      pool.njobs=argc-optind;
+      pool.jobs=calloc(pool.njobs,sizeof(struct job));
+      threads=calloc(nworkers,sizeof(pthread_t));
+      if(pool.jobs==NULL || threads==NULL)
+	{
+	  fprintf (stderr, "Error: Out of memory.\n");
+	  return 1;
+	}
+      for (index = 0; index < pool.njobs; index++)
+	pool.jobs[index].src=argv[optind+index];
+      if (!(flags & OGGFIX_CHECK) && check_outputs(pool.jobs,pool.njobs,
+						 outputdir) != 0)
+	{
+	  free(threads);
+	  free(pool.jobs);
+	  return 1;
 	}
+      pool.next=0;
+      pool.outputdir=outputdir;
+      pool.flags=flags;
+      pool.interval=interval;
+      pool.pages=&pages;
+      pthread_mutex_init(&pool.lock,NULL);
+
+      if (nworkers > pool.njobs)
+	nworkers = pool.njobs;
+      /* The main thread is a worker too */
+      for (index = 1; index < nworkers; index++)
+	if (pthread_create(&threads[index],NULL,worker,&pool) != 0)
+	  {
+	    fprintf (stderr, "Warning: Could only start %i worker(s).\n", index);
+	    nworkers = index;
+	    break;
+	  }
+      worker(&pool);
+      for (index = 1; index < nworkers; index++)
+	pthread_join(threads[index],NULL);
+
+      for (index = 0; index < pool.njobs; index++)
+	if (pool.jobs[index].status == 1)
+	  {
+	    printf ("%s\n", pool.jobs[index].src);
+	    mismatches++;
+	  }
+	else if (pool.jobs[index].status != 0)
+	  {
+	    fprintf (stderr, "Failed: %s.\n", pool.jobs[index].src);
+	    failures++;
+	  }
+      if (failures > 0)
+	fprintf (stderr, "%i of %i file(s) could not be %s.\n",
+		 failures, pool.njobs,
+		 (flags & OGGFIX_CHECK) ? "read" : "fixed");
+
+      pthread_mutex_destroy(&pool.lock);
+      free(threads);
+      free(pool.jobs);
     }
-  return 0;
+  if (failures > 0)
+    return 1;
+  return mismatches > 0 ? 3 : 0;
 }
-
@@ -0,0 +1,294 @@
+/*
+ * oggindex.c
+ *
+ * Seek index sidecar files, see oggindex.h for the format.
+ */
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "oggindex.h"
+
+
+static void
+put32(unsigned char *p, ogg_uint32_t v)
+{
+
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+	p[2] = (v >> 16) & 0xff;
+	p[3] = (v >> 24) & 0xff;
+}
+
+
+static void
+put64(unsigned char *p, ogg_int64_t v)
+{
+
+	put32(p, v & 0xffffffff);
+	put32(p + 4, (v >> 32) & 0xffffffff);
+}
+
+
+static ogg_uint32_t
+get32(const unsigned char *p)
+{
+
+	return (p[0] | (p[1] << 8) | (p[2] << 16) | ((ogg_uint32_t)p[3] << 24));
+}
+
+
+static ogg_int64_t
+get64(const unsigned char *p)
+{
+
+	return ((ogg_int64_t)(get32(p) | ((unsigned long long)get32(p + 4) << 32)));
+}
+
+
+/**
+ * setup w for a stream of the given serial number and sample rate, keeping
+ * at most one entry every interval_ms milliseconds of audio.
+ */
+void
+oggindex_writer_init(struct oggindex_writer *w, int serialno, long rate,
+    long interval_ms)
+{
+
+	(void)memset(w, 0, sizeof(struct oggindex_writer));
+	w->serialno = serialno;
+	w->rate = rate;
+	w->interval = (ogg_int64_t)rate * interval_ms / 1000;
+}
+
+
+/**
+ * record that a packet with the given granulepos begins on the page written
+ * at offset. It is dropped if it is less than the interval away from the
+ * last entry.
+ *
+ * return 0 on success and -1 on error (out of memory).
+ */
+int
+oggindex_add(struct oggindex_writer *w, ogg_int64_t granulepos,
+    ogg_int64_t offset)
+{
+	struct oggindex_entry *e;
+	size_t size;
+
+	if (w->count > 0 &&
+	    granulepos < w->entries[w->count - 1].granulepos + w->interval)
+		return (0);
+
+	if (w->count == w->size) {
+		size = (w->size > 0 ? 2 * w->size : 256);
+		e = realloc(w->entries, size * sizeof(struct oggindex_entry));
+		if (e == NULL)
+			return (-1);
+		w->entries = e;
+		w->size = size;
+	}
+	w->entries[w->count].granulepos = granulepos;
+	w->entries[w->count].offset = offset;
+	w->count++;
+	return (0);
+}
+
+
+/**
+ * record the audio page p, written at offset, when it belongs to the stream
+ * indexed by w. This is for callers going through pages rather than
+ * packets: the granulepos of the first packet beginning on p is worked out
+ * from the previous page granulepos and the blocksizes, which only take the
+ * first byte of each packet.
+ *
+ * return 0 on success and -1 on error (out of memory).
+ */
+int
+oggindex_add_page(struct oggindex_writer *w, vorbis_info *vi,
+    const ogg_page *p, ogg_int64_t offset)
+{
+	ogg_packet op;
+	long pos = 0;
+	int i, nsegs = p->header[26], start, first = 1, bs;
+
+	if (ogg_page_serialno(p) != w->serialno)
+		return (0);
+
+	(void)memset(&op, 0, sizeof(ogg_packet));
+	start = !ogg_page_continued(p);
+	for (i = 0; i < nsegs; pos += p->header[27 + i], i++) {
+		if (!start) {
+			start = (p->header[27 + i] < 255);
+			first = 0;
+			continue;
+		}
+		start = (p->header[27 + i] < 255);
+		op.packet = p->body + pos;
+		op.bytes = p->body_len - pos;
+		if (op.bytes == 0 || (bs = vorbis_packet_blocksize(vi, &op)) < 0) {
+			first = 0;
+			continue;
+		}
+		/* when nothing began on the previous page, its granulepos is
+		   the one of the packet just before */
+		if (first && w->lastgranulepos >= 0 &&
+		    oggindex_add(w, w->lastgranulepos +
+		    (w->lastbs ? (w->lastbs + bs) / 4 : 0), offset) != 0)
+			return (-1);
+		first = 0;
+		w->lastbs = bs;
+	}
+	w->lastgranulepos = ogg_page_granulepos(p);
+	return (0);
+}
+
+
+/**
+ * write the index collected by w into fp.
+ *
+ * return 0 on success and -1 on error.
+ */
+int
+oggindex_write(const struct oggindex_writer *w, FILE *fp)
+{
+	unsigned char buf[OGGINDEX_HEADER_LEN];
+	size_t i;
+
+	(void)memcpy(buf, OGGINDEX_MAGIC, 8);
+	put32(buf + 8, w->serialno);
+	put32(buf + 12, w->rate);
+	put64(buf + 16, w->count);
+	if (fwrite(buf, 1, OGGINDEX_HEADER_LEN, fp) != OGGINDEX_HEADER_LEN)
+		return (-1);
+
+	for (i = 0; i < w->count; i++) {
+		put64(buf, w->entries[i].granulepos);
+		put64(buf + 8, w->entries[i].offset);
+		if (fwrite(buf, 1, OGGINDEX_ENTRY_LEN, fp) != OGGINDEX_ENTRY_LEN)
+			return (-1);
+	}
+	return (0);
+}
+
+
+void
+oggindex_writer_clear(struct oggindex_writer *w)
+{
+
+	free(w->entries);
+	(void)memset(w, 0, sizeof(struct oggindex_writer));
+}
+
+
+/**
+ * map the index file at path into idx.
+ *
+ * return 0 on success and -1 on error (unreadable or not an index).
+ */
+int
+oggindex_open(struct oggindex *idx, const char *path)
+{
+	const unsigned char *p;
+	ogg_int64_t count;
+	int fd, ret = -1;
+
+	(void)memset(idx, 0, sizeof(struct oggindex));
+#ifdef _WIN32
+	if ((fd = open(path, O_RDONLY | O_BINARY)) == -1)
+		return (-1);
+	idx->maplen = _filelength(fd);
+	if ((long)idx->maplen < OGGINDEX_HEADER_LEN ||
+	    (idx->map = malloc(idx->maplen)) == NULL)
+		goto out;
+	if (read(fd, idx->map, idx->maplen) != (int)idx->maplen)
+		goto out;
+#else
+	struct stat st;
+
+	if ((fd = open(path, O_RDONLY)) == -1)
+		return (-1);
+	if (fstat(fd, &st) == -1 || st.st_size < OGGINDEX_HEADER_LEN)
+		goto out;
+	idx->maplen = st.st_size;
+	idx->map = mmap(NULL, idx->maplen, PROT_READ, MAP_SHARED, fd, 0);
+	if (idx->map == MAP_FAILED) {
+		idx->map = NULL;
+		goto out;
+	}
+#endif
+
+	p = idx->map;
+	if (memcmp(p, OGGINDEX_MAGIC, 8) != 0)
+		goto out;
+	idx->serialno = (int)get32(p + 8);
+	idx->rate = (long)get32(p + 12);
+	count = get64(p + 16);
+	if (count < 0 || count >
+	    (ogg_int64_t)(idx->maplen - OGGINDEX_HEADER_LEN) / OGGINDEX_ENTRY_LEN)
+		goto out;
+	idx->count = count;
+	idx->entries = p + OGGINDEX_HEADER_LEN;
+	ret = 0;
+	/* FALLTHROUGH */
+out:
+	(void)close(fd);
+	if (ret != 0)
+		oggindex_close(idx);
+	return (ret);
+}
+
+
+/**
+ * find the last entry of idx at or before granulepos, by bisecting the
+ * mapped entries.
+ *
+ * return 0 and fill entry on success, -1 when granulepos is before the first
+ * entry (or the index is empty).
+ */
+int
+oggindex_lookup(const struct oggindex *idx, ogg_int64_t granulepos,
+    struct oggindex_entry *entry)
+{
+	size_t lo = 0, hi = idx->count, mid;
+	const unsigned char *e;
+
+	/* find the first entry past granulepos */
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (get64(idx->entries + mid * OGGINDEX_ENTRY_LEN) <= granulepos)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == 0)
+		return (-1);
+
+	e = idx->entries + (lo - 1) * OGGINDEX_ENTRY_LEN;
+	entry->granulepos = get64(e);
+	entry->offset = get64(e + 8);
+	return (0);
+}
+
+
+void
+oggindex_close(struct oggindex *idx)
+{
+
+	if (idx->map != NULL) {
+#ifdef _WIN32
+		free(idx->map);
+#else
+		(void)munmap(idx->map, idx->maplen);
+#endif
+	}
+	(void)memset(idx, 0, sizeof(struct oggindex));
+}
@@ -0,0 +1,93 @@
+/*
+ * oggindex.h
+ *
+ * Seek index sidecar files for Ogg Vorbis streams.
+ *
+ * revorb and oggfix_granulepos know the granule position and the output
+ * offset of every page they write, so they can save them next to the file
+ * (-x) instead of letting every player bisect it later. An index is a flat
+ * little-endian file:
+ *
+ *   offset  size  field
+ *        0     8  magic, "OggIdx1\n"
+ *        8     4  serial number of the (first) logical stream
+ *       12     4  sample rate of the (first) logical stream
+ *       16     8  entry count
+ *       24  16*n  entries: granulepos (int64), byte offset (int64)
+ *
+ * Entries are sorted by granulepos. An entry is the offset of a page on which
+ * a packet begins, and the granulepos of that packet: decoding from there
+ * gives every sample from the granulepos on. They are sampled, by default
+ * every OGGINDEX_INTERVAL milliseconds of audio.
+ *
+ * Compile oggindex.c along with the tool using it, i.e.
+ *   cc -c oggindex.c skeleton.c oggcrc.c vorbiscache.c oggaio.c oggsink.c \
+ *       oggsource.c oggpager.c oggreplace.c
+ *   c++ revorb.cpp oggindex.o skeleton.o oggcrc.o vorbiscache.o oggaio.o \
+ *       oggsink.o oggsource.o oggpager.o oggreplace.o -logg -lvorbis \
+ *       -lpthread
+ */
+#ifndef OGGINDEX_H
+#define	OGGINDEX_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "ogg/ogg.h"
+#include "vorbis/codec.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define	OGGINDEX_MAGIC		"OggIdx1\n"
+#define	OGGINDEX_HEADER_LEN	24
+#define	OGGINDEX_ENTRY_LEN	16
+#define	OGGINDEX_INTERVAL	1000	/* default milliseconds between entries */
+
+struct oggindex_entry {
+	ogg_int64_t	granulepos;
+	ogg_int64_t	offset;
+};
+
+/* collects the entries while a file is written. */
+struct oggindex_writer {
+	int	serialno;
+	long	rate;
+	ogg_int64_t	interval;	/* granulepos units between two entries */
+	struct oggindex_entry	*entries;
+	size_t	count, size;
+	/* used by oggindex_add_page() */
+	int	lastbs;			/* blocksize of the last packet begun */
+	ogg_int64_t	lastgranulepos;	/* granulepos of the last page */
+};
+
+/* a mapped index file. */
+struct oggindex {
+	int	serialno;
+	long	rate;
+	size_t	count;
+	const unsigned char	*entries;
+	void	*map;
+	size_t	maplen;
+};
+
+void	oggindex_writer_init(struct oggindex_writer *w, int serialno,
+	    long rate, long interval_ms);
+int	oggindex_add(struct oggindex_writer *w, ogg_int64_t granulepos,
+	    ogg_int64_t offset);
+int	oggindex_add_page(struct oggindex_writer *w, vorbis_info *vi,
+	    const ogg_page *p, ogg_int64_t offset);
+int	oggindex_write(const struct oggindex_writer *w, FILE *fp);
+void	oggindex_writer_clear(struct oggindex_writer *w);
+
+int	oggindex_open(struct oggindex *idx, const char *path);
+int	oggindex_lookup(const struct oggindex *idx, ogg_int64_t granulepos,
+	    struct oggindex_entry *entry);
+void	oggindex_close(struct oggindex *idx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* OGGINDEX_H */
@@ -0,0 +1,343 @@
+/*
+ * oggpager.c
+ *
+ * Output pagination policies, see oggpager.h.
+ */
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "oggpager.h"
+
+
+/**
+ * add the policy given as [serialno:]fill[/ms] or [serialno:]name to r. A
+ * policy for the same streams as an earlier one replaces it.
+ *
+ * return 0 on success and -1 if arg is not a policy or r is full.
+ */
+int
+oggpager_parse(struct oggpager_rules *r, const char *arg)
+{
+	struct oggpager_rule rule;
+	const char *p, *colon;
+	char *end;
+	unsigned long serialno;
+	int i;
+
+	rule.all = 1;
+	rule.serialno = 0;
+	p = arg;
+	if ((colon = strchr(arg, ':')) != NULL) {
+		if (!isdigit((unsigned char)*arg))
+			return (-1);
+		serialno = strtoul(arg, &end, 0);
+		if (end != colon || serialno > 0xffffffffUL)
+			return (-1);
+		rule.all = 0;
+		rule.serialno = (ogg_uint32_t)serialno;
+		p = colon + 1;
+	}
+
+	rule.policy.fill = OGGPAGER_FILL;
+	rule.policy.span = 0;
+	if (strcmp(p, "live") == 0)
+		rule.policy.span = OGGPAGER_LIVE_SPAN;
+	else if (strcmp(p, "archive") == 0)
+		rule.policy.fill = OGGPAGER_MAXFILL;
+	else if (strcmp(p, "default") != 0) {
+		if (*p != '/') {
+			if (!isdigit((unsigned char)*p))
+				return (-1);
+			rule.policy.fill = strtol(p, &end, 10);
+			if (rule.policy.fill < 1 ||
+			    rule.policy.fill > OGGPAGER_MAXFILL)
+				return (-1);
+			p = end;
+		}
+		if (*p == '/') {
+			if (!isdigit((unsigned char)p[1]))
+				return (-1);
+			rule.policy.span = strtol(p + 1, &end, 10);
+			if (rule.policy.span < 0)
+				return (-1);
+			p = end;
+		}
+		if (*p != '\0')
+			return (-1);
+	}
+
+	for (i = 0; i < r->count; i++)
+		if (r->rule[i].all == rule.all &&
+		    r->rule[i].serialno == rule.serialno) {
+			r->rule[i] = rule;
+			return (0);
+		}
+	if (r->count == OGGPAGER_RULES)
+		return (-1);
+	r->rule[r->count++] = rule;
+	return (0);
+}
+
+
+/**
+ * find the policy for the logical stream serialno in r, the one given for
+ * it before the one given for every stream.
+ *
+ * return the policy, or NULL for the default one.
+ */
+const struct oggpager_policy *
+oggpager_lookup(const struct oggpager_rules *r, ogg_uint32_t serialno)
+{
+	const struct oggpager_policy *all = NULL;
+	int i;
+
+	for (i = 0; r != NULL && i < r->count; i++) {
+		if (!r->rule[i].all && r->rule[i].serialno == serialno)
+			return (&r->rule[i].policy);
+		if (r->rule[i].all)
+			all = &r->rule[i].policy;
+	}
+	return (all);
+}
+
+
+/**
+ * set pg up to lay out pages with policy p (the default one if NULL), for
+ * a stream of rate samples per second, from granulepos on.
+ */
+void
+oggpager_init(struct oggpager *pg, const struct oggpager_policy *p,
+    long rate, ogg_int64_t granulepos)
+{
+
+	pg->fill = (p != NULL ? p->fill : OGGPAGER_FILL);
+	pg->span = 0;
+	if (p != NULL && p->span > 0) {
+		pg->span = (ogg_int64_t)p->span * rate / 1000;
+		if (pg->span < 1)
+			pg->span = 1;
+	}
+	pg->bytes = 0;
+	pg->segs = 0;
+	pg->start = pg->last = granulepos;
+	pg->pages = 0;
+	pg->header_bytes = 0;
+	pg->body_bytes = 0;
+}
+
+
+/**
+ * tell whether the pages must be flushed before adding a packet ending at
+ * granulepos, to keep them within the span of the policy.
+ *
+ * return 1 if so, 0 otherwise.
+ */
+int
+oggpager_due(const struct oggpager *pg, ogg_int64_t granulepos)
+{
+
+	return (pg->span > 0 && pg->segs > 0 &&
+	    granulepos - pg->start > pg->span);
+}
+
+
+/**
+ * account for a packet of bytes bytes ending at granulepos.
+ *
+ * return 1 when the pages should be flushed after it, 0 otherwise.
+ */
+int
+oggpager_add(struct oggpager *pg, long bytes, ogg_int64_t granulepos)
+{
+
+	pg->bytes += bytes;
+	pg->segs += bytes / 255 + 1;
+	pg->last = granulepos;
+	return (pg->bytes >= pg->fill || pg->segs >= 255);
+}
+
+
+/**
+ * account for the pages ogg_stream_flush_fill(3) makes of the packets
+ * added since the last flush, with a fill of OGGPAGER_MAXFILL: a page
+ * every 255 lacing values.
+ *
+ * return the bytes these pages take.
+ */
+ogg_int64_t
+oggpager_flushed(struct oggpager *pg)
+{
+	long pages;
+	ogg_int64_t header;
+
+	if (pg->segs == 0)
+		return (0);
+	pages = (pg->segs + 254) / 255;
+	header = 27 * pages + pg->segs;
+	pg->pages += pages;
+	pg->header_bytes += header;
+	pg->body_bytes += pg->bytes;
+	pg->start = pg->last;
+	header += pg->bytes;
+	pg->bytes = 0;
+	pg->segs = 0;
+	return (header);
+}
+
+
+/**
+ * print how many pages pg has flushed and the share of their headers to
+ * fp, for the logical stream serialno of name (if not NULL).
+ */
+void
+oggpager_report(const struct oggpager *pg, FILE *fp, const char *name,
+    ogg_uint32_t serialno)
+{
+	ogg_int64_t total;
+
+	total = pg->header_bytes + pg->body_bytes;
+	(void)fprintf(fp, "%s%sstream %08lx: %ld audio pages, %lld of %lld "
+	    "bytes (%.2f%%) in page headers.\n", name != NULL ? name : "",
+	    name != NULL ? ": " : "", (unsigned long)serialno, pg->pages,
+	    (long long)pg->header_bytes, (long long)total,
+	    total > 0 ? 100.0 * pg->header_bytes / total : 0.0);
+}
+
+
+/**
+ * set po up to feed os, laid out by pg. page is given every page flushed
+ * and start, if not NULL, the granulepos of every packet starting a page,
+ * just before it goes in; both get arg and return 0, or -1 to stop.
+ */
+void
+oggpager_out_init(struct oggpager_out *po, ogg_stream_state *os,
+    struct oggpager *pg, oggpager_page_func page, oggpager_start_func start,
+    void *arg)
+{
+
+	po->os = os;
+	po->pg = pg;
+	po->page = page;
+	po->start = start;
+	po->arg = arg;
+	(void)memset(&po->held, 0, sizeof(po->held));
+	po->size = 0;
+	po->holding = 0;
+	po->eos = 0;
+}
+
+
+/**
+ * put the packet held by po in its stream, ending it if eos is not 0, and
+ * flush the pages where its policy says.
+ *
+ * return 0 on success and -1 on error.
+ */
+static int
+out_submit(struct oggpager_out *po, int eos)
+{
+	ogg_int64_t granulepos;
+
+	granulepos = po->held.granulepos;
+	po->holding = 0;
+	if (oggpager_due(po->pg, granulepos) && oggpager_out_flush(po) == -1)
+		return (-1);
+	if (po->pg->segs == 0 && po->start != NULL &&
+	    po->start(po->arg, granulepos) != 0)
+		return (-1);
+	po->held.e_o_s = eos;
+	if (ogg_stream_packetin(po->os, &po->held) != 0)
+		return (-1);
+	if (oggpager_add(po->pg, po->held.bytes, granulepos) &&
+	    oggpager_out_flush(po) == -1)
+		return (-1);
+	return (0);
+}
+
+
+/**
+ * give op, its granulepos set, to po. op is copied and held back, and the
+ * packet held before it goes in its stream.
+ *
+ * return 0 on success and -1 on error.
+ */
+int
+oggpager_out_packet(struct oggpager_out *po, const ogg_packet *op)
+{
+	unsigned char *p;
+
+	if (po->holding && out_submit(po, 0) == -1)
+		return (-1);
+	if (op->bytes > po->size) {
+		if ((p = realloc(po->held.packet, op->bytes)) == NULL)
+			return (-1);
+		po->held.packet = p;
+		po->size = op->bytes;
+	}
+	p = po->held.packet;
+	po->held = *op;
+	po->held.packet = p;
+	if (op->bytes > 0)
+		(void)memcpy(p, op->packet, op->bytes);
+	po->holding = 1;
+	return (0);
+}
+
+
+/**
+ * flush the pages of the packets in the stream of po, the held one left
+ * out.
+ *
+ * return 0 on success and -1 on error.
+ */
+int
+oggpager_out_flush(struct oggpager_out *po)
+{
+	ogg_page og;
+
+	(void)oggpager_flushed(po->pg);
+	while (ogg_stream_flush_fill(po->os, &og, OGGPAGER_MAXFILL)) {
+		po->eos = ogg_page_eos(&og);
+		if (po->page(po->arg, &og) != 0)
+			return (-1);
+	}
+	return (0);
+}
+
+
+/**
+ * put the packet held by po in its stream, ending the stream with it if
+ * eos is not 0, and flush every page left. Nothing is written if no
+ * packet was given since the last call.
+ *
+ * return 0 on success and -1 on error, or if the stream was to end and
+ * the last page flushed does not say so.
+ */
+int
+oggpager_out_end(struct oggpager_out *po, int eos)
+{
+	int held;
+
+	held = po->holding;
+	if (held && out_submit(po, eos) == -1)
+		return (-1);
+	if (oggpager_out_flush(po) == -1)
+		return (-1);
+	return (held && eos && !po->eos ? -1 : 0);
+}
+
+
+/**
+ * free what po holds.
+ */
+void
+oggpager_out_clear(struct oggpager_out *po)
+{
+
+	free(po->held.packet);
+	po->held.packet = NULL;
+	po->size = 0;
+	po->holding = 0;
+}
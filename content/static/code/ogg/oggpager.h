@@ -0,0 +1,119 @@
+/*
+ * oggpager.h
+ *
+ * Output pagination for the tools rewriting the audio pages. Packets are
+ * gathered until the page body reaches the fill of the policy, or the
+ * lacing table is full, and the pages are flushed then. A policy may also
+ * bound the audio a page holds: the page is then flushed before the packet
+ * which would take it over span milliseconds. Where the pages break only
+ * depends on the packets, which is what lets revorb -j lay out pieces of a
+ * file independently.
+ *
+ * Every page costs 27 bytes of header, CRC included, and a lacing value
+ * per 255 bytes of packet. Small, short pages go out sooner to a listener;
+ * full ones save space in an archive:
+ *
+ *   default  pages of OGGPAGER_FILL bytes, about what libogg writes
+ *   live     pages of at most 40 ms
+ *   archive  pages of up to OGGPAGER_MAXFILL bytes
+ *
+ * A policy is given as [serialno:]fill[/ms], or [serialno:]name, and only
+ * applies to the logical stream with that serial number when it has one,
+ * e.g. "archive", "0x1234:live" or "8192/100". The pager also counts the
+ * pages it lays out, and the bytes their headers take.
+ *
+ * The packets themselves go to their pages through an oggpager_out, which
+ * holds the last one back until the next one comes, or the stream ends.
+ * The last packet then always goes in with the end of stream flag, so the
+ * last page carries it whether or not a page break fell right before, as
+ * when the input was cut short. The pages it flushes are handed to a
+ * function, along with the packets starting them to another one if given.
+ *
+ * Compile oggpager.c along with the tool using it.
+ */
+#ifndef OGGPAGER_H
+#define	OGGPAGER_H
+
+#include <stdio.h>
+
+#include "ogg/ogg.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define	OGGPAGER_FILL		4096	/* default body bytes per page */
+#define	OGGPAGER_MAXFILL	65025	/* 255 lacing values of 255 bytes */
+#define	OGGPAGER_LIVE_SPAN	40	/* ms per page for "live" */
+#define	OGGPAGER_RULES		16
+
+struct oggpager_policy {
+	long	fill;			/* body bytes closing a page */
+	long	span;			/* ms of audio at most, 0 for any */
+};
+
+struct oggpager_rule {
+	int	all;			/* or only for serialno */
+	ogg_uint32_t	serialno;
+	struct oggpager_policy	policy;
+};
+
+/* the policies given on the command line, by logical stream. */
+struct oggpager_rules {
+	int	count;
+	struct oggpager_rule	rule[OGGPAGER_RULES];
+};
+
+/* lays out the audio pages of one logical stream. */
+struct oggpager {
+	long	fill;
+	ogg_int64_t	span;		/* in granulepos units, 0 for none */
+	long	bytes;			/* in the page being filled */
+	int	segs;
+	ogg_int64_t	start;		/* granulepos the page starts at */
+	ogg_int64_t	last;		/* of the last packet added */
+	/* what was flushed so far */
+	long	pages;
+	ogg_int64_t	header_bytes;
+	ogg_int64_t	body_bytes;
+};
+
+typedef int	(*oggpager_page_func)(void *, const ogg_page *);
+typedef int	(*oggpager_start_func)(void *, ogg_int64_t);
+
+/* the packets of one logical stream on their way to its pages. */
+struct oggpager_out {
+	ogg_stream_state	*os;
+	struct oggpager	*pg;
+	oggpager_page_func	page;	/* gets every page flushed */
+	oggpager_start_func	start;	/* told a packet starts a page */
+	void	*arg;			/* given to both */
+	ogg_packet	held;		/* the last packet, not in os yet */
+	long	size;			/* allocated for its data */
+	int	holding;
+	int	eos;			/* the last page flushed ended os */
+};
+
+int	oggpager_parse(struct oggpager_rules *r, const char *arg);
+const struct oggpager_policy *oggpager_lookup(const struct oggpager_rules *r,
+	    ogg_uint32_t serialno);
+void	oggpager_init(struct oggpager *pg, const struct oggpager_policy *p,
+	    long rate, ogg_int64_t granulepos);
+int	oggpager_due(const struct oggpager *pg, ogg_int64_t granulepos);
+int	oggpager_add(struct oggpager *pg, long bytes, ogg_int64_t granulepos);
+ogg_int64_t	oggpager_flushed(struct oggpager *pg);
+void	oggpager_report(const struct oggpager *pg, FILE *fp, const char *name,
+	    ogg_uint32_t serialno);
+void	oggpager_out_init(struct oggpager_out *po, ogg_stream_state *os,
+	    struct oggpager *pg, oggpager_page_func page,
+	    oggpager_start_func start, void *arg);
+int	oggpager_out_packet(struct oggpager_out *po, const ogg_packet *op);
+int	oggpager_out_flush(struct oggpager_out *po);
+int	oggpager_out_end(struct oggpager_out *po, int eos);
+void	oggpager_out_clear(struct oggpager_out *po);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* OGGPAGER_H */
@@ -0,0 +1,378 @@
+/*
+ * oggprobe.c
+ *
+ * Duration of an Ogg Vorbis file from its first and last pages, see
+ * oggprobe.h.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vorbis/codec.h"
+#include "oggprobe.h"
+
+#ifdef _WIN32
+#define	fseeko	_fseeki64
+#define	ftello	_ftelli64
+#endif
+
+#define	PROBE_CHUNK	4096	/* first read size, doubled while needed */
+#define	MAX_PAGE	(27 + 255 + 255 * 255)
+#define	MAX_SERIALS	16	/* streams multiplexed in a link */
+
+/* a link begins with the BOS pages of all its streams. */
+struct serials {
+	int	serialno[MAX_SERIALS];
+	int	count;
+};
+
+struct probe {
+	FILE	*fp;
+	struct oggprobe	*p;
+	ogg_sync_state	oy;
+	ogg_int64_t	off;		/* of the next byte in oy */
+};
+
+
+static int
+is_member(const struct serials *s, int serialno)
+{
+	int i;
+
+	for (i = 0; i < s->count; i++)
+		if (s->serialno[i] == serialno)
+			return (1);
+	return (0);
+}
+
+
+/**
+ * read the len bytes at off, or what there is of them, into the sync state
+ * of pr. What it held before is dropped.
+ *
+ * return 0 on success and -1 on error.
+ */
+static int
+read_chunk(struct probe *pr, ogg_int64_t off, long len)
+{
+	char *buf;
+	size_t n;
+
+	(void)ogg_sync_reset(&pr->oy);
+	pr->off = off;
+	if (off + len > pr->p->size)
+		len = pr->p->size - off;
+	if (len <= 0)
+		return (0);
+	if ((buf = ogg_sync_buffer(&pr->oy, len)) == NULL)
+		return (-1);
+	if (fseeko(pr->fp, off, SEEK_SET) != 0)
+		return (-1);
+	if ((n = fread(buf, 1, len, pr->fp)) != (size_t)len)
+		return (-1);
+	if (ogg_sync_wrote(&pr->oy, n) != 0)
+		return (-1);
+	pr->p->nread += n;
+	pr->p->nreads++;
+	return (0);
+}
+
+
+/**
+ * take the next whole page out of the bytes read, skipping what is not one.
+ *
+ * return 1 and the page and its offset, or 0 when there is none left.
+ */
+static int
+next_page(struct probe *pr, ogg_page *og, ogg_int64_t *pageoff)
+{
+	long n;
+
+	while ((n = ogg_sync_pageseek(&pr->oy, og)) != 0) {
+		if (n < 0) {
+			pr->off -= n;
+			continue;
+		}
+		*pageoff = pr->off;
+		pr->off += n;
+		return (1);
+	}
+	return (0);
+}
+
+
+/**
+ * read the BOS pages of the link beginning at begin into l and s, and the
+ * identification header of its (first) Vorbis stream.
+ *
+ * return 0 on success and -1 on error (unreadable or not Vorbis).
+ */
+static int
+read_link(struct probe *pr, ogg_int64_t begin, struct oggprobe_link *l,
+    struct serials *s)
+{
+	ogg_stream_state os;
+	ogg_packet op;
+	ogg_page og;
+	ogg_int64_t pageoff;
+	vorbis_info vi;
+	vorbis_comment vc;
+	int found = 0, ret;
+
+	(void)memset(l, 0, sizeof(struct oggprobe_link));
+	l->begin = begin;
+	l->granulepos = -1;
+	s->count = 0;
+	if (read_chunk(pr, begin, PROBE_CHUNK) != 0)
+		return (-1);
+	while (next_page(pr, &og, &pageoff) == 1 && ogg_page_bos(&og)) {
+		if (s->count < MAX_SERIALS)
+			s->serialno[s->count++] = ogg_page_serialno(&og);
+		if (found || og.body_len < 7 ||
+		    memcmp(og.body, "\001vorbis", 7) != 0)
+			continue;
+		if (ogg_stream_init(&os, ogg_page_serialno(&og)) != 0)
+			return (-1);
+		vorbis_info_init(&vi);
+		vorbis_comment_init(&vc);
+		ret = ogg_stream_pagein(&os, &og) == 0 &&
+		    ogg_stream_packetout(&os, &op) == 1 &&
+		    vorbis_synthesis_headerin(&vi, &vc, &op) == 0;
+		if (ret) {
+			l->serialno = os.serialno;
+			l->rate = vi.rate;
+			l->channels = vi.channels;
+			found = 1;
+		}
+		vorbis_comment_clear(&vc);
+		vorbis_info_clear(&vi);
+		ogg_stream_clear(&os);
+	}
+	return (found ? 0 : -1);
+}
+
+
+/**
+ * find the last page with a granulepos in [begin, end), of one of the
+ * streams of s or of any stream when s is NULL. The bytes are read
+ * backwards from end, by chunks growing from PROBE_CHUNK.
+ *
+ * return 0 and its serial number and granulepos, 1 if there is none and -1
+ * on error.
+ */
+static int
+last_granulepos(struct probe *pr, ogg_int64_t begin, ogg_int64_t end,
+    const struct serials *s, int *serialno, ogg_int64_t *granulepos)
+{
+	ogg_page og;
+	ogg_int64_t off, limit, pageoff, first;
+	long chunk = PROBE_CHUNK;
+	int found = 0, has_first;
+
+	/* every window ends where the first page of the one after begins */
+	for (limit = end; limit > begin; ) {
+		off = (limit - begin > chunk ? limit - chunk : begin);
+		if (read_chunk(pr, off, limit - off) != 0)
+			return (-1);
+		has_first = 0;
+		while (next_page(pr, &og, &pageoff) == 1) {
+			if (!has_first) {
+				first = pageoff;
+				has_first = 1;
+			}
+			if (ogg_page_granulepos(&og) == -1 ||
+			    (s != NULL && !is_member(s, ogg_page_serialno(&og))))
+				continue;
+			*serialno = ogg_page_serialno(&og);
+			*granulepos = ogg_page_granulepos(&og);
+			found = 1;
+		}
+		if (found)
+			return (0);
+		if (has_first)
+			limit = first;
+		else if (off == begin || chunk >= 2 * MAX_PAGE)
+			limit = off;	/* no page in there at all */
+		/* else a bigger page straddles off, read more of it */
+		if (chunk < 2 * MAX_PAGE)
+			chunk *= 2;
+	}
+	return (1);
+}
+
+
+/**
+ * find the first page at or after lo which does not belong to the streams of
+ * s, knowing there is one before hi. Pages of a link are contiguous, so this
+ * bisects [lo, hi) before going through the last few pages.
+ *
+ * return 0 and its offset on success and -1 on error.
+ */
+static int
+find_boundary(struct probe *pr, ogg_int64_t lo, ogg_int64_t hi,
+    const struct serials *s, ogg_int64_t *boundary)
+{
+	ogg_page og;
+	ogg_int64_t mid, pageoff;
+	long len;
+	int got;
+
+	while (hi - lo > PROBE_CHUNK) {
+		mid = lo + (hi - lo) / 2;
+		/* until a whole page is in, twice the biggest one always is */
+		for (len = 2 * PROBE_CHUNK; ; len *= 2) {
+			if (read_chunk(pr, mid, len) != 0)
+				return (-1);
+			if ((got = next_page(pr, &og, &pageoff)) ||
+			    len >= 2 * MAX_PAGE || mid + len >= hi)
+				break;
+		}
+		if (!got || pageoff >= hi)
+			hi = mid;
+		else if (is_member(s, ogg_page_serialno(&og)))
+			lo = pr->off;
+		else
+			hi = pageoff;
+	}
+
+	/* the last pages one by one, hi was only a guess if nothing began
+	   between mid and it */
+	for (len = PROBE_CHUNK + (hi - lo); lo < pr->p->size; ) {
+		if (read_chunk(pr, lo, len) != 0)
+			return (-1);
+		got = 0;
+		while (next_page(pr, &og, &pageoff) == 1) {
+			if (!is_member(s, ogg_page_serialno(&og))) {
+				*boundary = pageoff;
+				return (0);
+			}
+			lo = pr->off;
+			got = 1;
+		}
+		if (!got && len >= 2 * MAX_PAGE)
+			break;	/* not Ogg data */
+		len = (got ? PROBE_CHUNK : 2 * len);
+	}
+	return (-1);
+}
+
+
+/**
+ * append l to the links of p.
+ *
+ * return 0 on success and -1 on error (out of memory).
+ */
+static int
+add_link(struct oggprobe *p, const struct oggprobe_link *l)
+{
+	struct oggprobe_link *links;
+
+	links = realloc(p->links, (p->nlinks + 1) * sizeof(struct oggprobe_link));
+	if (links == NULL)
+		return (-1);
+	p->links = links;
+	p->links[p->nlinks++] = *l;
+	return (0);
+}
+
+
+/**
+ * probe the Ogg Vorbis file fp into p. The reads are exactly the size asked
+ * for when fp is unbuffered.
+ *
+ * return 0 on success, 1 for a chained file without OGGPROBE_LINKS (only its
+ * first link is in p, and it has no granulepos) and -1 on error.
+ */
+int
+oggprobe_file(FILE *fp, int flags, struct oggprobe *p)
+{
+	struct probe pr;
+	struct oggprobe_link l;
+	struct serials s, only;
+	ogg_int64_t gp, boundary;
+	int serialno, other, ret = -1;
+
+	(void)memset(p, 0, sizeof(struct oggprobe));
+	pr.fp = fp;
+	pr.p = p;
+	pr.off = 0;
+	(void)ogg_sync_init(&pr.oy); /* always return 0 */
+	if (fseeko(fp, 0, SEEK_END) != 0 || (p->size = ftello(fp)) == -1)
+		goto out;
+	if (read_link(&pr, 0, &l, &s) != 0)
+		goto out;
+
+	/* the last page of the file tells whether it is chained */
+	switch (last_granulepos(&pr, l.begin, p->size, NULL, &serialno, &gp)) {
+	case 0:
+		break;
+	case 1:
+		/* headers only */
+		ret = add_link(p, &l);
+		goto out;
+	default:
+		goto out;
+	}
+	only.count = 1;
+	while (!is_member(&s, serialno)) {
+		if (!(flags & OGGPROBE_LINKS)) {
+			ret = (add_link(p, &l) == 0 ? 1 : -1);
+			goto out;
+		}
+		if (find_boundary(&pr, l.begin, p->size, &s, &boundary) != 0)
+			goto out;
+		only.serialno[0] = l.serialno;
+		if (last_granulepos(&pr, l.begin, boundary, &only, &other,
+		    &l.granulepos) == -1)
+			goto out;
+		if (add_link(p, &l) != 0)
+			goto out;
+		if (read_link(&pr, boundary, &l, &s) != 0)
+			goto out;
+	}
+
+	/* in the last link: the last page may be of another stream of it */
+	if (serialno == l.serialno)
+		l.granulepos = gp;
+	else {
+		only.serialno[0] = l.serialno;
+		if (last_granulepos(&pr, l.begin, p->size, &only, &other,
+		    &l.granulepos) == -1)
+			goto out;
+	}
+	ret = add_link(p, &l);
+	/* FALLTHROUGH */
+out:
+	ogg_sync_clear(&pr.oy);
+	if (ret == -1)
+		oggprobe_clear(p);
+	return (ret);
+}
+
+
+/**
+ * return the duration of p in seconds, or -1 when a link has none.
+ */
+double
+oggprobe_duration(const struct oggprobe *p)
+{
+	double duration = 0;
+	size_t i;
+
+	for (i = 0; i < p->nlinks; i++) {
+		if (p->links[i].granulepos < 0 || p->links[i].rate <= 0)
+			return (-1);
+		duration += (double)p->links[i].granulepos / p->links[i].rate;
+	}
+	return (duration);
+}
+
+
+void
+oggprobe_clear(struct oggprobe *p)
+{
+
+	free(p->links);
+	p->links = NULL;
+	p->nlinks = 0;
+}
@@ -0,0 +1,56 @@
+/*
+ * oggprobe.h
+ *
+ * Duration of an Ogg Vorbis file from the fewest bytes: the identification
+ * header at the start, and the last page of the stream found by reading
+ * backwards from the end in small chunks. Nothing in between is read, so a
+ * query costs two short reads whatever the file size.
+ *
+ * The duration is the last granulepos over the sample rate, i.e. the stream
+ * is taken to begin at sample 0 as revorb and oggfix_granulepos write it.
+ *
+ * A chained file (several streams one after the other) is only walked when
+ * OGGPROBE_LINKS is given: the link boundaries are then bisected, which
+ * reads a few chunks per link. Without it, oggprobe_file() returns 1 for
+ * such a file, with the first link only.
+ *
+ * Compile oggprobe.c along with the tool using it.
+ */
+#ifndef OGGPROBE_H
+#define	OGGPROBE_H
+
+#include <stdio.h>
+
+#include "ogg/ogg.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define	OGGPROBE_LINKS	1	/* walk every link of a chained file */
+
+struct oggprobe_link {
+	int	serialno;		/* of its Vorbis stream */
+	long	rate;
+	int	channels;
+	ogg_int64_t	begin;		/* offset of its first page */
+	ogg_int64_t	granulepos;	/* of its last page, -1 if unknown */
+};
+
+struct oggprobe {
+	struct oggprobe_link	*links;
+	size_t	nlinks;
+	ogg_int64_t	size;		/* of the file */
+	ogg_int64_t	nread;		/* bytes read to find all this */
+	long	nreads;			/* and in how many reads */
+};
+
+int	oggprobe_file(FILE *fp, int flags, struct oggprobe *p);
+double	oggprobe_duration(const struct oggprobe *p);
+void	oggprobe_clear(struct oggprobe *p);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* OGGPROBE_H */
@@ -0,0 +1,322 @@
+/*
+ * oggreplace.c
+ *
+ * Crash-safe replacement of files, see oggreplace.h.
+ */
+#ifdef __linux__
+#define	_GNU_SOURCE	/* O_TMPFILE, syncfs(2) */
+#endif
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "oggreplace.h"
+
+#if defined(__linux__) && defined(O_TMPFILE)
+#define	HAVE_TMPFILE
+#endif
+
+
+/**
+ * make a new hidden name for name in its directory, unique to the process.
+ *
+ * return the name on success and NULL on error.
+ */
+static char *
+hidden_name(const char *name)
+{
+	static unsigned long n = 0;
+	size_t len;
+	char *s;
+
+	len = strlen(name) + 64;
+	if ((s = malloc(len)) == NULL)
+		return (NULL);
+	(void)snprintf(s, len, ".%s.%ld.%lu", name, (long)getpid(), n++);
+	return (s);
+}
+
+
+/**
+ * create a new empty file next to the file at path, open for writing, to be
+ * committed over it later. The new file keeps the permissions of the old.
+ *
+ * return the descriptor to write to on success and -1 on error, with errno
+ * set.
+ */
+int
+oggreplace_open(struct oggreplace_file *f, const char *path)
+{
+	struct stat st;
+	const char *slash;
+	char *dir;
+	mode_t mode;
+	int err;
+
+	memset(f, 0, sizeof(*f));
+	f->fd = f->dirfd = -1;
+
+	if ((f->path = strdup(path)) == NULL)
+		goto fail;
+	if ((slash = strrchr(path, '/')) == NULL) {
+		dir = strdup(".");
+		f->name = strdup(path);
+	} else {
+		dir = strndup(path, slash == path ? 1 : slash - path);
+		f->name = strdup(slash + 1);
+	}
+	if (dir == NULL || f->name == NULL) {
+		free(dir);
+		goto fail;
+	}
+	f->dirfd = open(dir, O_RDONLY | O_DIRECTORY);
+	free(dir);
+	if (f->dirfd == -1)
+		goto fail;
+
+	if (fstatat(f->dirfd, f->name, &st, 0) == 0)
+		mode = st.st_mode & 07777;
+	else if (errno == ENOENT)
+		mode = 0644;
+	else
+		goto fail;
+
+#ifdef HAVE_TMPFILE
+	f->fd = openat(f->dirfd, ".", O_TMPFILE | O_WRONLY, mode);
+	/* filesystems without it say EOPNOTSUPP, older kernels EISDIR */
+	if (f->fd == -1 && errno != EOPNOTSUPP && errno != EISDIR)
+		goto fail;
+#endif
+	while (f->fd == -1) {
+		free(f->tmp);
+		if ((f->tmp = hidden_name(f->name)) == NULL)
+			goto fail;
+		f->fd = openat(f->dirfd, f->tmp,
+		    O_WRONLY | O_CREAT | O_EXCL, mode);
+		if (f->fd == -1 && errno != EEXIST)
+			goto fail;
+	}
+	/* the umask may have taken some bits away */
+	if (fchmod(f->fd, mode) == -1)
+		goto fail;
+	return (f->fd);
+
+fail:
+	err = errno;
+	oggreplace_abort(f);
+	errno = err;
+	return (-1);
+}
+
+
+/**
+ * drop the new version of a file, leaving the old one as it was.
+ */
+void
+oggreplace_abort(struct oggreplace_file *f)
+{
+	if (f->fd != -1)
+		(void)close(f->fd);
+	if (f->tmp != NULL)
+		(void)unlinkat(f->dirfd, f->tmp, 0);
+	if (f->dirfd != -1)
+		(void)close(f->dirfd);
+	free(f->path);
+	free(f->name);
+	free(f->tmp);
+	memset(f, 0, sizeof(*f));
+	f->fd = f->dirfd = -1;
+}
+
+
+/**
+ * start an empty batch.
+ */
+void
+oggreplace_init(struct oggreplace *r)
+{
+	memset(r, 0, sizeof(*r));
+}
+
+
+/**
+ * forget the paths left by the last flush.
+ */
+void
+oggreplace_clear(struct oggreplace *r)
+{
+	int i;
+
+	for (i = 0; i < r->nfailed; i++)
+		free(r->failed[i]);
+	r->nfailed = 0;
+}
+
+
+/**
+ * queue the new version of a file, fully written, to replace the old one at
+ * the next flush. A full batch is flushed first. f is taken over by r and
+ * is to be opened again before any reuse.
+ *
+ * return what the flush returned, 0 when none was needed.
+ */
+int
+oggreplace_commit(struct oggreplace *r, struct oggreplace_file *f)
+{
+	int ret = 0;
+
+	if (r->count == OGGREPLACE_BATCH)
+		ret = oggreplace_flush(r);
+	else
+		oggreplace_clear(r);
+	r->files[r->count++] = *f;
+	memset(f, 0, sizeof(*f));
+	f->fd = f->dirfd = -1;
+	return (ret);
+}
+
+
+/**
+ * make sure the data of all the files of r is on disk.
+ *
+ * return 0 on success and -1 on error.
+ */
+static int
+sync_data(struct oggreplace *r)
+{
+	struct stat st;
+	dev_t done[OGGREPLACE_BATCH];
+	int i, j, ndone = 0;
+
+	if (r->count == 1)
+		return (fdatasync(r->files[0].fd));
+#ifdef __linux__
+	/* once per filesystem, a single journal commit for all the files */
+	for (i = 0; i < r->count; i++) {
+		if (fstat(r->files[i].fd, &st) == -1)
+			return (-1);
+		for (j = 0; j < ndone && done[j] != st.st_dev; j++)
+			continue;
+		if (j < ndone)
+			continue;
+		if (syncfs(r->files[i].fd) == -1)
+			return (-1);
+		done[ndone++] = st.st_dev;
+	}
+#else
+	(void)st;
+	(void)done;
+	(void)j;
+	(void)ndone;
+	for (i = 0; i < r->count; i++)
+		if (fdatasync(r->files[i].fd) == -1)
+			return (-1);
+#endif
+	return (0);
+}
+
+
+/**
+ * give the file f, written and synced, its hidden name if it has none yet.
+ *
+ * return 0 on success and -1 on error.
+ */
+static int
+link_tmp(struct oggreplace_file *f)
+{
+#ifdef HAVE_TMPFILE
+	char proc[64];
+
+	while (f->tmp == NULL) {
+		if ((f->tmp = hidden_name(f->name)) == NULL)
+			return (-1);
+		(void)snprintf(proc, sizeof(proc), "/proc/self/fd/%d", f->fd);
+		if (linkat(AT_FDCWD, proc, f->dirfd, f->tmp,
+		    AT_SYMLINK_FOLLOW) == 0)
+			break;
+		free(f->tmp);
+		f->tmp = NULL;
+		if (errno != EEXIST)
+			return (-1);
+	}
+#endif
+	return (f->tmp == NULL ? -1 : 0);
+}
+
+
+/**
+ * return 1 if the directories open as a and b are the same, 0 otherwise.
+ */
+static int
+same_dir(int a, int b)
+{
+	struct stat sa, sb;
+
+	if (fstat(a, &sa) == -1 || fstat(b, &sb) == -1)
+		return (0);
+	return (sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino);
+}
+
+
+/**
+ * replace the old version of every file of r by the new one, and empty r.
+ * When the data could not be synced no file is replaced, for a crash could
+ * then leave any of them truncated. The paths of the files left as they
+ * were, and of those replaced in a directory which could not be synced,
+ * are in r->failed afterward.
+ *
+ * return 0 on success and -1 if any file could not be durably replaced.
+ */
+int
+oggreplace_flush(struct oggreplace *r)
+{
+	struct oggreplace_file *f, *g;
+	int i, j, synced;
+
+	oggreplace_clear(r);
+	synced = (sync_data(r) == 0);
+
+	for (i = 0; i < r->count; i++) {
+		f = &r->files[i];
+		if (synced && link_tmp(f) == 0 &&
+		    renameat(f->dirfd, f->tmp, f->dirfd, f->name) == 0) {
+			free(f->tmp);
+			f->tmp = NULL;	/* it is the file now */
+		} else {
+			r->failed[r->nfailed++] = f->path;
+			f->path = NULL;
+		}
+	}
+
+	/* make the renames durable, each directory once */
+	for (i = 0; i < r->count; i++) {
+		f = &r->files[i];
+		for (j = 0; j < i; j++) {
+			if (same_dir(r->files[j].dirfd, f->dirfd))
+				break;
+		}
+		if (j < i || fsync(f->dirfd) == 0)
+			continue;
+		/* a crash may still undo the renames made in there */
+		for (j = i; j < r->count; j++) {
+			g = &r->files[j];
+			if (g->path != NULL &&
+			    (j == i || same_dir(g->dirfd, f->dirfd))) {
+				r->failed[r->nfailed++] = g->path;
+				g->path = NULL;
+			}
+		}
+	}
+
+	for (i = 0; i < r->count; i++)
+		oggreplace_abort(&r->files[i]);
+	r->count = 0;
+	return (r->nfailed > 0 ? -1 : 0);
+}
@@ -0,0 +1,64 @@
+/*
+ * oggreplace.h
+ *
+ * Crash-safe replacement of files by a rewritten version. Writing to
+ * <name>.tmp, then unlinking <name> and renaming, leaves a window without
+ * any file, and nothing makes sure the new data is on disk before the old
+ * is gone. Here the new version is written to an unnamed O_TMPFILE in the
+ * same directory, then linked under a hidden name and renamed over the
+ * original, which is atomic: after a crash either version is there, whole.
+ * Where there is no O_TMPFILE (other systems, some filesystems) the hidden
+ * name is created right away instead, and renamed over all the same.
+ *
+ * Durability costs a data sync before the rename and a directory sync
+ * after. Replaced files are thus gathered in a batch of up to
+ * OGGREPLACE_BATCH: when it is flushed, the data of all of them is synced
+ * at once with syncfs(2) (a single journal commit on ext4 or xfs), then
+ * they are all renamed, then each directory is synced once. A batch of one
+ * file only gets an fdatasync(2).
+ *
+ * This is POSIX only; on Windows revorb still goes through <name>.tmp.
+ * Compile oggreplace.c along with the tool using it.
+ */
+#ifndef OGGREPLACE_H
+#define	OGGREPLACE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define	OGGREPLACE_BATCH	64	/* files waiting for a flush, at most */
+
+/* the new version of a file, being written. */
+struct oggreplace_file {
+	int	fd;			/* write it here */
+	int	dirfd;			/* where name is */
+	char	*path;			/* as given */
+	char	*name;
+	char	*tmp;			/* its hidden name without O_TMPFILE */
+};
+
+/*
+ * the files written, waiting for a flush to replace the originals. The
+ * paths of those a flush could not replace, or not durably, are left in
+ * failed, until the next commit or flush.
+ */
+struct oggreplace {
+	struct oggreplace_file	files[OGGREPLACE_BATCH];
+	int	count;
+	char	*failed[OGGREPLACE_BATCH];
+	int	nfailed;
+};
+
+int	oggreplace_open(struct oggreplace_file *f, const char *path);
+void	oggreplace_abort(struct oggreplace_file *f);
+void	oggreplace_init(struct oggreplace *r);
+int	oggreplace_commit(struct oggreplace *r, struct oggreplace_file *f);
+int	oggreplace_flush(struct oggreplace *r);
+void	oggreplace_clear(struct oggreplace *r);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* OGGREPLACE_H */
@@ -0,0 +1,210 @@
+/*
+ * oggsink.c
+ *
+ * Pages gathered and written in batches, see oggsink.h.
+ */
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#include "oggsink.h"
+
+#ifdef _WIN32
+struct iovec {
+	void	*iov_base;
+	size_t	iov_len;
+};
+#endif
+
+
+/**
+ * write the n pieces of iov in order to fd.
+ *
+ * return 0 on success and -1 on error.
+ */
+static int
+write_fd(int fd, struct iovec *iov, int n)
+{
+	long w;
+
+	while (n > 0) {
+#ifdef _WIN32
+		w = _write(fd, iov->iov_base, (unsigned)iov->iov_len);
+#else
+		w = writev(fd, iov, n);
+#endif
+		if (w == -1) {
+			if (errno == EINTR)
+				continue;
+			return (-1);
+		}
+		/* skip what went out, the rest of a piece may not have */
+		while (n > 0 && (size_t)w >= iov->iov_len) {
+			w -= iov->iov_len;
+			iov++;
+			n--;
+		}
+		if (n > 0) {
+			iov->iov_base = (char *)iov->iov_base + w;
+			iov->iov_len -= w;
+		}
+	}
+	return (0);
+}
+
+
+/**
+ * write the n pieces of iov in order to the output of s.
+ *
+ * return 0 on success and -1 on error.
+ */
+static int
+emit(struct oggsink *s, struct iovec *iov, int n)
+{
+	int i;
+
+	if (s->write == NULL)
+		return (write_fd(s->fd, iov, n));
+	for (i = 0; i < n; i++)
+		if (iov[i].iov_len > 0 && s->write(iov[i].iov_base, 1,
+		    iov[i].iov_len, s->out) != iov[i].iov_len)
+			return (-1);
+	return (0);
+}
+
+
+static int
+sink_open(struct oggsink *s, long batch)
+{
+
+	s->batch = (batch > 0 ? batch : 0);
+	s->buf = NULL;
+	s->len = 0;
+	s->offset = 0;
+	s->error = 0;
+	if (s->batch > 0 && (s->buf = malloc(s->batch)) == NULL)
+		return (-1);
+	return (0);
+}
+
+
+/**
+ * set s up to write to fd, gathering batch bytes of pages at a time.
+ *
+ * return 0 on success and -1 on error (out of memory).
+ */
+int
+oggsink_open_fd(struct oggsink *s, int fd, long batch)
+{
+
+	s->fd = fd;
+	s->write = NULL;
+	s->out = NULL;
+	return (sink_open(s, batch));
+}
+
+
+/**
+ * set s up to write with the fwrite(3)-like write on out, gathering batch
+ * bytes of pages at a time.
+ *
+ * return 0 on success and -1 on error (out of memory).
+ */
+int
+oggsink_open_func(struct oggsink *s, oggsink_write_func write, void *out,
+    long batch)
+{
+
+	s->fd = -1;
+	s->write = write;
+	s->out = out;
+	return (sink_open(s, batch));
+}
+
+
+/**
+ * write the page og, or keep a copy of it for later.
+ *
+ * return 0 on success and -1 on error.
+ */
+int
+oggsink_page(struct oggsink *s, const ogg_page *og)
+{
+	struct iovec iov[3];
+	long n;
+
+	if (s->error)
+		return (-1);
+	n = og->header_len + og->body_len;
+	if (s->len + n <= s->batch) {
+		(void)memcpy(s->buf + s->len, og->header, og->header_len);
+		(void)memcpy(s->buf + s->len + og->header_len, og->body,
+		    og->body_len);
+		s->len += n;
+	} else {
+		/* it does not fit: out with it and what was gathered */
+		iov[0].iov_base = s->buf;
+		iov[0].iov_len = s->len;
+		iov[1].iov_base = og->header;
+		iov[1].iov_len = og->header_len;
+		iov[2].iov_base = og->body;
+		iov[2].iov_len = og->body_len;
+		if (emit(s, s->len > 0 ? iov : iov + 1, s->len > 0 ? 3 : 2)
+		    != 0) {
+			s->error = 1;
+			return (-1);
+		}
+		s->len = 0;
+	}
+	s->offset += n;
+	return (0);
+}
+
+
+/**
+ * write the pages gathered so far.
+ *
+ * return 0 on success and -1 on error.
+ */
+int
+oggsink_flush(struct oggsink *s)
+{
+	struct iovec iov;
+
+	if (s->error)
+		return (-1);
+	if (s->len == 0)
+		return (0);
+	iov.iov_base = s->buf;
+	iov.iov_len = s->len;
+	if (emit(s, &iov, 1) != 0) {
+		s->error = 1;
+		return (-1);
+	}
+	s->len = 0;
+	return (0);
+}
+
+
+/**
+ * flush s and release it.
+ *
+ * return 0 on success and -1 if any page could not be written.
+ */
+int
+oggsink_close(struct oggsink *s)
+{
+	int ret;
+
+	ret = oggsink_flush(s);
+	free(s->buf);
+	s->buf = NULL;
+	return (ret);
+}
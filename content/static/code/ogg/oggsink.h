@@ -0,0 +1,61 @@
+/*
+ * oggsink.h
+ *
+ * Page output shared by the tools. Writing a page takes two fwrite(3)
+ * calls, for its header and its body, and stdio then cuts them into writes
+ * of its own buffer size. A sink instead gathers the pages it is given, up
+ * to batch bytes, and hands the lot to the kernel at once: the page which
+ * does not fit any more goes out along with them, in the same writev(2),
+ * without being copied.
+ *
+ * The batch is the flush policy of the sink. OGGSINK_BATCH suits files;
+ * 0 writes every page as soon as it is given, for a listener waiting at
+ * the other end of a pipe. Pages are copied when gathered, since libogg
+ * reuses the memory of the pages it returns.
+ *
+ * A sink writes to a descriptor with writev(2), or through a function
+ * shaped like fwrite(3), which gets the pieces one by one: fwrite itself
+ * on a FILE, oggaio_fwrite() on an oggaio writer, or the write callback
+ * of vcedit. Whatever else writes to the same output must come after
+ * oggsink_flush().
+ *
+ * Compile oggsink.c along with the tool using it.
+ */
+#ifndef OGGSINK_H
+#define	OGGSINK_H
+
+#include <stddef.h>
+
+#include "ogg/ogg.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define	OGGSINK_BATCH	(64 * 1024)	/* bytes gathered before writing */
+
+typedef size_t	(*oggsink_write_func)(const void *, size_t, size_t, void *);
+
+struct oggsink {
+	int	fd;			/* written with writev(2), or */
+	oggsink_write_func	write;	/* with this on out */
+	void	*out;
+	long	batch;			/* flush policy, see above */
+	unsigned char	*buf;		/* the pages gathered */
+	long	len;
+	ogg_int64_t	offset;		/* output offset of the next page */
+	int	error;
+};
+
+int	oggsink_open_fd(struct oggsink *s, int fd, long batch);
+int	oggsink_open_func(struct oggsink *s, oggsink_write_func write,
+	    void *out, long batch);
+int	oggsink_page(struct oggsink *s, const ogg_page *og);
+int	oggsink_flush(struct oggsink *s);
+int	oggsink_close(struct oggsink *s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* OGGSINK_H */
@@ -0,0 +1,304 @@
+/*
+ * oggsource.c
+ *
+ * Pages pulled out of an Ogg input, see oggsource.h.
+ */
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "oggcrc.h"
+#include "oggsource.h"
+
+
+static void
+source_open(struct oggsource *s)
+{
+
+	s->map = NULL;
+	s->size = s->pos = 0;
+	s->mapped = 0;
+	s->fd = -1;
+	s->read = NULL;
+	s->in = NULL;
+	(void)ogg_sync_init(&s->oy); /* always return 0 */
+	s->offset = 0;
+	s->error = 0;
+}
+
+
+/**
+ * set s up to give the pages of the len bytes at buf, which must stay
+ * there until s is closed.
+ *
+ * return 0.
+ */
+int
+oggsource_open_mem(struct oggsource *s, const void *buf, size_t len)
+{
+
+	source_open(s);
+	s->map = buf;
+	s->size = len;
+	return (0);
+}
+
+
+/**
+ * set s up to give the pages of the regular file open as fd, from its
+ * start whatever its offset, mapping it.
+ *
+ * return 0 on success and -1 if fd cannot be mapped, in which case s holds
+ * nothing.
+ */
+int
+oggsource_open_map(struct oggsource *s, int fd)
+{
+#ifdef _WIN32
+	(void)fd;
+	source_open(s);
+	return (-1);
+#else
+	struct stat st;
+	void *map;
+
+	source_open(s);
+	if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size == 0)
+		return (-1);
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED)
+		return (-1);
+	(void)madvise(map, st.st_size, MADV_SEQUENTIAL);
+	s->map = map;
+	s->size = st.st_size;
+	s->mapped = 1;
+	return (0);
+#endif
+}
+
+
+/**
+ * set s up to give the pages read from fd, from its current offset on. A
+ * regular file read from its start is mapped, anything else is read.
+ *
+ * return 0.
+ */
+int
+oggsource_open_fd(struct oggsource *s, int fd)
+{
+
+	/* whether it is mapped or not, s starts out clean */
+	source_open(s);
+#ifdef _WIN32
+	if (_lseeki64(fd, 0, SEEK_CUR) == 0 && oggsource_open_map(s, fd) == 0)
+#else
+	if (lseek(fd, 0, SEEK_CUR) == 0 && oggsource_open_map(s, fd) == 0)
+#endif
+		return (0);
+	s->fd = fd;
+	return (0);
+}
+
+
+/**
+ * set s up to give the pages read with the fread(3)-like read on in.
+ *
+ * return 0.
+ */
+int
+oggsource_open_func(struct oggsource *s, oggsource_read_func read, void *in)
+{
+
+	source_open(s);
+	s->read = read;
+	s->in = in;
+	return (0);
+}
+
+
+/**
+ * give s the len bytes at buf, which were read from its input already,
+ * before anything else is read. Only a source reading its input takes any.
+ *
+ * return 0 on success and -1 on error.
+ */
+int
+oggsource_feed(struct oggsource *s, const void *buf, size_t len)
+{
+	char *p;
+
+	if (s->map != NULL)
+		return (-1);
+	if ((p = ogg_sync_buffer(&s->oy, len)) == NULL)
+		return (-1);
+	(void)memcpy(p, buf, len);
+	return (ogg_sync_wrote(&s->oy, len));
+}
+
+
+/**
+ * find the next page in the memory of s, checking it like
+ * ogg_sync_pageout() would.
+ */
+static int
+map_page(struct oggsource *s, ogg_page *og)
+{
+	const unsigned char *p, *next;
+	size_t avail, header_len, body_len;
+	ogg_uint32_t crc;
+	int i, skipped = 0;
+
+	while (s->pos < s->size) {
+		p = s->map + s->pos;
+		avail = s->size - s->pos;
+
+		if (avail >= 27 && memcmp(p, "OggS", 4) == 0 && p[4] == 0) {
+			header_len = 27 + p[26];
+			if (avail < header_len)
+				break;
+			body_len = 0;
+			for (i = 27; i < (int)header_len; i++)
+				body_len += p[i];
+			if (avail < header_len + body_len)
+				break;
+			crc = p[22] | (p[23] << 8) | (p[24] << 16) |
+			    ((ogg_uint32_t)p[25] << 24);
+			if (crc == oggcrc_page(p, header_len, p + header_len,
+			    body_len)) {
+				if (skipped)
+					return (-1);
+				og->header = (unsigned char *)p;
+				og->header_len = header_len;
+				og->body = (unsigned char *)p + header_len;
+				og->body_len = body_len;
+				s->pos += header_len + body_len;
+				s->offset = s->pos;
+				return (1);
+			}
+		}
+
+		/* lost sync: move on to the next capture pattern */
+		skipped = 1;
+		next = memchr(p + 1, 'O', avail - 1);
+		s->pos = (next != NULL ? (size_t)(next - s->map) : s->size);
+		s->offset = s->pos;
+	}
+	return (skipped ? -1 : 0);
+}
+
+
+/**
+ * read more of the input of s into its ogg_sync_state.
+ *
+ * return the bytes read, 0 at the end of the input or on error.
+ */
+static long
+fill(struct oggsource *s)
+{
+	char *buf;
+	long n;
+
+	if ((buf = ogg_sync_buffer(&s->oy, OGGSOURCE_CHUNK)) == NULL) {
+		s->error = 1;
+		return (0);
+	}
+	if (s->read != NULL) {
+		n = (long)s->read(buf, 1, OGGSOURCE_CHUNK, s->in);
+	} else {
+		do {
+#ifdef _WIN32
+			n = _read(s->fd, buf, OGGSOURCE_CHUNK);
+#else
+			n = read(s->fd, buf, OGGSOURCE_CHUNK);
+#endif
+		} while (n == -1 && errno == EINTR);
+	}
+	if (n < 0) {
+		s->error = 1;
+		return (0);
+	}
+	(void)ogg_sync_wrote(&s->oy, n);
+	return (n);
+}
+
+
+/**
+ * get the next page of s into og, with the contract of ogg_sync_pageout().
+ *
+ * return 1 when there is one, 0 at the end of the input (or on a read
+ * error, then s->error is set) and -1 when bytes were skipped to find it.
+ */
+int
+oggsource_page(struct oggsource *s, ogg_page *og)
+{
+	long n;
+
+	if (s->map != NULL)
+		return (map_page(s, og));
+	for (;;) {
+		n = ogg_sync_pageseek(&s->oy, og);
+		if (n > 0) {
+			s->offset += n;
+			return (1);
+		}
+		if (n < 0) {
+			s->offset -= n;
+			return (-1);
+		}
+		if (fill(s) == 0)
+			return (0);
+	}
+}
+
+
+/**
+ * get the next packet of the logical stream os into op, paging in the pages
+ * of s it needs. Pages of other streams are passed over.
+ *
+ * return 1 when there is one, 0 at the end of the stream or of the input,
+ * and -1 when data is missing before it, like ogg_stream_packetout().
+ */
+int
+oggsource_packet(struct oggsource *s, ogg_stream_state *os, ogg_packet *op)
+{
+	ogg_page og;
+	int res;
+
+	while ((res = ogg_stream_packetout(os, op)) == 0) {
+		if (os->e_o_s)
+			return (0);
+		if ((res = oggsource_page(s, &og)) == 0)
+			return (0);
+		if (res == 1 && ogg_page_serialno(&og) == os->serialno)
+			(void)ogg_stream_pagein(os, &og);
+	}
+	return (res);
+}
+
+
+/**
+ * release s. Its descriptor or input is left open.
+ */
+void
+oggsource_close(struct oggsource *s)
+{
+
+#ifndef _WIN32
+	if (s->mapped)
+		(void)munmap((void *)s->map, s->size);
+#endif
+	(void)ogg_sync_clear(&s->oy);
+	s->map = NULL;
+	s->size = s->pos = 0;
+	s->mapped = 0;
+}
@@ -0,0 +1,65 @@
+/*
+ * oggsource.h
+ *
+ * Page input shared by the tools, the other end of oggsink. Each of them
+ * had its own ogg_sync_buffer(), read, ogg_sync_wrote(), ogg_sync_pageout()
+ * loop, reading 4096 or BUFSIZ bytes at a time; they all pull their pages
+ * from a source instead, so that the input is tuned in a single place.
+ *
+ * A source reads from memory, from a descriptor, or through a function
+ * shaped like fread(3): fread itself on a FILE, oggaio_fread() on an oggaio
+ * reader, or the read callback of vcedit. The pages of memory, and of a
+ * descriptor on a regular file, which is mapped, are parsed in place and
+ * point right into it, with nothing copied. The others are read
+ * OGGSOURCE_CHUNK bytes at a time into an ogg_sync_state. Either way a page
+ * is valid until the next call on its source.
+ *
+ * Reaching the end of the input is not final: a source on a pipe or a
+ * socket may be called again once more data came in.
+ *
+ * Compile oggsource.c and oggcrc.c along with the tool using it.
+ */
+#ifndef OGGSOURCE_H
+#define	OGGSOURCE_H
+
+#include <stddef.h>
+
+#include "ogg/ogg.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define	OGGSOURCE_CHUNK	(64 * 1024)	/* bytes read at a time */
+
+typedef size_t	(*oggsource_read_func)(void *, size_t, size_t, void *);
+
+struct oggsource {
+	const unsigned char	*map;	/* the input is here, or */
+	size_t	size;
+	size_t	pos;			/* where the next page is looked for */
+	int	mapped;			/* map is ours to unmap */
+	int	fd;			/* read with read(2), or */
+	oggsource_read_func	read;	/* with this on in */
+	void	*in;
+	ogg_sync_state	oy;		/* what was read */
+	ogg_int64_t	offset;		/* input offset past the last page */
+	int	error;
+};
+
+int	oggsource_open_mem(struct oggsource *s, const void *buf, size_t len);
+int	oggsource_open_map(struct oggsource *s, int fd);
+int	oggsource_open_fd(struct oggsource *s, int fd);
+int	oggsource_open_func(struct oggsource *s, oggsource_read_func read,
+	    void *in);
+int	oggsource_feed(struct oggsource *s, const void *buf, size_t len);
+int	oggsource_page(struct oggsource *s, ogg_page *og);
+int	oggsource_packet(struct oggsource *s, ogg_stream_state *os,
+	    ogg_packet *op);
+void	oggsource_close(struct oggsource *s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* OGGSOURCE_H */
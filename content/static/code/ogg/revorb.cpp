@@ -24,29 +24,206 @@
 /*# LFLAGS=/NODEFAULTLIB:MSVCRT /LTCG /OPT:REF /MANIFEST:NO #*/
 
 #include <stdio.h>
-#include <io.h>
+#include <stdlib.h>
 #include <fcntl.h>
 #include <string.h>
 #include <ogg/ogg.h>
-#pragma comment(lib, "libogg-rsd.lib")
 #include <vorbis/codec.h>
+#include "oggaio.h"
+#include "oggcrc.h"
+#include "oggindex.h"
+#include "oggpager.h"
+#include "oggreplace.h"
+#include "oggsink.h"
+#include "oggsource.h"
+#include "skeleton.h"
+#include "vorbiscache.h"
+#ifdef _WIN32
+#include <io.h>
+#define fseeko _fseeki64
+#pragma comment(lib, "libogg-rsd.lib")
 #pragma comment(lib, "libvorbis-rsd.lib")
 #pragma comment(lib, "msvcrt-ddk.lib")
 #pragma comment(lib, "bufferoverflowu.lib")
 #pragma comment(lib, "libcmt.lib")
+#else
+#include <errno.h>
+#include <limits.h>
+#include <locale.h>
+#include <poll.h>
+#include <time.h>
+#include <wchar.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+/* Just enough of the MSVC wide-char CRT to build the same code on POSIX. */
+#define _O_BINARY 0
+#define _fileno fileno
+#define _setmode(fd, mode) ((void)(fd), (void)(mode))
+
+static bool wpath(char *buf, const wchar_t *path)
+{
+  size_t len = wcstombs(buf, path, PATH_MAX);
+  return len != (size_t)-1 && len < PATH_MAX;
+}
+
+static FILE *_wfopen(const wchar_t *path, const wchar_t *mode)
+{
+  char p[PATH_MAX], m[8];
+  if (!wpath(p, path) || wcstombs(m, mode, sizeof(m)) >= sizeof(m))
+    return NULL;
+  return fopen(p, m);
+}
+
+static int _wunlink(const wchar_t *path)
+{
+  char p[PATH_MAX];
+  return wpath(p, path) ? unlink(p) : -1;
+}
+#endif
 
 bool g_failed;
 
-bool copy_headers(FILE *fi, ogg_sync_state *si, ogg_stream_state *is,
-                  FILE *fo, ogg_sync_state *so, ogg_stream_state *os,
-                  vorbis_info *vi)
+/*
+ * Input side, an oggsource. Regular files are mapped read-only and pages
+ * are parsed straight out of the mapping, so no byte is copied before it
+ * reaches ogg_stream_pagein(). Anything that cannot be mapped (stdin, pipes,
+ * and everything on Windows) is read ahead with oggaio, or, for a live
+ * stream (-l), read as it comes.
+ */
+struct input {
+  FILE *fp;
+  oggsource src;
+  oggaio aio;
+  bool reading;
+  bool live;
+  int timeout;                 /* ms to wait for live input, -1 for ever */
+  bool timedout;
+  ogg_page page;               /* given back by the next input_pageout() */
+  bool held;
+};
+
+#ifndef _WIN32
+/*
+ * Reads whatever live input there is, waiting at most in->timeout ms for
+ * it. Shaped like fread() for the oggsource, a timeout reads nothing and
+ * sets in->timedout.
+ */
+static size_t live_read(void *buf, size_t size, size_t nmemb, void *arg)
+{
+  input *in = (input *)arg;
+  struct pollfd pfd;
+  pfd.fd = fileno(in->fp);
+  pfd.events = POLLIN;
+
+  while(1) {
+    int n = poll(&pfd, 1, in->timeout);
+    if (n == 0) {
+      in->timedout = true;
+      return 0;
+    }
+    if (n > 0) {
+      ssize_t numread = read(pfd.fd, buf, size * nmemb);
+      if (numread >= 0)
+        return numread / size;
+    }
+    if (errno != EINTR)
+      return 0;
+  }
+}
+#endif
+
+/*
+ * Same contract as ogg_sync_pageout(): 1 page, 0 end of data, -1 skipped
+ * garbage, and 2 when live input timed out.
+ */
+static int input_pageout(input *in, ogg_page *page)
+{
+  if (in->held) {
+    *page = in->page;
+    in->held = false;
+    return 1;
+  }
+  int res = oggsource_page(&in->src, page);
+  if (res == 0 && in->timedout) {
+    in->timedout = false;
+    return 2;
+  }
+  return res;
+}
+
+/*
+ * iodepth is the number of reads kept in flight when the file is not
+ * mapped, unless it is live and read as it comes.
+ */
+static bool input_open(input *in, const wchar_t *path, int iodepth, bool live)
 {
-  char *buffer = ogg_sync_buffer(si, 4096);
-  int numread = fread(buffer, 1, 4096, fi);
-  ogg_sync_wrote(si, numread);
+  memset(in, 0, sizeof(*in));
+  oggsource_open_mem(&in->src, NULL, 0);
+  in->live = live;
+  in->timeout = -1;
+
+  if (!wcscmp(path, L"-")) {
+    in->fp = stdin;
+    _setmode(_fileno(stdin), _O_BINARY);
+  } else {
+    in->fp = _wfopen(path, L"rb");
+    if (!in->fp)
+      return false;
+  }
+
+  if (in->fp != stdin && oggsource_open_map(&in->src, _fileno(in->fp)) == 0)
+    return true;
+#ifndef _WIN32
+  if (live) {
+    oggsource_open_func(&in->src, live_read, in);
+    return true;
+  }
+#endif
+  in->reading = oggaio_open_read(&in->aio, _fileno(in->fp), iodepth) == 0;
+  oggsource_open_func(&in->src, oggaio_fread, &in->aio);
+  return in->reading;
+}
 
+/* Size of the input if known, 0 otherwise. */
+static ogg_int64_t input_size(input *in)
+{
+  if (in->src.map)
+    return in->src.size;
+#ifdef _WIN32
+  __int64 size = (in->fp != stdin ? _filelengthi64(_fileno(in->fp)) : -1);
+  return size > 0 ? size : 0;
+#else
+  struct stat st;
+  if (in->fp != stdin && fstat(_fileno(in->fp), &st) == 0 && S_ISREG(st.st_mode))
+    return st.st_size;
+  return 0;
+#endif
+}
+
+static void input_close(input *in)
+{
+  oggsource_close(&in->src);
+  if (in->reading)
+    oggaio_close(&in->aio);
+  if (in->fp)
+    fclose(in->fp);
+}
+
+bool copy_headers(input *in, ogg_stream_state *is,
+                  FILE *fo, ogg_sync_state *so, ogg_stream_state *os,
+                  vorbis_info *vi, ogg_int64_t *offset, skeleton *sk)
+{
   ogg_page page;
-  if (ogg_sync_pageout(si, &page) != 1) {
+  if (input_pageout(in, &page) != 1) {
+    fprintf(stderr, "Input is not an Ogg.\n");
+    return false;
+  }
+
+  /* skip an Ogg Skeleton track, its pages are ignored from now on */
+  if (ogg_page_bos(&page) && page.body_len >= 8 && !memcmp(page.body, "fishead", 8) &&
+      input_pageout(in, &page) != 1) {
     fprintf(stderr, "Input is not an Ogg.\n");
     return false;
   }
@@ -71,7 +248,7 @@ bool copy_headers(FILE *fi, ogg_sync_state *si, ogg_stream_state *is,
 
   vorbis_comment vc;
   vorbis_comment_init(&vc);
-  if (vorbis_synthesis_headerin(vi, &vc, &packet) < 0) {
+  if (vorbiscache_headerin(vi, &vc, &packet) < 0) {
     fprintf(stderr, "Error in header, probably not a Vorbis file.\n");
     vorbis_comment_clear(&vc);
     ogg_stream_clear(is);
@@ -83,19 +260,14 @@ bool copy_headers(FILE *fi, ogg_sync_state *si, ogg_stream_state *is,
 
   int i = 0;
   while(i < 2) {
-    int res = ogg_sync_pageout(si, &page);
+    int res = input_pageout(in, &page);
 
     if (res == 0) {
-      buffer = ogg_sync_buffer(si, 4096);
-      numread = fread(buffer, 1, 4096, fi);
-      if (numread == 0 && i < 2) {
-        fprintf(stderr, "Headers are damaged, file is probably truncated.\n");
-        ogg_stream_clear(is);
-        ogg_stream_clear(os);
-        return false;
-      }
-      ogg_sync_wrote(si, 4096);
-      continue;
+      fprintf(stderr, "Headers are damaged, file is probably truncated.\n");
+      vorbis_comment_clear(&vc);
+      ogg_stream_clear(is);
+      ogg_stream_clear(os);
+      return false;
     }
 
     if (res == 1) {
@@ -111,7 +283,7 @@ bool copy_headers(FILE *fi, ogg_sync_state *si, ogg_stream_state *is,
           ogg_stream_clear(os);
           return false;
         }
-        vorbis_synthesis_headerin(vi, &vc, &packet);
+        vorbiscache_headerin(vi, &vc, &packet);
         ogg_stream_packetin(os, &packet);
         i++;
       }
@@ -120,184 +292,1537 @@ bool copy_headers(FILE *fi, ogg_sync_state *si, ogg_stream_state *is,
 
   vorbis_comment_clear(&vc);
 
-  while(ogg_stream_flush(os,&page)) {
+  if (sk) {
+    if (skeleton_write_headers(sk, vi, os, fo) < 0) {
+      fprintf(stderr,"Cannot write headers to output.\n");
+      ogg_stream_clear(is);
+      ogg_stream_clear(os);
+      return false;
+    }
+    *offset = sk->contentoff;
+    return true;
+  }
+
+  /* no output when only checking */
+  while(fo && ogg_stream_flush(os,&page)) {
     if (fwrite(page.header, 1, page.header_len, fo) != page.header_len || fwrite(page.body, 1, page.body_len, fo) != page.body_len) {
       fprintf(stderr,"Cannot write headers to output.\n");
       ogg_stream_clear(is);
       ogg_stream_clear(os);
       return false;
     }
+    *offset += page.header_len + page.body_len;
   }
 
   return true;
 }
 
-int wmain(int argc, wchar_t **argv)
+/* Adds a seek point when a packet starts a page, if we are indexing. */
+static bool index_add(oggindex_writer *index, ogg_int64_t granpos, ogg_int64_t offset)
 {
-  if (argc < 2) {
-    fprintf(stderr, "-= REVORB - <yirkha@fud.cz> 2008/06/29 =-\n");
-    fprintf(stderr, "Recomputes page granule positions in Ogg Vorbis files.\n");
-    fprintf(stderr, "Usage:\n");
-    fprintf(stderr, "  revorb <input.ogg> [output.ogg]\n");
+  if (index && oggindex_add(index, granpos, offset) != 0) {
+    fprintf(stderr, "Out of memory.\n");
+    return false;
+  }
+  return true;
+}
+
+/*
+ * Where rewrite_pages() and live_pages() send the audio pages, through an
+ * oggpager_out. Output pagination follows the oggpager policy of the
+ * stream (-p). The pages only break where the packets tell, so any run of
+ * packets starting on a page break is laid out the same way whoever writes
+ * it. This is what lets -j rewrite pieces of the file independently and
+ * still produce the serial output.
+ */
+struct audio_out {
+  oggsink *sink;
+  oggindex_writer *index;
+  long latency;                /* -l: ms a page may wait, after */
+  ogg_int64_t deadline;        /* its first packet went in */
+};
+
+static int audio_page(void *arg, const ogg_page *page)
+{
+  if (oggsink_page(((audio_out *)arg)->sink, page) != 0) {
+    fprintf(stderr, "Unable to write page to output.\n");
+    return -1;
+  }
+  return 0;
+}
+
+static int audio_start(void *arg, ogg_int64_t granpos)
+{
+  audio_out *ao = (audio_out *)arg;
+  return index_add(ao->index, granpos, ao->sink->offset) ? 0 : -1;
+}
+
+/*
+ * The offset of out is where the audio pages start in the output. granpos
+ * and lastbs are those of the packet before the first one, 0 at the start.
+ */
+static bool rewrite_pages(input *in, ogg_stream_state *is, ogg_stream_state *os,
+                          vorbis_info *vi, oggsink *out, oggindex_writer *index,
+                          oggpager *pg, ogg_int64_t granpos, int lastbs)
+{
+  ogg_int64_t packetnum = 0;
+  ogg_packet packet;
+  ogg_page page;
+  audio_out ao = { out, index, 0, 0 };
+  oggpager_out po;
+  bool ok = true;
+
+  oggpager_out_init(&po, os, pg, audio_page, audio_start, &ao);
+  int eos = 0;
+  while(ok && !eos) {
+    int res = input_pageout(in, &page);
+    if (res == 0)
+      break;
+
+    if (res < 0) {
+      fprintf(stderr, "Warning: Corrupted or missing data in bitstream.\n");
+      g_failed = true;
+      continue;
+    }
+
+    /* other logical streams (a Skeleton track) are left out */
+    if (ogg_page_serialno(&page) != is->serialno)
+      continue;
+    if (ogg_page_eos(&page))
+      eos = 1;
+    ogg_stream_pagein(is, &page);
+
+    while(ok) {
+      res = ogg_stream_packetout(is, &packet);
+      if (res == 0)
+        break;
+      if (res < 0) {
+        fprintf(stderr, "Warning: Bitstream error.\n");
+        g_failed = true;
+        continue;
+      }
+
+      int bs = vorbis_packet_blocksize(vi, &packet);
+      if (lastbs)
+        granpos += (lastbs+bs) / 4;
+      lastbs = bs;
+
+      packet.granulepos = granpos;
+      packet.packetno = packetnum++;
+      ok = oggpager_out_packet(&po, &packet) == 0;
+    }
+  }
+
+  if (index)
+    index->lastgranulepos = granpos;
+  /* the last packet ends the stream, even if the input was cut */
+  if (ok)
+    ok = oggpager_out_end(&po, 1) == 0;
+  oggpager_out_clear(&po);
+  return ok;
+}
+
+/*
+ * The audio pages go after the headers already in fo, written behind with
+ * up to iodepth buffers in flight while the next ones are being laid out.
+ * oggaio gathers them already, so the sink passes every page on at once.
+ */
+bool rewrite_serial(input *in, ogg_stream_state *is, ogg_stream_state *os,
+                    vorbis_info *vi, FILE *fo, oggindex_writer *index,
+                    oggpager *pg, ogg_int64_t offset, int iodepth)
+{
+  oggaio out;
+  oggsink sink;
+  if (fflush(fo) != 0 || oggaio_open_write(&out, _fileno(fo), iodepth) != 0) {
+    fprintf(stderr, "Unable to write page to output.\n");
+    return false;
+  }
+  oggsink_open_func(&sink, oggaio_fwrite, &out, 0);
+  sink.offset = offset;
+  bool ok = rewrite_pages(in, is, os, vi, &sink, index, pg, 0, 0);
+  bool written = oggsink_close(&sink) == 0;
+  if (oggaio_close(&out) != 0)
+    written = false;
+  if (!written && ok) {
+    fprintf(stderr, "Unable to write page to output.\n");
+    ok = false;
+  }
+  return ok;
+}
+
+/*
+ * A page header rewritten by -g, from the granulepos to the CRC. The serial
+ * and page numbers in between are unchanged, yet one pwrite() of the 20
+ * bytes is cheaper than one for each field.
+ */
+struct patch {
+  ogg_int64_t offset;          /* of the page in the file */
+  unsigned char bytes[20];     /* header bytes 6 to 25 */
+};
+
+struct patchlist {
+  patch *patches;
+  size_t count, size;
+};
+
+/* Records the header of page with granulepos set to granpos, and its CRC. */
+static bool patch_add(patchlist *pl, const input *in, const ogg_page *page, ogg_int64_t granpos)
+{
+  if (pl->count == pl->size) {
+    size_t size = pl->size ? pl->size * 2 : 256;
+    patch *p = (patch *)realloc(pl->patches, size * sizeof(*p));
+    if (!p) {
+      fprintf(stderr, "Out of memory.\n");
+      return false;
+    }
+    pl->patches = p;
+    pl->size = size;
+  }
+
+  unsigned char header[27 + 255];
+  ogg_page og = *page;
+  memcpy(header, page->header, page->header_len);
+  og.header = header;
+  for (int i = 0; i < 8; i++)
+    header[6 + i] = (unsigned char)((ogg_uint64_t)granpos >> (8 * i));
+  oggcrc_page_set(&og);
+
+  patch *p = &pl->patches[pl->count++];
+  p->offset = page->header - in->src.map;
+  memcpy(p->bytes, header + 6, sizeof(p->bytes));
+  return true;
+}
+
+/*
+ * --check: goes through the audio pages like rewrite_serial(), without
+ * writing anything, and stops at the first one whose granulepos is not the
+ * one it would write. The last page may hold a smaller one, this is how
+ * encoders trim the end of the stream. Damaged or unterminated streams
+ * fail the check too, since a rewrite would change them.
+ *
+ * With pl, every wrong page is recorded in it instead, and only damage
+ * fails. The input must then be mapped, for the page offsets.
+ */
+bool check_serial(input *in, ogg_stream_state *is, vorbis_info *vi, patchlist *pl)
+{
+  ogg_int64_t granpos = 0;
+  int lastbs = 0;
+  ogg_packet packet;
+  ogg_page page;
+
+  while(1) {
+    int res = input_pageout(in, &page);
+    if (res == 0) {
+      fprintf(stderr, "Stream has no end of stream page.\n");
+      return false;
+    }
+    if (res < 0) {
+      fprintf(stderr, "Corrupted or missing data in bitstream.\n");
+      return false;
+    }
+    if (ogg_page_serialno(&page) != is->serialno)
+      continue;
+    ogg_stream_pagein(is, &page);
+
+    int completed = 0;
+    while((res = ogg_stream_packetout(is, &packet)) != 0) {
+      if (res < 0) {
+        fprintf(stderr, "Bitstream error.\n");
+        return false;
+      }
+      int bs = vorbis_packet_blocksize(vi, &packet);
+      if (lastbs)
+        granpos += (lastbs+bs) / 4;
+      lastbs = bs;
+      completed++;
+    }
+
+    ogg_int64_t expected = completed ? granpos : -1;
+    ogg_int64_t found = ogg_page_granulepos(&page);
+    bool eos = ogg_page_eos(&page) != 0;
+    if (found != expected && !(eos && completed && found >= 0 && found < expected)) {
+      if (pl) {
+        if (!patch_add(pl, in, &page, expected))
+          return false;
+      } else {
+        fprintf(stderr, "Page %ld has granulepos %lld instead of %lld.\n",
+                ogg_page_pageno(&page), (long long)found, (long long)expected);
+        return false;
+      }
+    }
+    if (eos)
+      return true;
+  }
+}
+
+#ifndef _WIN32
+/*
+ * -g: fixes the granulepos of a file in place, when only they are wrong.
+ * The pages are left as they are, and the header of each wrong one gets
+ * its new granulepos and CRC, so the whole file is read but only a few
+ * bytes per page are written. Nothing is written unless the whole stream
+ * could be read, and the patches are synced before returning. A Skeleton
+ * index, if any, is left as it was.
+ */
+static int patch_file(const wchar_t *path)
+{
+  char p[PATH_MAX];
+  input in;
+  int fd, res = 2;
+
+  if (!wpath(p, path) || (fd = open(p, O_WRONLY)) == -1) {
+    fprintf(stderr, "%S: Cannot open the file to patch it.\n", path);
+    return 2;
+  }
+  /* the page offsets come from the mapping */
+  if (!input_open(&in, path, 0, false) || !in.src.map) {
+    fprintf(stderr, "%S: Cannot map the file to patch it.\n", path);
+    input_close(&in);
+    close(fd);
+    return 2;
+  }
+
+  ogg_stream_state stream_in, stream_out;
+  ogg_int64_t offset = 0;
+  vorbis_info vi;
+  patchlist pl;
+  memset(&pl, 0, sizeof(pl));
+
+  vorbis_info_init(&vi);
+  if (copy_headers(&in, &stream_in, NULL, NULL, &stream_out, &vi, &offset, NULL)) {
+    if (check_serial(&in, &stream_in, &vi, &pl)) {
+      res = 0;
+      for (size_t i = 0; i < pl.count && res == 0; i++) {
+        patch *pt = &pl.patches[i];
+        if (pwrite(fd, pt->bytes, sizeof(pt->bytes), pt->offset + 6) != (ssize_t)sizeof(pt->bytes))
+          res = 2;
+      }
+      if (res == 0 && pl.count > 0 && fdatasync(fd) != 0)
+        res = 2;
+      if (res != 0)
+        fprintf(stderr, "%S: Cannot patch the file.\n", path);
+    }
+    ogg_stream_clear(&stream_in);
+    ogg_stream_clear(&stream_out);
+  }
+  vorbiscache_info_clear(&vi);
+  free(pl.patches);
+  close(fd);
+  input_close(&in);
+  return res;
+}
+#endif
+
+#ifndef _WIN32
+/*
+ * -l: filters an endless stream, such as a live Icecast source, instead
+ * of a file. Each BOS page starts a new chained link, whose granulepos
+ * start over from 0, even when the link before it never ended. Pages go
+ * out as soon as they are laid out, and the one being filled is flushed
+ * once latency ms went by since its first packet went in, however little
+ * it holds. The last packet which came in is only put in when the next
+ * one does, so that a link cut short still ends with an EOS page. Nothing
+ * is kept from one link to the next but its serial number, so the memory
+ * used does not grow with the running time.
+ */
+static ogg_int64_t now_ms(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (ogg_int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Holds the BOS page of the next link for copy_headers(), false at the end. */
+static bool live_next_link(input *in)
+{
+  ogg_page page;
+
+  in->timeout = -1;
+  while(1) {
+    int res = input_pageout(in, &page);
+    if (res == 0)
+      return false;
+    if (res < 0) {
+      fprintf(stderr, "Warning: Corrupted or missing data in bitstream.\n");
+      g_failed = true;
+      continue;
+    }
+    if (ogg_page_bos(&page)) {
+      in->page = page;
+      in->held = true;
+      return true;
+    }
+  }
+}
+
+static int live_start(void *arg, ogg_int64_t granpos)
+{
+  audio_out *ao = (audio_out *)arg;
+  (void)granpos;
+  ao->deadline = now_ms() + ao->latency;
+  return 0;
+}
+
+/* The audio pages of a link, up to its EOS page or the next link. */
+static bool live_pages(input *in, ogg_stream_state *is, ogg_stream_state *os,
+                       vorbis_info *vi, oggsink *out, oggpager *pg, long latency)
+{
+  ogg_int64_t granpos = 0, packetnum = 0;
+  int lastbs = 0;
+  ogg_packet packet;
+  ogg_page page;
+  audio_out ao = { out, NULL, latency, 0 };
+  oggpager_out po;
+  bool ok = true;
+
+  oggpager_out_init(&po, os, pg, audio_page, live_start, &ao);
+  int eos = 0;
+  while(ok && !eos) {
+    if (pg->segs > 0) {
+      ogg_int64_t left = ao.deadline - now_ms();
+      in->timeout = left > 0 ? (int)left : 0;
+    } else {
+      in->timeout = -1;
+    }
+    int res = input_pageout(in, &page);
+    if (res == 0)
+      break;
+    if (res == 2) {
+      /* the packet held back waits for the next one */
+      ok = oggpager_out_flush(&po) == 0;
+      continue;
+    }
+    if (res < 0) {
+      fprintf(stderr, "Warning: Corrupted or missing data in bitstream.\n");
+      g_failed = true;
+      continue;
+    }
+
+    /* the next link, this one was cut short, whatever its serial number */
+    if (ogg_page_bos(&page)) {
+      in->page = page;
+      in->held = true;
+      break;
+    }
+    if (ogg_page_serialno(&page) != is->serialno)
+      continue;
+    if (ogg_page_eos(&page))
+      eos = 1;
+    ogg_stream_pagein(is, &page);
+
+    while(ok) {
+      res = ogg_stream_packetout(is, &packet);
+      if (res == 0)
+        break;
+      if (res < 0) {
+        fprintf(stderr, "Warning: Bitstream error.\n");
+        g_failed = true;
+        continue;
+      }
+
+      int bs = vorbis_packet_blocksize(vi, &packet);
+      if (lastbs)
+        granpos += (lastbs+bs) / 4;
+      lastbs = bs;
+
+      packet.granulepos = granpos;
+      packet.packetno = packetnum++;
+      ok = oggpager_out_packet(&po, &packet) == 0;
+      if (ok && pg->segs > 0 && now_ms() >= ao.deadline)
+        ok = oggpager_out_flush(&po) == 0;
+    }
+  }
+
+  if (ok)
+    ok = oggpager_out_end(&po, 1) == 0;
+  oggpager_out_clear(&po);
+  return ok;
+}
+
+/* Writes every link of in to fo, each page as soon as it is laid out. */
+bool rewrite_live(input *in, FILE *fo, const oggpager_rules *rules, long latency)
+{
+  oggsink sink;
+  bool ok = true, first = true;
+  ogg_uint32_t serialno = 0;
+
+  if (fflush(fo) != 0 || oggsink_open_fd(&sink, _fileno(fo), 0) != 0) {
+    fprintf(stderr, "Unable to write page to output.\n");
+    return false;
+  }
+
+  while (ok && live_next_link(in)) {
+    ogg_stream_state is, os;
+    ogg_int64_t offset = 0;
+    ogg_page page;
+    vorbis_info vi;
+
+    vorbis_info_init(&vi);
+    /* a link with broken headers is left out, the next one may be fine */
+    if (!copy_headers(in, &is, NULL, NULL, &os, &vi, &offset, NULL)) {
+      g_failed = true;
+      vorbiscache_info_clear(&vi);
+      continue;
+    }
+    /* chained links need serial numbers of their own */
+    if (!first && (ogg_uint32_t)os.serialno == serialno)
+      os.serialno = (ogg_uint32_t)(serialno + 1);
+    serialno = (ogg_uint32_t)os.serialno;
+    first = false;
+
+    while (ok && ogg_stream_flush(&os, &page)) {
+      if (oggsink_page(&sink, &page) != 0) {
+        fprintf(stderr, "Cannot write headers to output.\n");
+        ok = false;
+      }
+    }
+
+    oggpager pager;
+    oggpager_init(&pager, oggpager_lookup(rules, is.serialno), vi.rate, 0);
+    if (ok)
+      ok = live_pages(in, &is, &os, &vi, &sink, &pager, latency);
+    if (ok && rules->count > 0)
+      oggpager_report(&pager, stderr, NULL, os.serialno);
+
+    ogg_stream_clear(&is);
+    ogg_stream_clear(&os);
+    vorbiscache_info_clear(&vi);
+  }
+
+  if (oggsink_close(&sink) != 0 && ok) {
+    fprintf(stderr, "Unable to write page to output.\n");
+    ok = false;
+  }
+  return ok;
+}
+
+/*
+ * -j: the audio pages are cut into one chunk per thread at page boundaries.
+ *
+ * 1. Each thread lists the size and blocksize of the packets starting in its
+ *    chunk, reading past its end only to complete the last one.
+ * 2. A serial prefix pass over these lists gives, for every chunk, the
+ *    first page break at or after its start, and the granulepos, lastbs,
+ *    page number and output offset the serial pass would have there.
+ * 3. Each thread writes the pages from that break up to the next chunk's
+ *    one with pwrite(), at its offset.
+ */
+struct packet_info {
+  unsigned int bytes;
+  int bs;
+};
+
+struct chunk {
+  size_t start, end;
+  bool eos, failed;
+  long first_pageno, last_pageno;
+  packet_info *packets;
+  size_t npackets, size;
+
+  /* set by the prefix pass */
+  bool starts;                 /* whether a page break falls in this chunk */
+  size_t skip, count;          /* packets to skip over, then to write */
+  ogg_int64_t granpos;
+  int lastbs;
+  long pageno;
+  off_t offset;
+};
+
+struct split {
+  const input *in;
+  int serialno;
+  vorbis_info *vi;
+  chunk *chunks;
+  int nchunks, last;           /* chunk count, last one with a page break */
+  int fd;
+  off_t base;                  /* where the audio pages go in the output */
+  oggindex_writer *index;
+  const oggpager_policy *policy;
+  oggpager *pager;             /* of the serial pass, for the counts */
+};
+
+struct split_job {
+  split *sp;
+  chunk *c;
+  bool ok;
+  bool running;
+  pthread_t thread;
+};
+
+/* Returns the offset of the first valid page at or after pos. */
+static size_t next_page(const input *in, size_t pos)
+{
+  input view = *in;
+  ogg_page page;
+  int res;
+
+  view.src.pos = pos;
+  while ((res = oggsource_page(&view.src, &page)) < 0)
+    ;
+  return res ? view.src.pos - page.header_len - page.body_len : in->src.size;
+}
+
+/*
+ * Pulls the next page of our stream before end into is, 0 when there is
+ * none. Corrupted data is reported through failed, unless it is NULL.
+ */
+static int chunk_pagein(split *sp, input *view, size_t end, ogg_stream_state *is,
+                        ogg_page *page, long *first_pageno, bool *failed)
+{
+  while (view->src.pos < end) {
+    int res = oggsource_page(&view->src, page);
+    if (res == 0)
+      break;
+    if (res < 0) {
+      if (failed) {
+        fprintf(stderr, "Warning: Corrupted or missing data in bitstream.\n");
+        *failed = true;
+      }
+      continue;
+    }
+    if (ogg_page_serialno(page) != sp->serialno)
+      continue;
+    /* a fresh stream would see a gap before the first page */
+    if (*first_pageno < 0)
+      is->pageno = *first_pageno = ogg_page_pageno(page);
+    ogg_stream_pagein(is, page);
     return 1;
   }
+  return 0;
+}
 
-  FILE *fi;
-  if (!wcscmp(argv[1], L"-")) {
-    fi = stdin;
-    _setmode(_fileno(stdin), _O_BINARY);
+static bool chunk_add(chunk *c, ogg_packet *packet, vorbis_info *vi)
+{
+  if (c->npackets == c->size) {
+    size_t size = c->size ? 2 * c->size : 1024;
+    packet_info *p = (packet_info *)realloc(c->packets, size * sizeof(*p));
+    if (!p)
+      return false;
+    c->packets = p;
+    c->size = size;
+  }
+  c->packets[c->npackets].bytes = packet->bytes;
+  c->packets[c->npackets].bs = vorbis_packet_blocksize(vi, packet);
+  c->npackets++;
+  return true;
+}
+
+static void *split_scan(void *arg)
+{
+  split_job *job = (split_job *)arg;
+  split *sp = job->sp;
+  chunk *c = job->c;
+  input view = *sp->in;
+  ogg_stream_state is;
+  ogg_packet packet;
+  ogg_page page;
+  bool pending = false;
+
+  view.src.pos = c->start;
+  ogg_stream_init(&is, sp->serialno);
+
+  while (job->ok && !c->eos &&
+         chunk_pagein(sp, &view, c->end, &is, &page, &c->first_pageno, &c->failed)) {
+    int res;
+    c->last_pageno = ogg_page_pageno(&page);
+    c->eos = ogg_page_eos(&page);
+    pending = page.header[26] && page.header[27 + page.header[26] - 1] == 255;
+
+    while (job->ok && (res = ogg_stream_packetout(&is, &packet)) != 0) {
+      if (res < 0) {
+        fprintf(stderr, "Warning: Bitstream error.\n");
+        c->failed = true;
+        continue;
+      }
+      job->ok = chunk_add(c, &packet, sp->vi);
+    }
+  }
+
+  /* finish the packet running into the next chunk, it's ours */
+  while (job->ok && pending && !c->eos &&
+         chunk_pagein(sp, &view, sp->in->src.size, &is, &page, &c->first_pageno, NULL)) {
+    int res = ogg_stream_packetout(&is, &packet);
+    if (res > 0)
+      job->ok = chunk_add(c, &packet, sp->vi);
+    pending = (res == 0);
+  }
+
+  ogg_stream_clear(&is);
+  return NULL;
+}
+
+/* Accounts for the pages the writers will flush. */
+static void split_flushed(oggpager *pg, off_t *offset, long *pageno)
+{
+  long pages = pg->pages;
+  *offset += oggpager_flushed(pg);
+  *pageno += pg->pages - pages;
+}
+
+/*
+ * Turns the packet lists into a starting point for every chunk writer. The
+ * seek index is built here as well, it only needs the page offsets.
+ */
+static bool split_prefix(split *sp, long pageno)
+{
+  ogg_int64_t granpos = 0;
+  int lastbs = 0;
+  oggpager *pg = sp->pager;
+  off_t offset = 0;
+  long last_pageno = -1;
+  size_t total = 0, begin = 0;
+  chunk *prev = NULL;
+
+  sp->last = -1;
+  for (int k = 0; k < sp->nchunks; k++) {
+    chunk *c = &sp->chunks[k];
+
+    if (c->failed)
+      g_failed = true;
+    if (c->first_pageno >= 0) {
+      if (last_pageno >= 0 && c->first_pageno != last_pageno + 1) {
+        fprintf(stderr, "Warning: Bitstream error.\n");
+        g_failed = true;
+      }
+      last_pageno = c->last_pageno;
+    }
+
+    for (size_t i = 0; i < c->npackets; i++) {
+      int bs = c->packets[i].bs;
+      ogg_int64_t next = lastbs ? granpos + (lastbs+bs) / 4 : granpos;
+      if (oggpager_due(pg, next))
+        split_flushed(pg, &offset, &pageno);
+
+      bool group = (pg->segs == 0);
+      if (group && !c->starts) {
+        c->starts = true;
+        c->skip = i;
+        c->granpos = granpos;
+        c->lastbs = lastbs;
+        c->pageno = pageno;
+        c->offset = offset;
+        if (prev)
+          prev->count = total + i - begin;
+        prev = c;
+        begin = total + i;
+        sp->last = k;
+      }
+
+      granpos = next;
+      lastbs = bs;
+      if (group && !index_add(sp->index, granpos, sp->base + offset))
+        return false;
+      if (oggpager_add(pg, c->packets[i].bytes, granpos))
+        split_flushed(pg, &offset, &pageno);
+    }
+    total += c->npackets;
+
+    /* the serial pass stops at the end of stream too */
+    if (c->eos) {
+      sp->nchunks = k + 1;
+      break;
+    }
+  }
+  if (prev)
+    prev->count = total - begin;
+  split_flushed(pg, &offset, &pageno);
+  if (sp->index)
+    sp->index->lastgranulepos = granpos;
+  return true;
+}
+
+static bool write_all(int fd, const unsigned char *buf, size_t len, off_t offset)
+{
+  while (len > 0) {
+    ssize_t n = pwrite(fd, buf, len, offset);
+    if (n <= 0)
+      return false;
+    buf += n;
+    len -= n;
+    offset += n;
+  }
+  return true;
+}
+
+/* The pages a -j writer lays out, before they go to the file. */
+struct page_buf {
+  unsigned char *buf;
+  size_t len, size;
+};
+
+/* Adds a page at the end of the page_buf arg. */
+static int append_page(void *arg, const ogg_page *opage)
+{
+  page_buf *pb = (page_buf *)arg;
+  size_t need = pb->len + opage->header_len + opage->body_len;
+  if (need > pb->size) {
+    size_t nsize = need > 2 * pb->size ? need : 2 * pb->size;
+    unsigned char *p = (unsigned char *)realloc(pb->buf, nsize);
+    if (!p)
+      return -1;
+    pb->buf = p;
+    pb->size = nsize;
+  }
+  memcpy(pb->buf + pb->len, opage->header, opage->header_len);
+  memcpy(pb->buf + pb->len + opage->header_len, opage->body, opage->body_len);
+  pb->len = need;
+  return 0;
+}
+
+static void *split_write(void *arg)
+{
+  split_job *job = (split_job *)arg;
+  split *sp = job->sp;
+  chunk *c = job->c;
+  input view = *sp->in;
+  ogg_stream_state is, os;
+  ogg_packet packet;
+  ogg_page page;
+  ogg_int64_t granpos = c->granpos;
+  int lastbs = c->lastbs;
+  oggpager pg;
+  oggpager_out po;
+  size_t skip = c->skip, count = c->count;
+  long first_pageno = -1;
+  off_t offset = sp->base + c->offset;
+  page_buf pb = { NULL, 0, 0 };
+
+  view.src.pos = c->start;
+  oggpager_init(&pg, sp->policy, sp->vi->rate, granpos);
+  ogg_stream_init(&is, sp->serialno);
+  ogg_stream_init(&os, sp->serialno);
+  os.pageno = c->pageno;
+  os.b_o_s = 1;
+  oggpager_out_init(&po, &os, &pg, append_page, NULL, &pb);
+
+  while (job->ok && count > 0 &&
+         chunk_pagein(sp, &view, sp->in->src.size, &is, &page, &first_pageno, NULL)) {
+    int res;
+    while (job->ok && count > 0 && (res = ogg_stream_packetout(&is, &packet)) != 0) {
+      if (res < 0)
+        continue;
+      if (skip > 0) {
+        skip--;
+        continue;
+      }
+
+      int bs = vorbis_packet_blocksize(sp->vi, &packet);
+      if (lastbs)
+        granpos += (lastbs+bs) / 4;
+      lastbs = bs;
+      packet.granulepos = granpos;
+      job->ok = oggpager_out_packet(&po, &packet) == 0;
+      count--;
+
+      if (job->ok && pb.len >= (1 << 20)) {
+        job->ok = write_all(sp->fd, pb.buf, pb.len, offset);
+        offset += pb.len;
+        pb.len = 0;
+      }
+    }
+  }
+
+  /*
+   * The last writer ends the stream with its last packet, like
+   * rewrite_serial(). The others end with a page break, but it may only be
+   * due to the next packet.
+   */
+  if (job->ok)
+    job->ok = oggpager_out_end(&po, c == &sp->chunks[sp->last]) == 0;
+  if (job->ok && pb.len > 0)
+    job->ok = write_all(sp->fd, pb.buf, pb.len, offset);
+
+  oggpager_out_clear(&po);
+  free(pb.buf);
+  ogg_stream_clear(&is);
+  ogg_stream_clear(&os);
+  return NULL;
+}
+
+static bool run_jobs(split *sp, void *(*fn)(void *), bool only_starting)
+{
+  split_job *jobs = (split_job *)calloc(sp->nchunks, sizeof(split_job));
+  bool ok = (jobs != NULL);
+
+  for (int k = 0; ok && k < sp->nchunks; k++) {
+    jobs[k].sp = sp;
+    jobs[k].c = &sp->chunks[k];
+    jobs[k].ok = true;
+    if (only_starting && !sp->chunks[k].starts)
+      continue;
+    jobs[k].running = (pthread_create(&jobs[k].thread, NULL, fn, &jobs[k]) == 0);
+    if (!jobs[k].running)
+      fn(&jobs[k]);
+  }
+  for (int k = 0; ok && k < sp->nchunks; k++) {
+    if (jobs[k].running)
+      pthread_join(jobs[k].thread, NULL);
+  }
+  for (int k = 0; ok && k < sp->nchunks; k++)
+    ok = jobs[k].ok;
+
+  free(jobs);
+  return ok;
+}
+
+/*
+ * Same output as rewrite_serial() using nthreads threads. Only possible when
+ * the input is mapped and the output is a regular file.
+ */
+bool rewrite_split(input *in, ogg_stream_state *os, vorbis_info *vi, FILE *fo,
+                   int nthreads, oggindex_writer *index,
+                   const oggpager_policy *policy, oggpager *pg)
+{
+  struct stat st;
+  split sp;
+  bool ok;
+
+  memset(&sp, 0, sizeof(sp));
+  sp.in = in;
+  sp.serialno = os->serialno;
+  sp.vi = vi;
+  sp.fd = fileno(fo);
+  sp.index = index;
+  sp.policy = policy;
+  sp.pager = pg;
+  if (fflush(fo) != 0 || fstat(sp.fd, &st) != 0 || (sp.base = ftello(fo)) < 0) {
+    fprintf(stderr, "Unable to write page to output.\n");
+    return false;
+  }
+
+  sp.nchunks = nthreads;
+  sp.chunks = (chunk *)calloc(sp.nchunks, sizeof(chunk));
+  if (!sp.chunks) {
+    fprintf(stderr, "Out of memory.\n");
+    return false;
+  }
+  for (int k = 0; k < sp.nchunks; k++) {
+    chunk *c = &sp.chunks[k];
+    c->start = k ? next_page(in, in->src.pos + (in->src.size - in->src.pos) / nthreads * k) : in->src.pos;
+    if (k && c->start < sp.chunks[k - 1].start)
+      c->start = sp.chunks[k - 1].start;
+    c->first_pageno = c->last_pageno = -1;
+    if (k)
+      sp.chunks[k - 1].end = c->start;
+  }
+  sp.chunks[sp.nchunks - 1].end = in->src.size;
+
+  ok = run_jobs(&sp, split_scan, false);
+  if (ok) {
+    ok = split_prefix(&sp, os->pageno);
+    if (ok && sp.last >= 0 && !run_jobs(&sp, split_write, true)) {
+      fprintf(stderr, "Unable to write page to output.\n");
+      ok = false;
+    }
   } else {
-    fi = _wfopen(argv[1], L"rb");
-    if (!fi) {
-      fprintf(stderr, "Could not open input file.\n");
-      return 2;
+    fprintf(stderr, "Out of memory.\n");
+  }
+
+  for (int k = 0; k < nthreads; k++)
+    free(sp.chunks[k].packets);
+  free(sp.chunks);
+  return ok;
+}
+#endif
+
+#ifndef _WIN32
+/*
+ * -r: repairs a file whose pages only go wrong from some point on, as an
+ * encoder crash or a truncated upload leaves them, by rewriting its tail.
+ *
+ * 1. The audio pages are bisected by offset. A probe reads REPAIR_PROBES
+ *    pages from the first page break at an offset, and holds when their
+ *    granulepos follow the first one by the blocksizes of their packets.
+ * 2. From the last offset that held, the pages are checked one by one
+ *    like --check, up to the first wrong or damaged one.
+ * 3. The file is rewritten in place from the last page starting on a fresh
+ *    packet before that one, and cut after the new last page.
+ *
+ * The time taken thus depends on the size of the damaged tail, not of the
+ * file. Wrong pages followed by sound ones, such as a tail whose granulepos
+ * are all shifted, hold in the probes and are not found: --check tells
+ * about those, and a rewrite of the whole file fixes them.
+ */
+#define REPAIR_PROBES 4        /* pages with packets read by a probe */
+#define REPAIR_SPAN 65536      /* bytes left when the bisection stops */
+
+/* Where the pages can be rewritten from, and the state right before. */
+struct repair_point {
+  size_t offset;               /* of a page starting on a fresh packet */
+  long pageno;
+  ogg_int64_t granpos;
+  int lastbs;
+};
+
+enum { REPAIR_WRONG, REPAIR_HELD, REPAIR_SOUND };
+
+/*
+ * Checks the pages of our stream from the first page break at or after
+ * pos, at most max of those with packets, or all when max is negative.
+ * From the start of the audio granpos starts at 0, elsewhere the first
+ * page with packets is taken as it is. The last point before a fresh
+ * packet seen on the way goes in *restart, when it is not NULL; its offset
+ * stays 0 if there was none.
+ *
+ * Returns REPAIR_SOUND when the stream ends as it should, REPAIR_HELD after
+ * max good pages, REPAIR_WRONG on a wrong or damaged page, or at the end
+ * of the data without the end of the stream.
+ */
+static int repair_scan(const input *in, int serialno, vorbis_info *vi,
+                       size_t pos, bool start, long max, repair_point *restart)
+{
+  input view = *in;
+  ogg_stream_state is;
+  ogg_packet packet;
+  ogg_page page;
+  ogg_int64_t granpos = start ? 0 : -1;
+  int lastbs = 0, res, status = REPAIR_WRONG;
+  bool first = true;
+  long checked = 0;
+
+  if (restart)
+    restart->offset = 0;
+  view.src.pos = next_page(in, pos);
+  ogg_stream_init(&is, serialno);
+  while (max < 0 || checked < max) {
+    size_t offset = view.src.pos;
+    if ((res = oggsource_page(&view.src, &page)) <= 0)
+      break;
+    if (ogg_page_serialno(&page) != serialno)
+      continue;
+    /* a fresh stream would see a gap before the first page */
+    if (first)
+      is.pageno = ogg_page_pageno(&page);
+    first = false;
+    if (restart && granpos >= 0 && !ogg_page_continued(&page)) {
+      restart->offset = offset;
+      restart->pageno = ogg_page_pageno(&page);
+      restart->granpos = granpos;
+      restart->lastbs = lastbs;
     }
+    ogg_stream_pagein(&is, &page);
+
+    int completed = 0;
+    while ((res = ogg_stream_packetout(&is, &packet)) > 0) {
+      int bs = vorbis_packet_blocksize(vi, &packet);
+      if (granpos >= 0 && lastbs)
+        granpos += (lastbs+bs) / 4;
+      lastbs = bs;
+      completed++;
+    }
+    if (res < 0)
+      break;
+    if (!completed)
+      continue;
+
+    ogg_int64_t found = ogg_page_granulepos(&page);
+    bool eos = ogg_page_eos(&page) != 0;
+    if (granpos < 0) {
+      if (found < 0)
+        break;
+      granpos = found;
+    } else if (found != granpos && !(eos && found >= 0 && found < granpos)) {
+      break;
+    } else {
+      checked++;
+    }
+    if (eos) {
+      status = REPAIR_SOUND;
+      break;
+    }
+  }
+  if (max >= 0 && checked == max)
+    status = REPAIR_HELD;
+
+  ogg_stream_clear(&is);
+  return status;
+}
+
+/*
+ * Rewrites the pages of in from r on, to the same offset of fd, and cuts
+ * the file after them. The tail is copied first, as the new pages may
+ * overwrite the old ones before they are read.
+ */
+static bool repair_tail(const input *in, int fd, int serialno, vorbis_info *vi,
+                        const oggpager_rules *rules, const repair_point *r)
+{
+  size_t len = in->src.size - r->offset;
+  unsigned char *tail = (unsigned char *)malloc(len);
+  if (!tail) {
+    fprintf(stderr, "Out of memory.\n");
+    return false;
   }
+  memcpy(tail, in->src.map + r->offset, len);
 
+  input view = *in;
+  view.src.map = tail;
+  view.src.size = len;
+  view.src.pos = 0;
+
+  ogg_stream_state is, os;
+  ogg_stream_init(&is, serialno);
+  ogg_stream_init(&os, serialno);
+  is.pageno = os.pageno = r->pageno;
+  os.b_o_s = 1;                 /* the first page is still the one before */
+
+  oggpager pager;
+  oggpager_init(&pager, oggpager_lookup(rules, serialno), vi->rate, r->granpos);
+  oggsink sink;
+  bool ok = lseek(fd, r->offset, SEEK_SET) != -1 && oggsink_open_fd(&sink, fd, OGGSINK_BATCH) == 0;
+  if (ok) {
+    sink.offset = r->offset;
+    ok = rewrite_pages(&view, &is, &os, vi, &sink, NULL, &pager, r->granpos, r->lastbs);
+    if (oggsink_close(&sink) != 0 || ftruncate(fd, sink.offset) != 0 || fdatasync(fd) != 0)
+      ok = false;
+  }
+
+  ogg_stream_clear(&is);
+  ogg_stream_clear(&os);
+  free(tail);
+  return ok;
+}
+
+static int repair_file(const wchar_t *path, const oggpager_rules *rules)
+{
+  char p[PATH_MAX];
+  input in;
+  int fd, res = 2;
+
+  if (!wpath(p, path) || (fd = open(p, O_WRONLY)) == -1) {
+    fprintf(stderr, "%S: Cannot open the file to repair it.\n", path);
+    return 2;
+  }
+  /* the probes read the pages right out of the mapping */
+  if (!input_open(&in, path, 0, false) || !in.src.map) {
+    fprintf(stderr, "%S: Cannot map the file to repair it.\n", path);
+    input_close(&in);
+    close(fd);
+    return 2;
+  }
+
+  ogg_stream_state stream_in, stream_out;
+  ogg_int64_t offset = 0;
+  vorbis_info vi;
+
+  vorbis_info_init(&vi);
+  if (copy_headers(&in, &stream_in, NULL, NULL, &stream_out, &vi, &offset, NULL)) {
+    int serialno = stream_in.serialno;
+    size_t start = in.src.pos, lo = start, hi = in.src.size;
+    repair_point r;
+
+    while (hi - lo > REPAIR_SPAN) {
+      size_t mid = lo + (hi - lo) / 2;
+      if (repair_scan(&in, serialno, &vi, mid, false, REPAIR_PROBES, NULL) != REPAIR_WRONG)
+        lo = mid;
+      else
+        hi = mid;
+    }
+    int status = repair_scan(&in, serialno, &vi, lo, lo == start, -1, &r);
+    /* the first wrong page came before any fresh one, look from the start */
+    if (status != REPAIR_SOUND && r.offset == 0 && lo != start)
+      status = repair_scan(&in, serialno, &vi, start, true, -1, &r);
+
+    if (status == REPAIR_SOUND) {
+      res = 0;
+    } else if (r.offset == 0) {
+      fprintf(stderr, "%S: No audio page to repair from.\n", path);
+    } else if (repair_tail(&in, fd, serialno, &vi, rules, &r)) {
+      res = 0;
+    } else {
+      fprintf(stderr, "%S: Cannot repair the file.\n", path);
+    }
+    ogg_stream_clear(&stream_in);
+    ogg_stream_clear(&stream_out);
+  }
+  vorbiscache_info_clear(&vi);
+  close(fd);
+  input_close(&in);
+  return res;
+}
+#endif
+
+/*
+ * What applies to every file rewritten.
+ */
+struct options {
+  int nthreads, iodepth;
+  bool indexing, skeletal;
+  long interval;
+  oggpager_rules rules;
+#ifndef _WIN32
+  oggreplace batch;            /* files rewritten in place, to be put back */
+#endif
+};
+
+#ifndef _WIN32
+/* Tell about the files a commit or flush of the batch could not replace. */
+static void replace_failed(oggreplace *batch)
+{
+  for (int i = 0; i < batch->nfailed; i++)
+    fprintf(stderr, "%s: Could not put the output file back in place.\n", batch->failed[i]);
+  oggreplace_clear(batch);
+}
+#endif
+
+/*
+ * Rewrite path to out, or in place when out is NULL. On POSIX a file
+ * rewritten in place is queued in opts->batch, and is only put back when the
+ * batch is flushed. Return 0, or 2 when the input or output cannot be opened.
+ */
+static int revorb(const wchar_t *path, const wchar_t *out, options *opts)
+{
+  input in;
+  if (!input_open(&in, path, opts->iodepth, false)) {
+    fprintf(stderr, "Could not open input file.\n");
+    input_close(&in);
+    return 2;
+  }
+
+#ifndef _WIN32
+  oggreplace_file replace;
+#else
   wchar_t tmpName[260];
+#endif
   FILE *fo;
-  if (argc >= 3) {
-    if (!wcscmp(argv[2], L"-")) {
+  if (out) {
+    if (!wcscmp(out, L"-")) {
       fo = stdout;
       _setmode(_fileno(stdout), _O_BINARY);
     } else {
-      fo = _wfopen(argv[2], L"wb");
+      fo = _wfopen(out, L"wb");
       if (!fo) {
         fprintf(stderr, "Could not open output file.\n");
-        fclose(fi);
+        input_close(&in);
         return 2;
       }
     }
   } else {
-    wcscpy(tmpName, argv[1]);
+#ifndef _WIN32
+    /* fclose() must leave the descriptor to oggreplace, so it gets a dup */
+    char p[PATH_MAX];
+    int fd = -1;
+    fo = NULL;
+    if (wpath(p, path) && oggreplace_open(&replace, p) != -1) {
+      if ((fd = dup(replace.fd)) != -1 && !(fo = fdopen(fd, "wb")))
+        close(fd);
+      if (!fo)
+        oggreplace_abort(&replace);
+    }
+#else
+    wcscpy(tmpName, path);
     wcscat(tmpName, L".tmp");
     fo = _wfopen(tmpName, L"wb");
+#endif
     if (!fo) {
       fprintf(stderr, "Could not open output file.\n");
-      fclose(fi);
+      input_close(&in);
       return 2;
     }
     g_failed = false;
   }
 
-  ogg_sync_state sync_in, sync_out;
-  ogg_sync_init(&sync_in);
+  ogg_sync_state sync_out;
   ogg_sync_init(&sync_out);
 
   ogg_stream_state stream_in, stream_out;
   vorbis_info vi;
   vorbis_info_init(&vi);
 
-  ogg_packet packet;
-  ogg_page page;
+  oggindex_writer index;
+  ogg_int64_t offset = 0;
+  oggindex_writer_init(&index, 0, 0, opts->interval);
 
-  if (copy_headers(fi, &sync_in, &stream_in, fo, &sync_out, &stream_out, &vi)) {
-    ogg_int64_t granpos = 0, packetnum = 0;
-    int lastbs = 0;
-
-    while(1) {
-//    ogg_int64_t logstream_startgran = granpos;
-
-      int eos = 0;
-      while(!eos) {
-        int res = ogg_sync_pageout(&sync_in, &page);
-        if (res == 0) {
-          char *buffer = ogg_sync_buffer(&sync_in, 4096);
-          int numread = fread(buffer, 1, 4096, fi);
-          if (numread > 0)
-            ogg_sync_wrote(&sync_in, numread);
-          else
-            eos = 2;
-          continue;
-        }
-
-        if (res < 0) {
-          fprintf(stderr, "Warning: Corrupted or missing data in bitstream.\n");
-          g_failed = true;
-        } else {
-          if (ogg_page_eos(&page))
-            eos = 1;
-          ogg_stream_pagein(&stream_in,&page);
-
-          while(1) {
-            res = ogg_stream_packetout(&stream_in, &packet);
-            if (res == 0)
-              break;
-            if (res < 0) {
-              fprintf(stderr, "Warning: Bitstream error.\n");
-              g_failed = true;
-              continue;
-            }
-
-            /*
-            if (packet.granulepos >= 0) {
-              granpos = packet.granulepos + logstream_startgran;
-              packet.granulepos = granpos;
-            }
-            */
-            int bs = vorbis_packet_blocksize(&vi, &packet);
-            if (lastbs)
-              granpos += (lastbs+bs) / 4;
-            lastbs = bs;
-
-            packet.granulepos = granpos;
-            packet.packetno = packetnum++;
-            if (!packet.e_o_s) {
-              ogg_stream_packetin(&stream_out, &packet);
-
-              ogg_page opage;
-              while(ogg_stream_pageout(&stream_out, &opage)) {
-                if (fwrite(opage.header, 1, opage.header_len, fo) != opage.header_len || fwrite(opage.body, 1, opage.body_len, fo) != opage.body_len) {
-                  fprintf(stderr, "Unable to write page to output.\n");
-                  eos = 2;
-                  g_failed = true;
-                  break;
-                }
-              }
-            }
-          }
-        }
-      }
-
-      if (eos == 2)
-        break;
+  skeleton sk;
+  skeleton_init(&sk, input_size(&in), opts->interval);
 
-      {
-        packet.e_o_s = 1;
-        ogg_stream_packetin(&stream_out, &packet);
-        ogg_page opage;
-        while(ogg_stream_flush(&stream_out, &opage)) {
-          if (fwrite(opage.header, 1, opage.header_len, fo) != opage.header_len || fwrite(opage.body, 1, opage.body_len, fo) != opage.body_len) {
-            fprintf(stderr, "Unable to write page to output.\n");
-            g_failed = true;
-            break;
-          }
-        }
-        ogg_stream_clear(&stream_in);
-        break;
-      }
+  if (copy_headers(&in, &stream_in, fo, &sync_out, &stream_out, &vi, &offset, opts->skeletal ? &sk : NULL)) {
+    bool ok;
+    oggindex_writer *indexp = (opts->indexing || opts->skeletal) ? &index : NULL;
+    oggindex_writer_init(&index, stream_out.serialno, vi.rate, opts->interval);
+    const oggpager_policy *policy = oggpager_lookup(&opts->rules, stream_out.serialno);
+    oggpager pager;
+    oggpager_init(&pager, policy, vi.rate, 0);
+#ifndef _WIN32
+    struct stat st;
+    if (opts->nthreads > 1 && in.src.map && fstat(fileno(fo), &st) == 0 && S_ISREG(st.st_mode))
+      ok = rewrite_split(&in, &stream_out, &vi, fo, opts->nthreads, indexp, policy, &pager);
+    else
+#endif
+      ok = rewrite_serial(&in, &stream_in, &stream_out, &vi, fo, indexp, &pager, offset, opts->iodepth);
+    if (ok && opts->rules.count > 0) {
+      char name[1024];
+      size_t len = wcstombs(name, path, sizeof(name));
+      bool named = !out && len != (size_t)-1 && len < sizeof(name);
+      oggpager_report(&pager, stderr, named ? name : NULL, stream_out.serialno);
+    }
+    /* the keypoints go in the Skeleton pages written with the headers */
+    if (ok && opts->skeletal && (fflush(fo) != 0 || fseeko(fo, 0, SEEK_END) != 0 || skeleton_finish(&sk, &index, fo) != 0)) {
+      fprintf(stderr, "Cannot write the Skeleton index.\n");
+      ok = false;
     }
+    if (!ok)
+      g_failed = true;
 
+    ogg_stream_clear(&stream_in);
     ogg_stream_clear(&stream_out);
   } else {
     g_failed = true;
   }
 
-  vorbis_info_clear(&vi);
+  vorbiscache_info_clear(&vi);
 
-  ogg_sync_clear(&sync_in);
   ogg_sync_clear(&sync_out);
 
-  fclose(fi);
-  fclose(fo);
+  input_close(&in);
+  if (fclose(fo) != 0)
+    g_failed = true;
+
+  /* the index goes along with the output, when it is kept */
+  if (opts->indexing && (out || !g_failed)) {
+    const wchar_t *name = out ? out : path;
+    wchar_t *idxName = (wchar_t *)malloc((wcslen(name) + 5) * sizeof(wchar_t));
+    FILE *fx = NULL;
+    if (idxName) {
+      wcscpy(idxName, name);
+      wcscat(idxName, L".idx");
+      fx = _wfopen(idxName, L"wb");
+    }
+    bool written = fx && oggindex_write(&index, fx) == 0;
+    if (fx && fclose(fx) != 0)
+      written = false;
+    if (!written) {
+      fprintf(stderr, "%S.idx: Could not write the seek index.\n", name);
+      if (fx)
+        _wunlink(idxName);
+    }
+    free(idxName);
+  }
+  oggindex_writer_clear(&index);
 
-  if (argc < 3) {
+  if (!out) {
+#ifndef _WIN32
+    if (g_failed) {
+      oggreplace_abort(&replace);
+    } else if (oggreplace_commit(&opts->batch, &replace) != 0) {
+      replace_failed(&opts->batch);
+    }
+#else
     if (g_failed) {
       _wunlink(tmpName);
     } else {
-      if (_wunlink(argv[1]) || _wrename(tmpName, argv[1]))
+      if (_wunlink(path) || _wrename(tmpName, path))
         fprintf(stderr, "%S: Could not put the output file back in place.\n", tmpName);
     }
+#endif
   }
   return 0;
 }
+
+int wmain(int argc, wchar_t **argv)
+{
+  bool checking = false, inplace = false, patching = false, repairing = false;
+  long latency = -1;
+  options opts;
+  int argi = 1;
+
+  opts.nthreads = 1;
+  opts.iodepth = OGGAIO_DEPTH;
+  opts.indexing = opts.skeletal = false;
+  opts.interval = OGGINDEX_INTERVAL;
+  opts.rules.count = 0;
+
+  while (argi < argc && argv[argi][0] == L'-' && argv[argi][1]) {
+    wchar_t opt = argv[argi][1];
+    if (!wcscmp(argv[argi], L"--check")) {
+      checking = true;
+    } else if (opt == L'i' && !argv[argi][2]) {
+      inplace = true;
+    } else if (opt == L'g' && !argv[argi][2]) {
+      patching = true;
+    } else if (opt == L'r' && !argv[argi][2]) {
+      repairing = true;
+    } else if (opt == L'x' && !argv[argi][2]) {
+      opts.indexing = true;
+    } else if (opt == L's' && !argv[argi][2]) {
+      opts.skeletal = true;
+    } else if (opt == L'p') {
+      const wchar_t *p = argv[argi][2] ? argv[argi] + 2 : (argi + 1 < argc ? argv[++argi] : L"");
+      char policy[64];
+      size_t len = wcstombs(policy, p, sizeof(policy));
+      if (len == (size_t)-1 || len >= sizeof(policy) || oggpager_parse(&opts.rules, policy) != 0)
+        argi = argc;
+    } else if (opt == L'j' || opt == L't' || opt == L'q' || opt == L'l') {
+      const wchar_t *n = argv[argi][2] ? argv[argi] + 2 : (argi + 1 < argc ? argv[++argi] : L"");
+      wchar_t *end;
+      long value = wcstol(n, &end, 10);
+      if (end == n || value < (opt == L'q' || opt == L'l' ? 0 : 1))
+        argi = argc;
+      else if (opt == L'j')
+        opts.nthreads = value;
+      else if (opt == L'q')
+        opts.iodepth = value;
+      else if (opt == L'l')
+        latency = value;
+      else
+        opts.interval = value;
+    } else {
+      argi = argc;
+    }
+    argi++;
+  }
+  wchar_t **args = argv + argi;
+  int nargs = argc - argi;
+
+  if (nargs < 1 || ((opts.indexing || opts.skeletal) && nargs >= 2 && !wcscmp(args[1], L"-")) ||
+      (latency >= 0 && (nargs < 2 || opts.indexing || opts.skeletal || checking || inplace)) ||
+      (inplace && checking) ||
+      (patching && (inplace || checking || latency >= 0 || opts.indexing || opts.skeletal ||
+                    opts.nthreads > 1 || opts.rules.count > 0 || repairing)) ||
+      (repairing && (inplace || checking || latency >= 0 || opts.indexing || opts.skeletal ||
+                     opts.nthreads > 1))) {
+    fprintf(stderr, "-= REVORB - <yirkha@fud.cz> 2008/06/29 =-\n");
+    fprintf(stderr, "Recomputes page granule positions in Ogg Vorbis files.\n");
+    fprintf(stderr, "Usage:\n");
+    fprintf(stderr, "  revorb [-j threads] [-q depth] [-p policy] [-s] [-x] [-t ms] <input.ogg> [output.ogg]\n");
+    fprintf(stderr, "  revorb -i [-j threads] [-q depth] [-p policy] [-s] [-x] [-t ms] <file.ogg>...\n");
+    fprintf(stderr, "  revorb -g <file.ogg>...\n");
+    fprintf(stderr, "  revorb -r [-p policy] <file.ogg>...\n");
+    fprintf(stderr, "  revorb --check <input.ogg>\n");
+    fprintf(stderr, "  revorb -l ms [-p policy] <input.ogg> <output.ogg>\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -i          rewrite every file given in place, syncing them to disk together\n");
+    fprintf(stderr, "  -g          only fix the granulepos in the page headers of every file given,\n");
+    fprintf(stderr, "              in place, when their pages need no other change\n");
+    fprintf(stderr, "  -r          find where every file given goes wrong, and rewrite it in\n");
+    fprintf(stderr, "              place from there on, for damaged or truncated endings\n");
+    fprintf(stderr, "  -j threads  rewrite the file with several threads\n");
+    fprintf(stderr, "  -q depth    I/O buffers in flight, 0 for blocking I/O (default %d)\n", OGGAIO_DEPTH);
+    fprintf(stderr, "  -p policy   page layout, and report the page overhead: live, archive,\n");
+    fprintf(stderr, "              or bytes[/ms] per page, for one stream with serial:policy\n");
+    fprintf(stderr, "  -s          add an Ogg Skeleton track with a seek index\n");
+    fprintf(stderr, "  -x          also write a seek index to <output.ogg>.idx\n");
+    fprintf(stderr, "  -t ms       audio between two index entries (default %d)\n", OGGINDEX_INTERVAL);
+    fprintf(stderr, "  --check     only read the file, exit with 3 if it needs a rewrite\n");
+    fprintf(stderr, "  -l ms       filter a live stream of chained links, e.g. - -, and flush\n");
+    fprintf(stderr, "              a page at the latest ms after its first packet came in\n");
+    return 1;
+  }
+
+  if (checking) {
+    input in;
+    if (!input_open(&in, args[0], opts.iodepth, false)) {
+      fprintf(stderr, "Could not open input file.\n");
+      input_close(&in);
+      return 2;
+    }
+
+    ogg_stream_state stream_in, stream_out;
+    ogg_int64_t offset = 0;
+    vorbis_info vi;
+    int res = 2;
+
+    vorbis_info_init(&vi);
+    if (copy_headers(&in, &stream_in, NULL, NULL, &stream_out, &vi, &offset, NULL)) {
+      res = check_serial(&in, &stream_in, &vi, NULL) ? 0 : 3;
+      ogg_stream_clear(&stream_in);
+      ogg_stream_clear(&stream_out);
+    }
+    vorbiscache_info_clear(&vi);
+    input_close(&in);
+    return res;
+  }
+
+  if (patching) {
+#ifndef _WIN32
+    int res = 0;
+    for (int i = 0; i < nargs; i++) {
+      if (patch_file(args[i]) != 0)
+        res = 2;
+    }
+    return res;
+#else
+    fprintf(stderr, "Patching in place is not supported on Windows.\n");
+    return 2;
+#endif
+  }
+
+  if (repairing) {
+#ifndef _WIN32
+    int res = 0;
+    for (int i = 0; i < nargs; i++) {
+      if (repair_file(args[i], &opts.rules) != 0)
+        res = 2;
+    }
+    return res;
+#else
+    fprintf(stderr, "Repairing in place is not supported on Windows.\n");
+    return 2;
+#endif
+  }
+
+  if (latency >= 0) {
+    input in;
+    if (!input_open(&in, args[0], opts.iodepth, true)) {
+      fprintf(stderr, "Could not open input file.\n");
+      input_close(&in);
+      return 2;
+    }
+    FILE *fo = stdout;
+    if (wcscmp(args[1], L"-"))
+      fo = _wfopen(args[1], L"wb");
+    else
+      _setmode(_fileno(stdout), _O_BINARY);
+    if (!fo) {
+      fprintf(stderr, "Could not open output file.\n");
+      input_close(&in);
+      return 2;
+    }
+#ifndef _WIN32
+    bool ok = rewrite_live(&in, fo, &opts.rules, latency);
+#else
+    fprintf(stderr, "Live streams are not supported on Windows.\n");
+    bool ok = false;
+#endif
+    input_close(&in);
+    if (fclose(fo) != 0)
+      ok = false;
+    return ok ? 0 : 2;
+  }
+
+#ifndef _WIN32
+  oggreplace_init(&opts.batch);
+#endif
+  int res = 0;
+  if (!inplace) {
+    res = revorb(args[0], nargs >= 2 ? args[1] : NULL, &opts);
+  } else {
+    for (int i = 0; i < nargs; i++) {
+      if (revorb(args[i], NULL, &opts) != 0)
+        res = 2;
+    }
+  }
+#ifndef _WIN32
+  if (oggreplace_flush(&opts.batch) != 0)
+    replace_failed(&opts.batch);
+#endif
+  return res;
+}
+
+#ifndef _WIN32
+int main(int argc, char **argv)
+{
+  setlocale(LC_CTYPE, "");
+
+  wchar_t **wargv = (wchar_t **)calloc(argc + 1, sizeof(*wargv));
+  for (int i = 0; i < argc; i++) {
+    size_t len = mbstowcs(NULL, argv[i], 0);
+    if (len == (size_t)-1) {
+      fprintf(stderr, "%s: invalid multibyte string.\n", argv[i]);
+      return 2;
+    }
+    wargv[i] = (wchar_t *)calloc(len + 1, sizeof(wchar_t));
+    mbstowcs(wargv[i], argv[i], len + 1);
+  }
+  return wmain(argc, wargv);
+}
+#endif
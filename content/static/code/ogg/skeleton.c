@@ -0,0 +1,317 @@
+/*
+ * skeleton.c
+ *
+ * Ogg Skeleton 4.0 track with a keyframe index, see skeleton.h.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "skeleton.h"
+
+#ifdef _WIN32
+#define	fseeko	_fseeki64
+#define	ftello	_ftelli64
+#endif
+
+#define	FISHEAD_LEN	80
+#define	FISBONE_FIELDS	"Content-Type: audio/vorbis\r\n" \
+			"Role: audio/main\r\n" \
+			"Name: audio_0\r\n"
+#define	FISBONE_LEN	(52 + sizeof(FISBONE_FIELDS) - 1)
+#define	INDEX_HEADER_LEN	42
+#define	KEYPOINT_ROOM	8	/* bytes reserved for each expected keypoint */
+
+
+static void
+put32(unsigned char *p, ogg_uint32_t v)
+{
+
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+	p[2] = (v >> 16) & 0xff;
+	p[3] = (v >> 24) & 0xff;
+}
+
+
+static void
+put64(unsigned char *p, ogg_int64_t v)
+{
+
+	put32(p, v & 0xffffffff);
+	put32(p + 4, (v >> 32) & 0xffffffff);
+}
+
+
+/**
+ * encode v as a Skeleton variable length integer (seven bits per byte, least
+ * significant first, the last byte has its high bit set) into p, unless it
+ * is NULL.
+ *
+ * return the encoded length.
+ */
+static int
+put_vint(unsigned char *p, ogg_int64_t v)
+{
+	unsigned char b;
+	int n = 0;
+
+	do {
+		b = v & 0x7f;
+		v >>= 7;
+		if (v == 0)
+			b |= 0x80;
+		if (p != NULL)
+			p[n] = b;
+		n++;
+	} while (v != 0);
+	return (n);
+}
+
+
+static void
+fishead(unsigned char *p, const struct skeleton *sk, ogg_int64_t seglen)
+{
+
+	(void)memset(p, 0, FISHEAD_LEN);
+	(void)memcpy(p, "fishead", 8);
+	p[8] = 4;		/* version 4.0 */
+	put64(p + 20, 1000);	/* presentation time, 0/1000 */
+	put64(p + 36, 1000);	/* base time, 0/1000 */
+	put64(p + 64, seglen);
+	put64(p + 72, sk->contentoff);
+}
+
+
+static void
+fisbone(unsigned char *p, const struct skeleton *sk)
+{
+
+	(void)memset(p, 0, FISBONE_LEN);
+	(void)memcpy(p, "fisbone", 8);
+	put32(p + 8, 44);	/* message header fields offset */
+	put32(p + 12, sk->serialno);
+	put32(p + 16, sk->nheaders);
+	put64(p + 20, sk->rate);	/* granule rate, rate/1 */
+	put64(p + 28, 1);
+	put32(p + 44, 2);	/* Vorbis needs the previous packet */
+	(void)memcpy(p + 52, FISBONE_FIELDS, sizeof(FISBONE_FIELDS) - 1);
+}
+
+
+/**
+ * lay out the index packet into the sk->indexlen bytes at p, with the
+ * keypoints of w when it is not NULL. Keypoints are thinned out until they
+ * fit, the remaining bytes are zeroed.
+ */
+static void
+index_packet(unsigned char *p, const struct skeleton *sk,
+    const struct oggindex_writer *w)
+{
+	const struct oggindex_entry *e;
+	ogg_int64_t n, lastoff, lastgp;
+	size_t i, step = 1;
+	long len;
+
+	(void)memset(p, 0, sk->indexlen);
+	(void)memcpy(p, "index", 6);
+	put32(p + 6, sk->serialno);
+	put64(p + 18, sk->rate);	/* timestamps are in samples */
+	if (w == NULL || w->count == 0)
+		return;
+
+	for (;;) {
+		len = INDEX_HEADER_LEN;
+		lastoff = lastgp = 0;
+		for (i = 0; i < w->count; i += step) {
+			e = &w->entries[i];
+			len += put_vint(NULL, e->offset - lastoff);
+			len += put_vint(NULL, e->granulepos - lastgp);
+			lastoff = e->offset;
+			lastgp = e->granulepos;
+		}
+		if (len <= sk->indexlen)
+			break;
+		step *= 2;
+	}
+
+	n = 0;
+	len = INDEX_HEADER_LEN;
+	lastoff = lastgp = 0;
+	for (i = 0; i < w->count; i += step) {
+		e = &w->entries[i];
+		len += put_vint(p + len, e->offset - lastoff);
+		len += put_vint(p + len, e->granulepos - lastgp);
+		lastoff = e->offset;
+		lastgp = e->granulepos;
+		n++;
+	}
+	put64(p + 10, n);
+	put64(p + 26, w->entries[0].granulepos);
+	put64(p + 34, w->lastgranulepos);
+}
+
+
+/**
+ * put the len bytes at data as the next packet of the Skeleton stream ss,
+ * and write its pages if flush is set.
+ *
+ * return 0 on success and -1 on error.
+ */
+static int
+put_packet(ogg_stream_state *ss, unsigned char *data, long len, int eos,
+    int flush, FILE *fp)
+{
+	ogg_packet op;
+	ogg_page og;
+
+	(void)memset(&op, 0, sizeof(ogg_packet));
+	op.packet = data;
+	op.bytes = len;
+	op.b_o_s = (ss->packetno == 0);
+	op.e_o_s = eos;
+	op.packetno = ss->packetno;
+	if (ogg_stream_packetin(ss, &op) != 0)
+		return (-1);
+	while (flush && ogg_stream_flush(ss, &og)) {
+		if (fwrite(og.header, 1, og.header_len, fp) != (size_t)og.header_len)
+			return (-1);
+		if (fwrite(og.body, 1, og.body_len, fp) != (size_t)og.body_len)
+			return (-1);
+	}
+	return (0);
+}
+
+
+/**
+ * setup sk for an input of size bytes and a keypoint every interval_ms
+ * milliseconds.
+ */
+void
+skeleton_init(struct skeleton *sk, ogg_int64_t size, long interval_ms)
+{
+
+	(void)memset(sk, 0, sizeof(struct skeleton));
+	sk->size = size;
+	sk->interval = interval_ms;
+}
+
+
+/**
+ * write the header pages of the Vorbis stream os, which holds the three
+ * header packets and nothing else yet, along with the Skeleton ones:
+ *
+ *   fishead | Vorbis id | fisbone, index | Vorbis comment, setup | EOS
+ *
+ * return the number of Vorbis pages written on success and -1 on error.
+ */
+int
+skeleton_write_headers(struct skeleton *sk, vorbis_info *vi,
+    ogg_stream_state *os, FILE *fp)
+{
+	unsigned char head[FISHEAD_LEN], bone[FISBONE_LEN], *index = NULL;
+	ogg_stream_state ss;
+	ogg_page og;
+	ogg_int64_t keypoints;
+	long bitrate;
+	int npages = 0, ret = -1;
+
+	sk->serialno = os->serialno;
+	sk->rate = vi->rate;
+	sk->nheaders = 3;
+	/* twice the keypoints we expect, VBR files stray from the nominal
+	   bitrate */
+	bitrate = (vi->bitrate_nominal > 0 ? vi->bitrate_nominal : 32000);
+	keypoints = sk->size * 8 / bitrate * 1000 / sk->interval;
+	sk->indexlen = INDEX_HEADER_LEN + (2 * keypoints + 16) * KEYPOINT_ROOM;
+	if ((index = malloc(sk->indexlen)) == NULL)
+		return (-1);
+	if (ogg_stream_init(&ss, (ogg_uint32_t)sk->serialno + 1) == -1) {
+		free(index);
+		return (-1);
+	}
+	fishead(head, sk, 0);
+	fisbone(bone, sk);
+	index_packet(index, sk, NULL);
+
+	if ((sk->headoff = ftello(fp)) == -1)
+		goto out;
+	if (put_packet(&ss, head, FISHEAD_LEN, 0, 1, fp) == -1)
+		goto out;
+	/* the id header is alone on the first Vorbis page */
+	if (ogg_stream_flush(os, &og) == 0)
+		goto out;
+	if (fwrite(og.header, 1, og.header_len, fp) != (size_t)og.header_len ||
+	    fwrite(og.body, 1, og.body_len, fp) != (size_t)og.body_len)
+		goto out;
+	npages++;
+
+	if ((sk->boneoff = ftello(fp)) == -1)
+		goto out;
+	if (put_packet(&ss, bone, FISBONE_LEN, 0, 0, fp) == -1 ||
+	    put_packet(&ss, index, sk->indexlen, 0, 1, fp) == -1)
+		goto out;
+	while (ogg_stream_flush(os, &og)) {
+		if (fwrite(og.header, 1, og.header_len, fp) != (size_t)og.header_len ||
+		    fwrite(og.body, 1, og.body_len, fp) != (size_t)og.body_len)
+			goto out;
+		npages++;
+	}
+	if (put_packet(&ss, head, 0, 1, 1, fp) == -1)
+		goto out;
+	if ((sk->contentoff = ftello(fp)) == -1)
+		goto out;
+	ret = npages;
+	/* FALLTHROUGH */
+out:
+	ogg_stream_clear(&ss);
+	free(index);
+	return (ret);
+}
+
+
+/**
+ * write the Skeleton pages again, now with the keypoints collected by w and
+ * the actual layout. The segment ends at the current position of fp, which
+ * is restored.
+ *
+ * return 0 on success and -1 on error.
+ */
+int
+skeleton_finish(struct skeleton *sk, const struct oggindex_writer *w,
+    FILE *fp)
+{
+	unsigned char head[FISHEAD_LEN], bone[FISBONE_LEN], *index;
+	ogg_stream_state ss;
+	ogg_int64_t end;
+	int ret = -1;
+
+	if ((end = ftello(fp)) == -1)
+		return (-1);
+	if ((index = malloc(sk->indexlen)) == NULL)
+		return (-1);
+	if (ogg_stream_init(&ss, (ogg_uint32_t)sk->serialno + 1) == -1) {
+		free(index);
+		return (-1);
+	}
+	fishead(head, sk, end);
+	fisbone(bone, sk);
+	index_packet(index, sk, w);
+
+	/* same packets length, same pages */
+	if (fseeko(fp, sk->headoff, SEEK_SET) == -1 ||
+	    put_packet(&ss, head, FISHEAD_LEN, 0, 1, fp) == -1)
+		goto out;
+	if (fseeko(fp, sk->boneoff, SEEK_SET) == -1 ||
+	    put_packet(&ss, bone, FISBONE_LEN, 0, 0, fp) == -1 ||
+	    put_packet(&ss, index, sk->indexlen, 0, 1, fp) == -1)
+		goto out;
+	if (fseeko(fp, end, SEEK_SET) == -1)
+		goto out;
+	ret = 0;
+	/* FALLTHROUGH */
+out:
+	ogg_stream_clear(&ss);
+	free(index);
+	return (ret);
+}
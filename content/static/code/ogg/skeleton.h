@@ -0,0 +1,53 @@
+/*
+ * skeleton.h
+ *
+ * Ogg Skeleton 4.0 track with a keyframe index, multiplexed in front of a
+ * Vorbis stream while it is rewritten, see
+ * https://wiki.xiph.org/Ogg_Skeleton_4
+ *
+ * The index packet is written with room for the keypoints expected from the
+ * input size and bitrate. Once the audio is out, skeleton_finish() fills in
+ * the keypoints, the content offset and the segment length and writes the
+ * Skeleton pages again over the first ones: the packets keep their length,
+ * so the pages do too and the rest of the file is left alone. When there are
+ * more keypoints than room, every other one is dropped until they fit.
+ *
+ * The output has to be seekable. Compile skeleton.c and oggindex.c along
+ * with the tool using it.
+ */
+#ifndef SKELETON_H
+#define	SKELETON_H
+
+#include <stdio.h>
+
+#include "ogg/ogg.h"
+#include "vorbis/codec.h"
+#include "oggindex.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct skeleton {
+	ogg_int64_t	size;		/* input size, to guess the duration */
+	long	interval;		/* milliseconds between keypoints */
+	int	serialno;		/* of the Vorbis stream */
+	long	rate;
+	long	nheaders;		/* Vorbis header packets */
+	long	indexlen;		/* length of the index packet */
+	ogg_int64_t	headoff;	/* where the fishead page is */
+	ogg_int64_t	boneoff;	/* where the fisbone and index pages are */
+	ogg_int64_t	contentoff;	/* where the first audio page is */
+};
+
+void	skeleton_init(struct skeleton *sk, ogg_int64_t size, long interval_ms);
+int	skeleton_write_headers(struct skeleton *sk, vorbis_info *vi,
+	    ogg_stream_state *os, FILE *fp);
+int	skeleton_finish(struct skeleton *sk, const struct oggindex_writer *w,
+	    FILE *fp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SKELETON_H */
@@ -9,20 +9,41 @@
  * last modified: $Id: vcedit.c,v 1.10 2001/03/04 06:01:27 msmith Exp $
  */
 
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <ogg/ogg.h>
 #include <vorbis/codec.h>
 
 #include "vcedit.h"
+#include "oggcrc.h"
+#include "oggsink.h"
+#include "vorbiscache.h"
 
-#define CHUNKSIZE 4096
+/* Room left after the comments, so that later edits can be done in place */
+#define PADDING 512
+
+/* Where vcedit_write_mem() writes, or counts the bytes it would when buf is
+ * NULL. */
+struct vcedit_mem {
+	unsigned char	*buf;
+	long		len;
+	long		size;
+	int		full;		/* a write did not fit */
+};
+
+static int vcedit_open_source(vcedit_state *state);
+static int vcedit_mem_eos(vcedit_state *state);
 
 vcedit_state *vcedit_new_state(void)
 {
 	vcedit_state *state = malloc(sizeof(vcedit_state));
 	memset(state, 0, sizeof(vcedit_state));
+	state->padding = PADDING;
+	state->vcoffset = -1;
+	state->audiooffset = -1;
 
 	return state;
 }
@@ -45,18 +66,18 @@ static void vcedit_clear_internals(vcedit_state *state)
 		free(state->vc);
 		state->vc=NULL;
 	}
-	if(state->os)
-	{
-		ogg_stream_clear(state->os);
-		free(state->os);
-		state->os=NULL;
-	}
-	if(state->oy)
-	{
-		ogg_sync_clear(state->oy);
-		free(state->oy);
-		state->oy=NULL;
-	}
+	/* The stream, the source and the buffers are kept for the next file,
+	 * only vcedit_clear() frees them. */
+	if(state->src)
+		oggsource_close(state->src);
+	state->in=NULL;
+	state->inlen=0;
+	state->mainlen=0;
+	state->booklen=0;
+	state->vcpageslen=0;
+	state->vcoffset=-1;
+	state->audiooffset=-1;
+	state->headerpages=0;
 }
 
 void vcedit_clear(vcedit_state *state)
@@ -64,22 +85,198 @@ void vcedit_clear(vcedit_state *state)
 	if(state)
 	{
 		vcedit_clear_internals(state);
+		if(state->os)
+		{
+			ogg_stream_clear(state->os);
+			free(state->os);
+		}
+		free(state->src);
+		free(state->mainbuf);
+		free(state->bookbuf);
+		free(state->vcpages);
 		free(state);
 	}
 }
 
+/* Copies the len bytes at data to *buf, which is grown when its size is too
+ * small. Returns 0, or -1 when out of memory. */
+static int vcedit_keep(unsigned char **buf, long *size, const void *data,
+		long len)
+{
+	unsigned char *p;
+
+	if(len > *size)
+	{
+		if((p = realloc(*buf, len)) == NULL)
+			return -1;
+		*buf = p;
+		*size = len;
+	}
+	memcpy(*buf, data, len);
+	return 0;
+}
+
+/* Keeps a copy of a page holding (part of) the comment header, for
+ * vcedit_write_inplace(). The comment pages must follow one another: a page
+ * of another stream in between, or a first page which does not begin with
+ * the comment header, and they are not updated in place. */
+static void vcedit_keep_page(vcedit_state *state, ogg_page *og)
+{
+	unsigned char *pages;
+	long len = og->header_len + og->body_len;
+
+	if(state->vcoffset < 0)
+		return;
+	if(ogg_page_serialno(og) != state->serial ||
+			(state->vcpageslen == 0 && (ogg_page_continued(og) ||
+			og->body_len < 7 || memcmp(og->body, "\003vorbis", 7) != 0)))
+	{
+		state->vcoffset = -1;
+		return;
+	}
+
+	if(state->vcpageslen + len > state->vcpagessize)
+	{
+		pages = realloc(state->vcpages, state->vcpageslen + len);
+		if(pages == NULL)
+		{
+			state->vcoffset = -1;
+			return;
+		}
+		state->vcpages = pages;
+		state->vcpagessize = state->vcpageslen + len;
+	}
+	pages = state->vcpages;
+	memcpy(pages + state->vcpageslen, og->header, og->header_len);
+	memcpy(pages + state->vcpageslen + og->header_len, og->body, og->body_len);
+	state->vcpageslen += len;
+}
+
+/* Walks the comment header packet laid out in the len bytes of pages, from
+ * the beginning of the first page body. If packet is not NULL, it replaces
+ * the comment header (it must be exactly as long) and the page checksums
+ * are updated. Returns the length of the comment header, -1 if the pages end
+ * before it does. */
+static long vcedit_walk_comment_pages(unsigned char *pages, long len,
+		const unsigned char *packet)
+{
+	long pos = 0, done = 0;
+	int end = 0;
+
+	while(!end && pos + 27 <= len)
+	{
+		ogg_page og;
+		long bodypos = 0;
+		int s, segs = pages[pos + 26];
+
+		og.header = pages + pos;
+		og.header_len = 27 + segs;
+		og.body = og.header + og.header_len;
+		og.body_len = 0;
+		for(s = 0; s < segs; s++)
+			og.body_len += og.header[27 + s];
+
+		for(s = 0; s < segs && !end; s++)
+		{
+			int seg = og.header[27 + s];
+
+			if(packet)
+				memcpy(og.body + bodypos, packet + done, seg);
+			bodypos += seg;
+			done += seg;
+			end = seg < 255;
+		}
+		if(packet)
+			oggcrc_page_set(&og);
+		pos += og.header_len + og.body_len;
+	}
+
+	return end ? done : -1;
+}
+
 int vcedit_open(vcedit_state *state, FILE *in)
 {
 	return vcedit_open_callbacks(state, (void *)in, 
 			(vcedit_read_func)fread, (vcedit_write_func)fwrite);
 }
 
+/* read_func and write_func are called like fread() and fwrite(), on in and on
+ * the out given to vcedit_write(). oggaio_fread() and oggaio_fwrite(), with an
+ * oggaio reader and writer, keep the disk busy while the pages are rebuilt. */
 int vcedit_open_callbacks(vcedit_state *state, void *in,
 		vcedit_read_func read_func, vcedit_write_func write_func)
 {
+	state->in = in;
+	state->read = read_func;
+	state->write = write_func;
 
-	char *buffer;
-	int bytes,i;
+	/* the pages come through a source, which keeps the input offset */
+	if(state->src == NULL &&
+			(state->src = malloc(sizeof(struct oggsource))) == NULL)
+	{
+		state->lasterror = "Out of memory.";
+		return -1;
+	}
+	oggsource_open_func(state->src, read_func, in);
+	return vcedit_open_source(state);
+}
+
+/* Opens the len bytes at buf, a whole file already in memory, for
+ * vcedit_write_mem(). They are parsed where they are, nothing is copied, and
+ * must stay there until the state is written or cleared. */
+int vcedit_open_mem(vcedit_state *state, const void *buf, long len)
+{
+	state->in = (void *)buf;
+	state->inlen = len;
+	state->read = NULL;
+	state->write = NULL;
+
+	if(state->src == NULL &&
+			(state->src = malloc(sizeof(struct oggsource))) == NULL)
+	{
+		state->lasterror = "Out of memory.";
+		return -1;
+	}
+	oggsource_open_mem(state->src, buf, len);
+	if(vcedit_open_source(state))
+		return -1;
+	/* A stream cut short is rebuilt, and reported, like vcedit_write() does */
+	if(state->audiooffset >= 0 && !vcedit_mem_eos(state))
+		state->audiooffset = -1;
+	return 0;
+}
+
+/* Tells whether the audio pages of the input opened by vcedit_open_mem()
+ * end the edited stream, going from page header to page header. */
+static int vcedit_mem_eos(vcedit_state *state)
+{
+	const unsigned char *p = state->in;
+	long pos = state->audiooffset, body;
+	ogg_page og;
+	int i;
+
+	while(state->inlen - pos >= 27 && memcmp(p + pos, "OggS", 4) == 0)
+	{
+		og.header = (unsigned char *)p + pos;
+		og.header_len = 27 + og.header[26];
+		if(state->inlen - pos < og.header_len)
+			break;
+		for(body = 0, i = 27; i < og.header_len; i++)
+			body += og.header[i];
+		if(state->inlen - pos - og.header_len < body)
+			break;
+		if(ogg_page_serialno(&og) == state->serial && ogg_page_eos(&og))
+			return 1;
+		pos += og.header_len + body;
+	}
+	return 0;
+}
+
+/* Reads the headers of the first stream of state->src. */
+static int vcedit_open_source(vcedit_state *state)
+{
+
+	int i, result, segs;
 	ogg_packet *header;
 	ogg_packet	header_main;
 	ogg_packet  header_comments;
@@ -87,22 +284,14 @@ int vcedit_open_callbacks(vcedit_state *state, void *in,
 	ogg_page    og;
 	vorbis_info vi;
 
+	state->vcpageslen = 0;
+	state->audiooffset = -1;
+	state->headerpages = 0;
+	vorbis_info_init(&vi);
 
-	state->in = in;
-	state->read = read_func;
-	state->write = write_func;
-
-	state->oy = malloc(sizeof(ogg_sync_state));
-	ogg_sync_init(state->oy);
-
-	buffer = ogg_sync_buffer(state->oy, CHUNKSIZE);
-	bytes = state->read(buffer, 1, CHUNKSIZE, state->in);
-
-	ogg_sync_wrote(state->oy, bytes);
-
-	if(ogg_sync_pageout(state->oy, &og) != 1)
+	if((result = oggsource_page(state->src, &og)) != 1)
 	{
-		if(bytes<CHUNKSIZE)
+		if(result == 0)
 			state->lasterror = "Input truncated or empty.";
 		else
 			state->lasterror = "Input is not an Ogg bitstream.";
@@ -110,11 +299,16 @@ int vcedit_open_callbacks(vcedit_state *state, void *in,
 	}
 
 	state->serial = ogg_page_serialno(&og);
+	/* the comment header pages follow, unless the first page is odd */
+	state->vcoffset = ogg_page_packets(&og) == 1 ? state->src->offset : -1;
 
-	state->os = malloc(sizeof(ogg_stream_state));
-	ogg_stream_init(state->os, state->serial);
-
-	vorbis_info_init(&vi);
+	if(state->os == NULL)
+	{
+		state->os = malloc(sizeof(ogg_stream_state));
+		ogg_stream_init(state->os, state->serial);
+	}
+	else /* its buffers are reused */
+		ogg_stream_reset_serialno(state->os, state->serial);
 
 	state->vc = malloc(sizeof(vorbis_comment));
 	vorbis_comment_init(state->vc);
@@ -124,6 +318,7 @@ int vcedit_open_callbacks(vcedit_state *state, void *in,
 		state->lasterror = "Error reading first page of Ogg bitstream.";
 		goto err;
 	}
+	state->headerpages++;
 
 	if(ogg_stream_packetout(state->os, &header_main) != 1)
 	{
@@ -131,79 +326,93 @@ int vcedit_open_callbacks(vcedit_state *state, void *in,
 		goto err;
 	}
 
-	if(vorbis_synthesis_headerin(&vi, state->vc, &header_main) < 0)
+	if(vorbiscache_headerin(&vi, state->vc, &header_main) < 0)
 	{
 		state->lasterror = "Ogg bitstream does not contain vorbis data.";
 		goto err;
 	}
 
+	if(vcedit_keep(&state->mainbuf, &state->mainsize, header_main.packet,
+				header_main.bytes))
+	{
+		state->lasterror = "Out of memory.";
+		goto err;
+	}
 	state->mainlen = header_main.bytes;
-	state->mainbuf = malloc(state->mainlen);
-	memcpy(state->mainbuf, header_main.packet, header_main.bytes);
 
 	i = 0;
 	header = &header_comments;
 	while(i<2) {
-		while(i<2) {
-			int result = ogg_sync_pageout(state->oy, &og);
-			if(result == 0) break; /* Too little data so far */
-			else if(result == 1)
+		result = oggsource_page(state->src, &og);
+		if(result == 0)
+		{
+			state->lasterror = "EOF before end of vorbis headers.";
+			goto err;
+		}
+		else if(result == -1 && i == 0)
+			state->vcoffset = -1; /* comment pages are not contiguous */
+		else if(result == 1)
+		{
+			if(i == 0)
+				vcedit_keep_page(state, &og);
+			if(ogg_stream_pagein(state->os, &og) == 0)
+				state->headerpages++;
+			while(i<2)
 			{
-				ogg_stream_pagein(state->os, &og);
-				while(i<2)
+				result = ogg_stream_packetout(state->os, header);
+				if(result == 0) break;
+				if(result == -1)
+				{
+					state->lasterror = "Corrupt secondary header.";
+					goto err;
+				}
+				vorbiscache_headerin(&vi, state->vc, header);
+				if(i==1)
 				{
-					result = ogg_stream_packetout(state->os, header);
-					if(result == 0) break;
-					if(result == -1)
+					if(vcedit_keep(&state->bookbuf, &state->booksize,
+								header->packet, header->bytes))
 					{
-						state->lasterror = "Corrupt secondary header.";
+						state->lasterror = "Out of memory.";
 						goto err;
 					}
-					vorbis_synthesis_headerin(&vi, state->vc, header);
-					if(i==1)
-					{
-						state->booklen = header->bytes;
-						state->bookbuf = malloc(state->booklen);
-						memcpy(state->bookbuf, header->packet, 
-								header->bytes);
-					}
-					i++;
-					header = &header_codebooks;
+					state->booklen = header->bytes;
 				}
+				i++;
+				header = &header_codebooks;
 			}
 		}
-
-		buffer = ogg_sync_buffer(state->oy, CHUNKSIZE);
-		bytes = state->read(buffer, 1, CHUNKSIZE, state->in);
-		if(bytes == 0 && i < 2)
-		{
-			state->lasterror = "EOF before end of vorbis headers.";
-			goto err;
-		}
-		ogg_sync_wrote(state->oy, bytes);
 	}
 
-	/* Headers are done! */
-	vorbis_info_clear(&vi);
+	/* Headers are done! When the last of them ends its page (a last lacing
+	 * value below 255, and no audio packet after them) the audio pages can
+	 * be copied as they are, see vcedit_write_mem(), if they end the stream
+	 * too. */
+	segs = og.header[26];
+	if(segs > 0 && og.header[27 + segs - 1] != 255 &&
+			ogg_stream_packetpeek(state->os, NULL) == 0)
+		state->audiooffset = state->src->offset;
+
+	vorbiscache_info_clear(&vi);
 	return 0;
 
 err:
+	vorbiscache_info_clear(&vi);
 	vcedit_clear_internals(state);
 	return -1;
 }
 
-int vcedit_write(vcedit_state *state, void *out)
+/* Writes the header pages of the edited stream through sink, the comment
+ * header with state->padding zero bytes after the comments. streamout is
+ * left holding the stream, for the audio packets to follow. Returns the
+ * number of pages written, or -1 on error. */
+static long vcedit_header_pages(vcedit_state *state,
+		ogg_stream_state *streamout, struct oggsink *sink)
 {
-	ogg_stream_state streamout;
 	ogg_packet header_main;
 	ogg_packet header_comments;
 	ogg_packet header_codebooks;
-
-	ogg_page ogout, ogin;
-	ogg_packet op;
-	int result;
-	char *buffer;
-	int bytes, eosin=0, eosout=0;
+	ogg_page ogout;
+	long npages = 0;
 
 	header_main.bytes = state->mainlen;
 	header_main.packet = state->mainbuf;
@@ -217,118 +426,93 @@ int vcedit_write(vcedit_state *state, void *out)
 	header_codebooks.e_o_s = 0;
 	header_codebooks.granulepos = 0;
 
-	ogg_stream_init(&streamout, state->serial);
-
 	vorbis_commentheader_out(state->vc, &header_comments);
+	if(state->padding > 0)
+	{
+		unsigned char *packet = realloc(header_comments.packet,
+				header_comments.bytes + state->padding);
+		if(packet)
+		{
+			memset(packet + header_comments.bytes, 0, state->padding);
+			header_comments.packet = packet;
+			header_comments.bytes += state->padding;
+		}
+	}
 
-	ogg_stream_packetin(&streamout, &header_main);
-	ogg_stream_packetin(&streamout, &header_comments);
-	ogg_stream_packetin(&streamout, &header_codebooks);
+	ogg_stream_packetin(streamout, &header_main);
+	ogg_stream_packetin(streamout, &header_comments);
+	ogg_stream_packetin(streamout, &header_codebooks);
+	ogg_packet_clear(&header_comments);
 
-	while((result = ogg_stream_flush(&streamout, &ogout)))
+	while(ogg_stream_flush(streamout, &ogout))
 	{
-		if(state->write(ogout.header,1,ogout.header_len, out) !=
-				(size_t) ogout.header_len)
-			goto cleanup;
-		if(state->write(ogout.body,1,ogout.body_len, out) != 
-				(size_t) ogout.body_len)
-			goto cleanup;
+		if(oggsink_page(sink, &ogout))
+			return -1;
+		npages++;
 	}
+	return npages;
+}
+
+/* Writes the edited stream and the rest of the input through sink, which is
+ * closed, and clears the internals of state. */
+static int vcedit_write_sink(vcedit_state *state, struct oggsink *sink)
+{
+	ogg_stream_state streamout;
+	ogg_page ogout;
+	ogg_packet op;
+	int result;
+	int eosin=0, eosout=0;
+
+	ogg_stream_init(&streamout, state->serial);
 
+	if(vcedit_header_pages(state, &streamout, sink) < 0)
+		goto cleanup;
+
+	/* The audio packets of the stream, up to its end or the input's */
 	while(!eosout)
 	{
+		result = oggsource_packet(state->src, state->os, &op);
+		if(result==0) break;
+		else if(result==-1)
+			continue;
+
+		ogg_stream_packetin(&streamout, &op);
+
 		while(!eosout)
 		{
-			result = ogg_sync_pageout(state->oy, &ogin);
-			if(result==0) break; /* Need more data... */
-			else if(result ==-1)
-				continue;
-			else
-			{
-				ogg_stream_pagein(state->os, &ogin);
-	
-				while(1)
-				{
-					result = ogg_stream_packetout(state->os, &op);
-					if(result==0)break;
-					else if(result==-1)
-						continue;
-					else
-					{
-						ogg_stream_packetin(&streamout, &op);
-	
-						while(!eosout)
-						{
-							int result=ogg_stream_pageout(&streamout, &ogout);
-							if(result==0)break;
-	
-							if(state->write(ogout.header,1,ogout.header_len, 
-										out) != (size_t) ogout.header_len)
-								goto cleanup;
-							if(state->write(ogout.body,1,ogout.body_len, 
-										out) != (size_t) ogout.body_len)
-								goto cleanup;
-	
-							if(ogg_page_eos(&ogout)) eosout=1;
-						}
-					}
-				}
-				if(ogg_page_eos(&ogin)) eosin = 1;
-			}
-		}
-		if(!eosin)
-		{
-			buffer = ogg_sync_buffer(state->oy, CHUNKSIZE);
-			bytes = state->read(buffer,1, CHUNKSIZE, state->in);
-			ogg_sync_wrote(state->oy, bytes);
-			if(bytes == 0) 
-			{
-				eosin = 1;
-				break;
-			}
+			int result=ogg_stream_pageout(&streamout, &ogout);
+			if(result==0)break;
+
+			if(oggsink_page(sink, &ogout))
+				goto cleanup;
+
+			if(ogg_page_eos(&ogout)) eosout=1;
 		}
 	}
 
-	eosin=0; /* clear it, because not all paths to here do */
 	while(!eosin) /* We reached eos, not eof */
 	{
 		/* We copy the rest of the stream (other logical streams)
 		 * through, a page at a time. */
-		while(1)
-		{
-			result = ogg_sync_pageout(state->oy, &ogout);
-			if(result==0) break;
-			if(result<0)
-				state->lasterror = "Corrupt or missing data, continuing...";
-			else
-			{
-				/* Don't bother going through the rest, we can just 
-				 * write the page out now */
-				if(state->write(ogout.header,1,ogout.header_len, 
-						out) != (size_t) ogout.header_len)
-					goto cleanup;
-				if(state->write(ogout.body,1,ogout.body_len, out) !=
-						(size_t) ogout.body_len)
-					goto cleanup;
-			}
-		}
-		buffer = ogg_sync_buffer(state->oy, CHUNKSIZE);
-		bytes = state->read(buffer,1, CHUNKSIZE, state->in);
-		ogg_sync_wrote(state->oy, bytes);
-		if(bytes == 0) 
-		{
+		result = oggsource_page(state->src, &ogout);
+		if(result==0)
 			eosin = 1;
-			break;
+		else if(result<0)
+			state->lasterror = "Corrupt or missing data, continuing...";
+		else
+		{
+			/* Don't bother going through the rest, we can just 
+			 * write the page out now */
+			if(oggsink_page(sink, &ogout))
+				goto cleanup;
 		}
 	}
 							
 
 cleanup:
+	if(oggsink_close(sink))
+		eosout = 0; /* the last pages did not make it */
 	ogg_stream_clear(&streamout);
-	ogg_packet_clear(&header_comments);
-
-	free(state->mainbuf);
-	free(state->bookbuf);
 
 	vcedit_clear_internals(state);
 	if(!(eosin && eosout))
@@ -342,3 +526,231 @@ cleanup:
 	return 0;
 }
 
+int vcedit_write(vcedit_state *state, void *out)
+{
+	struct oggsink sink;
+
+	/* The pages are gathered, and given to state->write in batches */
+	if(oggsink_open_func(&sink, state->write, out, OGGSINK_BATCH))
+	{
+		vcedit_clear_internals(state);
+		state->lasterror = "Out of memory.";
+		return -1;
+	}
+	return vcedit_write_sink(state, &sink);
+}
+
+static size_t vcedit_mem_write(const void *ptr, size_t size, size_t nmemb,
+		void *out)
+{
+	struct vcedit_mem *mem = out;
+	long len = size * nmemb;
+
+	if(len > mem->size - mem->len)
+	{
+		mem->full = 1;
+		return 0;
+	}
+	if(mem->buf)
+		memcpy(mem->buf + mem->len, ptr, len);
+	mem->len += len;
+	return nmemb;
+}
+
+/* Writes the header pages, then copies the audio pages of the input opened
+ * by vcedit_open_mem() as they are, only renumbering those of the edited
+ * stream when the header takes another number of pages than it did. */
+static long vcedit_copy_mem(vcedit_state *state, struct vcedit_mem *mem)
+{
+	ogg_stream_state streamout;
+	struct oggsource out;
+	struct oggsink sink;
+	ogg_page og;
+	long delta, pageno, rest;
+	int result, eos = 0;
+
+	oggsink_open_func(&sink, vcedit_mem_write, mem, 0);
+	ogg_stream_init(&streamout, state->serial);
+	delta = vcedit_header_pages(state, &streamout, &sink);
+	ogg_stream_clear(&streamout);
+	if(oggsink_close(&sink) || delta < 0)
+		return -1;
+	delta -= state->headerpages;
+
+	rest = state->inlen - state->audiooffset;
+	if(rest > mem->size - mem->len)
+	{
+		mem->full = 1;
+		return -1;
+	}
+	if(mem->buf == NULL)
+		return mem->len + rest;
+	memcpy(mem->buf + mem->len, (unsigned char *)state->in +
+			state->audiooffset, rest);
+
+	/* up to its last page, another link may reuse the serial number */
+	oggsource_open_mem(&out, mem->buf + mem->len, rest);
+	while(delta != 0 && !eos && (result = oggsource_page(&out, &og)) != 0)
+	{
+		if(result < 0 || ogg_page_serialno(&og) != state->serial)
+			continue;
+		pageno = ogg_page_pageno(&og) + delta;
+		og.header[18] = pageno & 0xff;
+		og.header[19] = (pageno >> 8) & 0xff;
+		og.header[20] = (pageno >> 16) & 0xff;
+		og.header[21] = (pageno >> 24) & 0xff;
+		oggcrc_page_set(&og);
+		eos = ogg_page_eos(&og);
+	}
+	oggsource_close(&out);
+	return mem->len + rest;
+}
+
+/* Returns the size of the file vcedit_write_mem() would write for the input
+ * opened by vcedit_open_mem(), with the comments as they are now, or -1 on
+ * error. When the audio begins on a fresh page it is known right away;
+ * otherwise the stream is rebuilt once more for nothing but its size, which
+ * costs a second pass over the input (though no more I/O). */
+long vcedit_mem_size(vcedit_state *state)
+{
+	vcedit_state *dry;
+	struct vcedit_mem mem;
+	long len;
+	int i;
+
+	if(state->read != NULL || state->vc == NULL)
+	{
+		state->lasterror = "Input not opened with vcedit_open_mem().";
+		return -1;
+	}
+
+	mem.buf = NULL;
+	mem.len = 0;
+	mem.size = LONG_MAX;
+	mem.full = 0;
+	if(state->audiooffset >= 0)
+	{
+		if((len = vcedit_copy_mem(state, &mem)) < 0)
+			state->lasterror = "Error building the header pages.";
+		return len;
+	}
+
+	if((dry = vcedit_new_state()) == NULL)
+	{
+		state->lasterror = "Out of memory.";
+		return -1;
+	}
+	dry->padding = state->padding;
+	if(vcedit_open_mem(dry, state->in, state->inlen))
+	{
+		state->lasterror = dry->lasterror;
+		vcedit_clear(dry);
+		return -1;
+	}
+	vorbis_comment_clear(dry->vc);
+	vorbis_comment_init(dry->vc);
+	for(i = 0; i < state->vc->comments; i++)
+		vorbis_comment_add(dry->vc, state->vc->user_comments[i]);
+	if((len = vcedit_write_mem(dry, NULL, LONG_MAX)) < 0)
+		state->lasterror = dry->lasterror;
+	vcedit_clear(dry);
+	return len;
+}
+
+/* Writes the edited file for the input opened by vcedit_open_mem() to the
+ * size bytes at buf, which come from the caller: vcedit_mem_size() tells how
+ * many are needed. Pages are written straight into buf, without going
+ * through a batch, and when the audio begins on a fresh page and ends with
+ * the stream its pages are copied whole instead of being rebuilt. Returns
+ * the number of bytes written, or -1 on error (buf too small among others).
+ * The state can then be opened again, with its buffers reused. */
+long vcedit_write_mem(vcedit_state *state, void *buf, long size)
+{
+	struct vcedit_mem mem;
+	struct oggsink sink;
+	long len;
+
+	if(state->read != NULL || state->vc == NULL)
+	{
+		state->lasterror = "Input not opened with vcedit_open_mem().";
+		return -1;
+	}
+
+	mem.buf = buf;
+	mem.len = 0;
+	mem.size = size;
+	mem.full = 0;
+	if(state->audiooffset >= 0)
+	{
+		len = vcedit_copy_mem(state, &mem);
+		vcedit_clear_internals(state);
+		if(len < 0)
+			state->lasterror = mem.full ? "Output buffer too small." :
+				"Error writing stream to output.";
+		return len;
+	}
+
+	oggsink_open_func(&sink, vcedit_mem_write, &mem, 0);
+	if(vcedit_write_sink(state, &sink))
+	{
+		if(mem.full)
+			state->lasterror = "Output buffer too small.";
+		return -1;
+	}
+	return mem.len;
+}
+
+/* Rewrites the comment header pages of the file opened by vcedit_open() in
+ * place, when the new comments fit in the room taken by the old ones and
+ * their padding. Returns 1 (and leaves fd untouched) if they don't, in which
+ * case the whole file has to go through vcedit_write(). */
+int vcedit_write_inplace(vcedit_state *state, int fd)
+{
+	ogg_packet header_comments;
+	unsigned char *pages, *packet;
+	long len;
+	int ret = -1;
+
+	len = vcedit_walk_comment_pages(state->vcpages, state->vcpageslen, NULL);
+	if(state->vcoffset < 0 || len < 0)
+	{
+		state->lasterror = "Comment header cannot be updated in place.";
+		return 1;
+	}
+
+	vorbis_commentheader_out(state->vc, &header_comments);
+	if(header_comments.bytes > len)
+	{
+		state->lasterror = "Not enough room to update the comments in place.";
+		ogg_packet_clear(&header_comments);
+		return 1;
+	}
+
+	pages = malloc(state->vcpageslen);
+	packet = calloc(len, 1);
+	if(pages == NULL || packet == NULL)
+		state->lasterror = "Out of memory.";
+	else
+	{
+		memcpy(pages, state->vcpages, state->vcpageslen);
+		memcpy(packet, header_comments.packet, header_comments.bytes);
+		vcedit_walk_comment_pages(pages, state->vcpageslen, packet);
+
+		if(pwrite(fd, pages, state->vcpageslen, state->vcoffset) !=
+				(ssize_t) state->vcpageslen)
+			state->lasterror = "Error writing comment header pages.";
+		else
+		{
+			free(state->vcpages);
+			state->vcpages = pages;
+			state->vcpagessize = state->vcpageslen;
+			pages = NULL;
+			ret = 0;
+		}
+	}
+
+	free(pages);
+	free(packet);
+	ogg_packet_clear(&header_comments);
+	return ret;
+}
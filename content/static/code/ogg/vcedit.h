@@ -0,0 +1,77 @@
+/* This program is licensed under the GNU Library General Public License, version 2,
+ * a copy of which is included with this program (with filename LICENSE.LGPL).
+ *
+ * (c) 2000-2001 Michael Smith <msmith@labyrinth.net.au>
+ *
+ * VCEdit header.
+ *
+ * last modified: $ID:$
+ */
+
+#ifndef __VCEDIT_H
+#define __VCEDIT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <ogg/ogg.h>
+#include <vorbis/codec.h>
+
+#include "oggsource.h"
+
+typedef size_t (*vcedit_read_func)(void *, size_t, size_t, void *);
+typedef size_t (*vcedit_write_func)(const void *, size_t, size_t, void *);
+
+typedef struct {
+	struct oggsource	*src;
+	ogg_stream_state	*os;
+
+	vorbis_comment		*vc;
+
+	vcedit_read_func read;
+	vcedit_write_func write;
+
+	void		*in;
+	long		inlen;		/* bytes at in for vcedit_open_mem() */
+	long		serial;
+	unsigned char	*mainbuf;	/* kept from one file to the next */
+	unsigned char	*bookbuf;
+	int		mainlen;
+	int		booklen;
+	long		mainsize;	/* room at mainbuf */
+	long		booksize;
+	char 	    *lasterror;
+
+	long		padding;	/* zero bytes written after the comments */
+	long		vcoffset;	/* input offset of the comment pages, or -1 */
+	unsigned char	*vcpages;	/* copy of the pages holding the comments */
+	long		vcpageslen;
+	long		vcpagessize;
+
+	long		audiooffset;	/* input offset of the first audio page when
+					   it holds nothing else, or -1 */
+	long		headerpages;	/* pages of the stream before it */
+} vcedit_state;
+
+extern vcedit_state *	vcedit_new_state(void);
+extern void				vcedit_clear(vcedit_state *state);
+extern vorbis_comment *	vcedit_comments(vcedit_state *state);
+extern int				vcedit_open(vcedit_state *state, FILE *in);
+extern int				vcedit_open_callbacks(vcedit_state *state, void *in,
+		vcedit_read_func read_func, vcedit_write_func write_func);
+extern int				vcedit_open_mem(vcedit_state *state, const void *buf,
+		long len);
+extern int				vcedit_write(vcedit_state *state, void *out);
+extern long				vcedit_mem_size(vcedit_state *state);
+extern long				vcedit_write_mem(vcedit_state *state, void *buf,
+		long size);
+extern int				vcedit_write_inplace(vcedit_state *state, int fd);
+extern char *			vcedit_error(vcedit_state *state);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __VCEDIT_H */
@@ -3,47 +3,512 @@
  *
  * A simple example on how to modify Vorbis Comments with libogg and libvorbis.
  * Compile with:
- *   cc -I/include/path vorbis_comment.c -L/lib/path -logg -lvorbis -lvorbisfile
+ *   cc -I/include/path vorbis_comment.c skeleton.c oggindex.c oggcrc.c \
+ *       oggsink.c oggsource.c vorbiscache.c -L/lib/path -logg -lvorbis \
+ *       -lpthread
  */
+#include <sys/stat.h>
+
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "ogg/ogg.h"
 #include "vorbis/codec.h"
-#define	OV_EXCLUDE_STATIC_CALLBACKS 1
-#include "vorbis/vorbisfile.h"
-#undef	OV_EXCLUDE_STATIC_CALLBACKS
+
+#include "oggcrc.h"
+#include "oggindex.h"
+#include "oggsink.h"
+#include "oggsource.h"
+#include "skeleton.h"
+#include "vorbiscache.h"
+
+/*
+ * bytes of padding reserved after the comments when writing a file, so that
+ * they can later be updated in place by update_in_place().
+ */
+#define	DEFAULT_PADDING	512
+
+/*
+ * how far read_headers() looks for the first Ogg page before deciding that
+ * the file is not an Ogg one.
+ */
+#define	MAX_SYNC_BYTES	65536
+
+
+/*
+ * the beginning of an input file, as read by read_headers(): every byte up
+ * to the end of the first stream header packets. update_in_place() and
+ * save_it() start from these bytes instead of reading the file again.
+ */
+struct input_headers {
+	FILE		*fp;	/* positioned right after buf */
+	unsigned char	*buf;
+	size_t		 len;
+	vorbis_comment	 vc;	/* the comments of the first stream */
+};
+
+
+/**
+ * write the page p into the given sink.
+ *
+ * return 0 on success and -1 on error.
+ */
+int
+write_page(ogg_page *p, struct oggsink *sink)
+{
+
+	return (oggsink_page(sink, p));
+}
+
+
+/**
+ * write the header pages held by os into sink, or the Ogg Skeleton ones
+ * and them straight into fp, the file sink writes to, when sk is not NULL.
+ *
+ * return the number of pages of os written on success and -1 on error.
+ */
+int
+write_headers(ogg_stream_state *os, struct skeleton *sk, vorbis_info *vi,
+    struct oggsink *sink, FILE *fp)
+{
+	ogg_page og;
+	int npages = 0;
+
+	if (sk != NULL) {
+		/* fp takes over where the sink is, and hands back */
+		if (oggsink_flush(sink) == -1 || fseeko(fp, 0, SEEK_END) == -1)
+			return (-1);
+		if ((npages = skeleton_write_headers(sk, vi, os, fp)) == -1 ||
+		    fflush(fp) == EOF)
+			return (-1);
+		sink->offset = sk->contentoff;
+		return (npages);
+	}
+	while (ogg_stream_flush(os, &og)) {
+		if (write_page(&og, sink) == -1)
+			return (-1);
+		npages++;
+	}
+	return (npages);
+}
+
+
+/**
+ * add the page p, about to be written through sink, to the index w.
+ * Nothing is done when w is NULL.
+ *
+ * return 0 on success and -1 on error.
+ */
+int
+index_page(struct oggindex_writer *w, vorbis_info *vi, ogg_page *p,
+    const struct oggsink *sink)
+{
+
+	if (w == NULL)
+		return (0);
+	return (oggindex_add_page(w, vi, p, sink->offset));
+}
+
+
+/**
+ * check whether p is the first page of an Ogg Skeleton track.
+ *
+ * return 1 if it is, 0 otherwise.
+ */
+int
+is_fishead(ogg_page *p)
+{
+
+	return (ogg_page_bos(p) && p->body_len >= 8 &&
+	    memcmp(p->body, "fishead", 8) == 0);
+}
+
+
+/**
+ * release what read_headers() allocated in h.
+ */
+void
+clear_headers(struct input_headers *h)
+{
+
+	if (h->fp != NULL)
+		(void)fclose(h->fp);
+	free(h->buf);
+	vorbis_comment_clear(&h->vc);
+	h->fp = NULL;
+	h->buf = NULL;
+	h->len = 0;
+}
+
+
+/**
+ * open the ogg/vorbis file at path and read it until the end of the header
+ * packets of its first stream, skipping any Skeleton track. The file is only
+ * read forward, and no further than needed: unlike ov_fopen() it is neither
+ * scanned for its links nor its length. h->vc is filled with its comments.
+ *
+ * return 0 on success and -1 on error, in which case h holds nothing.
+ */
+int
+read_headers(const char *path, struct input_headers *h)
+{
+	ogg_sync_state    oy;
+	ogg_stream_state  os;
+	ogg_page          og;
+	ogg_packet        op;
+	vorbis_info       vi;
+	unsigned char    *p;
+	char             *buf;
+	size_t            s;
+	long              n;
+	int               npackets, has_stream, has_page, ret;
+	int               skeleton_serialno, has_skeleton;
+
+	ret = -1;
+	npackets = has_stream = has_page = 0;
+	skeleton_serialno = has_skeleton = 0;
+	(void)memset(h, 0, sizeof(struct input_headers));
+	vorbis_comment_init(&h->vc);
+	vorbis_info_init(&vi);
+	(void)ogg_sync_init(&oy); /* always return 0 */
+	if ((h->fp = fopen(path, "r")) == NULL)
+		goto cleanup_label;
+
+	while (npackets < 3) {
+		if ((n = ogg_sync_pageout(&oy, &og)) != 1) {
+			if (!has_page && h->len >= MAX_SYNC_BYTES)
+				goto cleanup_label; /* not an Ogg file */
+			if ((p = realloc(h->buf, h->len + BUFSIZ)) == NULL)
+				goto cleanup_label;
+			h->buf = p;
+			if ((s = fread(h->buf + h->len, 1, BUFSIZ, h->fp)) == 0)
+				goto cleanup_label; /* truncated or I/O error */
+			if ((buf = ogg_sync_buffer(&oy, s)) == NULL)
+				goto cleanup_label;
+			(void)memcpy(buf, h->buf + h->len, s);
+			if (ogg_sync_wrote(&oy, s) == -1)
+				goto cleanup_label;
+			h->len += s;
+			continue;
+		}
+		has_page = 1;
+		if (!has_stream && !has_skeleton && is_fishead(&og)) {
+			skeleton_serialno = ogg_page_serialno(&og);
+			has_skeleton = 1;
+			continue;
+		}
+		if (has_skeleton && ogg_page_serialno(&og) == skeleton_serialno)
+			continue;
+		if (!has_stream) {
+			if (!ogg_page_bos(&og))
+				goto cleanup_label;
+			if (ogg_stream_init(&os, ogg_page_serialno(&og)) == -1)
+				goto cleanup_label;
+			has_stream = 1;
+		}
+		if (ogg_page_serialno(&og) != os.serialno)
+			continue; /* another multiplexed stream */
+		if (ogg_stream_pagein(&os, &og) == -1)
+			goto cleanup_label;
+		while (npackets < 3 && (n = ogg_stream_packetout(&os, &op)) != 0) {
+			/* a hole in the headers */
+			if (n == -1)
+				goto cleanup_label;
+			if (vorbiscache_headerin(&vi, &h->vc, &op) != 0)
+				goto cleanup_label;
+			npackets++;
+		}
+	}
+	ret = 0;
+	/* FALLTHROUGH */
+cleanup_label:
+	if (has_stream)
+		ogg_stream_clear(&os);
+	ogg_sync_clear(&oy);
+	vorbiscache_info_clear(&vi);
+	if (ret != 0)
+		clear_headers(h);
+	return (ret);
+}
+
+
+/**
+ * write the page p into the given sink, moving it delta pages forward (or
+ * backward) if it belongs to the logical stream serialno.
+ *
+ * Only the header is copied in order to patch the page sequence number and
+ * the CRC, the body is written as-is.
+ *
+ * return 0 on success and -1 on error.
+ */
+int
+copy_page(ogg_page *p, int serialno, long delta, struct oggsink *sink)
+{
+	unsigned char header[27 + 255]; /* the biggest possible page header */
+	ogg_page copy;
+	long pageno;
+
+	if (delta == 0 || ogg_page_serialno(p) != serialno)
+		return (write_page(p, sink));
+
+	(void)memcpy(header, p->header, p->header_len);
+	pageno = ogg_page_pageno(p) + delta;
+	header[18] = pageno & 0xff;
+	header[19] = (pageno >> 8) & 0xff;
+	header[20] = (pageno >> 16) & 0xff;
+	header[21] = (pageno >> 24) & 0xff;
+	copy = *p;
+	copy.header = header;
+	oggcrc_page_set(&copy);
+	return (write_page(&copy, sink));
+}
+
+
+/**
+ * check that the page p, from which the last header packet was just pulled
+ * out of os, does not hold the start of any audio packet.
+ *
+ * return 1 if the audio data begins on a fresh page, 0 otherwise.
+ */
+int
+headers_end_page(ogg_page *p, ogg_stream_state *os)
+{
+	int nsegs = p->header[26];
+
+	/* a last lacing value of 255 means a packet continues on the next page */
+	if (nsegs == 0 || p->header[27 + nsegs - 1] == 255)
+		return (0);
+	return (ogg_stream_packetpeek(os, NULL) == 0);
+}
 
 
 /**
- * write the page p into the given file pointer fp.
+ * append padding zero bytes to the packet op. Decoders stop reading the
+ * comment header at its framing bit, so they are ignored.
  *
  * return 0 on success and -1 on error.
  */
 int
-write_page(ogg_page *p, FILE *fp)
+pad_packet(ogg_packet *op, size_t padding)
 {
+	unsigned char *p;
 
-	if (fwrite(p->header, 1, p->header_len, fp) != p->header_len)
-		return -1;
-	if (fwrite(p->body, 1, p->body_len, fp) != p->body_len)
-		return -1;
-	return 0;
+	if (padding == 0)
+		return (0);
+	if ((p = realloc(op->packet, op->bytes + padding)) == NULL)
+		return (-1);
+	(void)memset(p + op->bytes, 0, padding);
+	op->packet = p;
+	op->bytes += padding;
+	return (0);
 }
 
 
+/**
+ * walk the comment header packet laid out into the len bytes of the given
+ * pages (starting at the beginning of the first page body). If packet is not
+ * NULL it is copied over the comment header packet (it has to be exactly as
+ * long) and the pages CRC are updated.
+ *
+ * return the comment header packet size or -1 if the pages end before it
+ * does.
+ */
+long
+walk_comment_pages(unsigned char *pages, size_t len, const unsigned char *packet)
+{
+	ogg_page og;
+	size_t pos;
+	long done, bodypos;
+	int s, nsegs, seg, end;
+
+	pos = done = end = 0;
+	while (!end && pos + 27 <= len) {
+		nsegs = pages[pos + 26];
+		og.header = pages + pos;
+		og.header_len = 27 + nsegs;
+		og.body = og.header + og.header_len;
+		og.body_len = 0;
+		for (s = 0; s < nsegs; s++)
+			og.body_len += og.header[27 + s];
+
+		bodypos = 0;
+		for (s = 0; s < nsegs && !end; s++) {
+			seg = og.header[27 + s];
+			if (packet != NULL)
+				(void)memcpy(og.body + bodypos, packet + done, seg);
+			bodypos += seg;
+			done += seg;
+			end = (seg < 255);
+		}
+		if (packet != NULL)
+			oggcrc_page_set(&og);
+		pos += og.header_len + og.body_len;
+	}
+	return (end ? done : -1);
+}
+
+
+/*
+ * rewrite the Vorbis Comments of the file at path in place, using vc. This
+ * is possible when the new comment header packet fits into the old one
+ * (including its padding): its pages keep the same layout, only their bodies
+ * and CRC are written back. The pages are looked for in the bytes in
+ * read from path, which hold them all.
+ *
+ * return 0 on success, 1 if vc doesn't fit (path is left untouched) and -1
+ * on error.
+ */
+int
+update_in_place(const char *path, const struct input_headers *in,
+    struct vorbis_comment *vc)
+{
+	int               fd;
+	ogg_sync_state    oy;
+	ogg_page          og;
+	ogg_packet        vc_packet;
+	unsigned char    *pages, *packet, *p;
+	char             *buf;
+	size_t            pageslen;
+	off_t             offset, vcoffset; /* file offsets */
+	long              n, len;
+	int               serialno, ret;
+	int               skeleton_serialno, has_skeleton;
+
+	ret = -1;
+	serialno = 0;
+	skeleton_serialno = has_skeleton = 0;
+	pages = packet = NULL;
+	pageslen = 0;
+	offset = vcoffset = 0;
+	(void)ogg_sync_init(&oy); /* always return 0 */
+	if (vorbis_commentheader_out(vc, &vc_packet) != 0)
+		return (-1);
+	if ((fd = open(path, O_RDWR)) == -1)
+		goto cleanup_label;
+	if ((buf = ogg_sync_buffer(&oy, in->len)) == NULL)
+		goto cleanup_label;
+	(void)memcpy(buf, in->buf, in->len);
+	if (ogg_sync_wrote(&oy, in->len) == -1)
+		goto cleanup_label;
+
+	/*
+	 * collect the pages holding the comment header packet, which are
+	 * right after the first page (and the Skeleton ones, if any).
+	 */
+	len = -1;
+	while (len == -1) {
+		if ((n = ogg_sync_pageseek(&oy, &og)) == 0) {
+			goto cleanup_label; /* not a file read_headers() took */
+		} else if (n < 0) {
+			/* bytes were skipped, the header pages are not contiguous */
+			ret = 1;
+			goto cleanup_label;
+		}
+		offset += n;
+
+		if (pageslen == 0 && vcoffset == 0 && !has_skeleton &&
+		    is_fishead(&og)) {
+			skeleton_serialno = ogg_page_serialno(&og);
+			has_skeleton = 1;
+			continue;
+		}
+		if (pageslen == 0 && has_skeleton &&
+		    ogg_page_serialno(&og) == skeleton_serialno) {
+			if (vcoffset != 0)
+				vcoffset = offset;
+			continue;
+		}
+
+		if (vcoffset == 0) {
+			/* the identification header alone on the first page */
+			if (!ogg_page_bos(&og) || ogg_page_packets(&og) != 1 ||
+			    og.body_len < 7 || memcmp(og.body, "\001vorbis", 7) != 0)
+				goto cleanup_label;
+			serialno = ogg_page_serialno(&og);
+			vcoffset = offset;
+			continue;
+		} else if (pageslen == 0) {
+			if (ogg_page_continued(&og) || og.body_len < 7 ||
+			    memcmp(og.body, "\003vorbis", 7) != 0)
+				goto cleanup_label;
+		}
+		if (ogg_page_serialno(&og) != serialno) {
+			/* another logical stream is interleaved */
+			ret = 1;
+			goto cleanup_label;
+		}
+		if ((p = realloc(pages, pageslen + n)) == NULL)
+			goto cleanup_label;
+		pages = p;
+		(void)memcpy(pages + pageslen, og.header, og.header_len);
+		(void)memcpy(pages + pageslen + og.header_len, og.body, og.body_len);
+		pageslen += n;
+		len = walk_comment_pages(pages, pageslen, NULL);
+	}
+
+	if (vc_packet.bytes > len) {
+		ret = 1;
+		goto cleanup_label;
+	}
+	/* our new comment header, padded to the old one size */
+	if ((packet = calloc(len, 1)) == NULL)
+		goto cleanup_label;
+	(void)memcpy(packet, vc_packet.packet, vc_packet.bytes);
+	(void)walk_comment_pages(pages, pageslen, packet);
+
+	if (pwrite(fd, pages, pageslen, vcoffset) != (ssize_t)pageslen)
+		goto cleanup_label;
+	ret = 0;
+	/* FALLTHROUGH */
+cleanup_label:
+	if (fd != -1 && close(fd) != 0)
+		ret = -1;
+	ogg_sync_clear(&oy);
+	ogg_packet_clear(&vc_packet);
+	free(packet);
+	free(pages);
+	return (ret);
+}
+
+
+/*
+ * save_it() options.
+ */
+struct save_opts {
+	/*
+	 * Only rebuild the header pages and copy all the following pages
+	 * byte for byte (patching their page sequence number when the header
+	 * page count changes). Audio packets are not looked at, so their
+	 * granulepos are kept as-is.
+	 */
+	int	passthrough;
+	/* bytes of padding reserved after the comments */
+	size_t	padding;
+	/*
+	 * Add an Ogg Skeleton track indexing the first stream, so that it can
+	 * be seeked with a single request. The output has to be seekable.
+	 */
+	int	skeleton;
+};
+
+
 /*
- * copy a ogg/vorbis file from path_in to path_out, using the given Vorbis Comments
- * vc_out for the new file.
+ * copy the ogg/vorbis file in, as opened by read_headers(), to path_out, using
+ * the given Vorbis Comments vc_out for the new file.
  *
  * return 0 on success and -1 on error.
  */
 int
-save_it(const char *path_in, struct vorbis_comment *vc_out, const char *path_out)
+save_it(const struct input_headers *in, struct vorbis_comment *vc_out,
+    const char *path_out, const struct save_opts *opts)
 {
-	FILE             *fp_in  = NULL;  /* input file pointer */
+	FILE             *fp_in  = in->fp;  /* input file pointer */
 	FILE             *fp_out = NULL; /* output file pointer */
-	ogg_sync_state    oy_in;  /* sync and verify incoming physical bitstream */
+	struct oggsink    sink;   /* the pages go out through it, in batches */
+	struct oggsource  src_in; /* sync and verify incoming physical bitstream */
 	ogg_stream_state  os_in;  /* take physical pages, weld into a logical
 	                             stream of packets */
 	ogg_stream_state  os_out; /* take physical pages, weld into a logical
@@ -62,11 +527,21 @@ save_it(const char *path_in, struct vorbis_comment *vc_out, const char *path_out
 	unsigned long     bs;     /* blocksize of the current packet */
 	unsigned long     lastbs; /* blocksize of the last packet */
 	ogg_int64_t       granulepos; /* granulepos of the current page */
+	long              pageno_delta; /* output minus input page sequence number */
+	int               npages; /* header pages written */
+	struct skeleton   sk;     /* the Skeleton track we write */
+	struct skeleton  *skp;    /* &sk while writing the first stream headers */
+	struct oggindex_writer index;  /* its keypoints */
+	struct oggindex_writer *indexp; /* &index while copying the first stream */
+	int               skeleton_serialno; /* of a Skeleton track in the input */
+	int               has_skeleton;
+	int               input_end; /* the input ran out */
+	struct stat       st;
 	enum {
 		BUILDING_VC_PACKET, SETUP, B_O_S, START_READING,
 		STREAMS_INITIALIZED, READING_HEADERS, READING_DATA,
-		READING_DATA_NEED_FLUSH, READING_DATA_NEED_PAGEOUT, E_O_S,
-		WRITE_FINISH, DONE_SUCCESS,
+		READING_DATA_NEED_FLUSH, READING_DATA_NEED_PAGEOUT,
+		COPYING_PAGES, E_O_S, WRITE_FINISH, DONE_SUCCESS,
 	} state;
 
 	/*
@@ -75,59 +550,89 @@ save_it(const char *path_in, struct vorbis_comment *vc_out, const char *path_out
 	 * algorithm is to replace the SECOND ogg packet (which contains vorbis
 	 * comments) and copy ALL THE OTHERS. See "Metadata workflow":
 	 * https://xiph.org/vorbis/doc/libvorbis/overview.html
+	 *
+	 * When opts->passthrough is set, we only go through the packets until
+	 * the end of the headers. The Vorbis I specification requires the
+	 * audio data to begin on a fresh page, so every page after the headers
+	 * can be written unchanged. Files breaking this rule are remuxed.
+	 *
+	 * A Skeleton track in the input is dropped, opts->skeleton writes a
+	 * new one matching the output.
 	 */
 
+	oggindex_writer_init(&index, 0, 0, OGGINDEX_INTERVAL);
+	indexp = NULL;
+	sink.buf = NULL;
+	(void)oggsource_open_mem(&src_in, NULL, 0);
 	state = BUILDING_VC_PACKET;
 	/* create the packet holding our vorbis_comment */
 	if (vorbis_commentheader_out(vc_out, &my_vc_packet) != 0)
 		goto cleanup_label;
+	if (pad_packet(&my_vc_packet, opts->padding) == -1)
+		goto cleanup_label;
 
 	state = SETUP;
-	/* open files & stuff */
-	(void)ogg_sync_init(&oy_in); /* always return 0 */
-	if ((fp_in = fopen(path_in, "r")) == NULL)
-		goto cleanup_label;
+	/*
+	 * open files & stuff. A file is mapped and read again from its start,
+	 * anything else goes on from the bytes read_headers() went through.
+	 */
+	if (oggsource_open_map(&src_in, fileno(fp_in)) == -1) {
+		(void)oggsource_open_func(&src_in, (oggsource_read_func)fread,
+		    fp_in);
+		if (oggsource_feed(&src_in, in->buf, in->len) == -1)
+			goto cleanup_label;
+	}
 	if ((fp_out = (path_out == NULL ? stdout : fopen(path_out, "w"))) == NULL)
 		goto cleanup_label;
+	if (oggsink_open_fd(&sink, fileno(fp_out), OGGSINK_BATCH) == -1)
+		goto cleanup_label;
 	lastbs = granulepos = 0;
+	pageno_delta = 0;
+	if (fstat(fileno(fp_in), &st) != 0)
+		goto cleanup_label;
+	skeleton_init(&sk, st.st_size, OGGINDEX_INTERVAL);
 
 	nstream_in = 0;
+	input_end = 0;
 bos_label: /* beginning of a stream */
 	state = B_O_S; /* never read, but that's fine */
 	nstream_in += 1;
 	npage_in = npacket_in = 0;
+	skp = (opts->skeleton && nstream_in == 1 ? &sk : NULL);
+	has_skeleton = 0;
 	vorbis_info_init(&vi_in);
 	vorbis_comment_init(&vc_in);
 
 	state = START_READING;
-	/* main loop: read the input file into buf in order to sync pages out */
+	/* main loop: pull the pages out of the input file */
 	while (state != E_O_S) {
-		switch (ogg_sync_pageout(&oy_in, &og_in)) {
-		case 0:  /* more data needed or an internal error occurred. */
+		switch (oggsource_page(&src_in, &og_in)) {
 		case -1: /* stream has not yet captured sync (bytes were skipped). */
-			if (feof(fp_in)) {
-				if (state < READING_DATA)
-					goto cleanup_label;
-				/* There is no more data to read and we could
-				   not get a page so we're done here. */
-				state = E_O_S;
-			} else {
-				/* read more data and try again to get a page. */
-				char *buf;
-				size_t s;
-				/* get a buffer */
-				if ((buf = ogg_sync_buffer(&oy_in, BUFSIZ)) == NULL)
-					goto cleanup_label;
-				/* read a part of the file */
-				if ((s = fread(buf, sizeof(char), BUFSIZ, fp_in)) == -1)
-					goto cleanup_label;
-				/* tell ogg how much was read */
-				if (ogg_sync_wrote(&oy_in, s) == -1)
-					goto cleanup_label;
-			}
+			continue;
+		case 0:  /* end of the input, or a read error. */
+			if (src_in.error || state < READING_DATA)
+				goto cleanup_label;
+			/* There is no more data to read and we could not get a
+			   page so we're done here. */
+			input_end = 1;
+			state = E_O_S;
+			continue;
+		}
+		/* here oggsource_page() returned 1 and a page was sync'ed. */
+		if (npage_in == 0 && is_fishead(&og_in)) {
+			skeleton_serialno = ogg_page_serialno(&og_in);
+			has_skeleton = 1;
+			continue;
+		}
+		if (has_skeleton && ogg_page_serialno(&og_in) == skeleton_serialno)
+			continue;
+		if (state == COPYING_PAGES) {
+			if (index_page(indexp, &vi_in, &og_in, &sink) == -1)
+				goto cleanup_label;
+			if (copy_page(&og_in, os_out.serialno, pageno_delta, &sink) == -1)
+				goto cleanup_label;
 			continue;
 		}
-		/* here ogg_sync_pageout() returned 1 and a page was sync'ed. */
 		if (++npage_in == 1) {
 			/* init both input and output streams with the serialno
 			   of the first page */
@@ -162,7 +667,7 @@ bos_label: /* beginning of a stream */
 				 * We use them to get the vorbis_info which
 				 * will be used later. vc_in will not be unused.
 				 */
-				if (vorbis_synthesis_headerin(&vi_in, &vc_in, &op_in) != 0)
+				if (vorbiscache_headerin(&vi_in, &vc_in, &op_in) != 0)
 					goto cleanup_label;
 				/* force a flush after the third ogg_packet */
 				state = (npacket_in == 3 ? READING_DATA_NEED_FLUSH : READING_HEADERS);
@@ -192,14 +697,27 @@ bos_label: /* beginning of a stream */
 				lastbs = bs;
 
 				/* write page(s) if needed */
-				if (state == READING_DATA_NEED_FLUSH) {
+				if (npacket_in == 4) {
+					/* only the headers are in os_out */
+					if (write_headers(&os_out, skp, &vi_in, &sink, fp_out) == -1)
+						goto cleanup_label;
+					if (skp != NULL) {
+						oggindex_writer_init(&index, os_out.serialno,
+						    vi_in.rate, OGGINDEX_INTERVAL);
+						indexp = &index;
+					}
+				} else if (state == READING_DATA_NEED_FLUSH) {
 					while (ogg_stream_flush(&os_out, &og_out)) {
-						if (write_page(&og_out, fp_out) == -1)
+						if (index_page(indexp, &vi_in, &og_out, &sink) == -1)
+							goto cleanup_label;
+						if (write_page(&og_out, &sink) == -1)
 							goto cleanup_label;
 					}
 				} else if (state == READING_DATA_NEED_PAGEOUT) {
 					while (ogg_stream_pageout(&os_out, &og_out)) {
-						if (write_page(&og_out, fp_out) == -1)
+						if (index_page(indexp, &vi_in, &og_out, &sink) == -1)
+							goto cleanup_label;
+						if (write_page(&og_out, &sink) == -1)
 							goto cleanup_label;
 					}
 				}
@@ -231,6 +749,22 @@ bos_label: /* beginning of a stream */
 			/* insert the target packet into the output stream */
 			if (ogg_stream_packetin(&os_out, target) == -1)
 				goto cleanup_label;
+
+			if (npacket_in == 3 && nstream_in == 1 &&
+			    opts->passthrough && headers_end_page(&og_in, &os_in)) {
+				/* write the new header pages, and copy the rest */
+				npages = write_headers(&os_out, skp, &vi_in, &sink, fp_out);
+				if (npages == -1)
+					goto cleanup_label;
+				pageno_delta = npages - npage_in;
+				if (skp != NULL) {
+					oggindex_writer_init(&index, os_out.serialno,
+					    vi_in.rate, OGGINDEX_INTERVAL);
+					indexp = &index;
+				}
+				state = COPYING_PAGES;
+				break;
+			}
 		}
 		if (ogg_page_eos(&og_in)) {
 			/* og_in was the last page of the stream */
@@ -241,24 +775,39 @@ bos_label: /* beginning of a stream */
 	/* forces remaining packets into a last page */
 	os_out.e_o_s = 1;
 	while (ogg_stream_flush(&os_out, &og_out)) {
-		if (write_page(&og_out, fp_out) == -1)
+		if (index_page(indexp, &vi_in, &og_out, &sink) == -1)
+			goto cleanup_label;
+		if (write_page(&og_out, &sink) == -1)
+			goto cleanup_label;
+	}
+	/* now that the stream layout is known, fill in the Skeleton index */
+	if (indexp != NULL) {
+		if (oggsink_flush(&sink) == -1 ||
+		    fseeko(fp_out, 0, SEEK_END) == -1 ||
+		    skeleton_finish(&sk, indexp, fp_out) == -1 ||
+		    fflush(fp_out) == EOF)
 			goto cleanup_label;
+		indexp = NULL;
+	}
 	/* ogg_page and ogg_packet structs always point to storage in libvorbis.
 	   They're never freed or manipulated directly */
 
-	/* check if we need to read another stream */
-	if (!feof(fp_in)) {
+	/*
+	 * check if we need to read another stream. The bytes a mapped input
+	 * ends with may not make a page, as when the file was cut.
+	 */
+	if (!input_end &&
+	    (src_in.map != NULL ? src_in.pos < src_in.size : !feof(fp_in))) {
 		ogg_stream_clear(&os_in);
 		ogg_stream_clear(&os_out);
 		vorbis_comment_clear(&vc_in);
-		vorbis_info_clear(&vi_in);
+		vorbiscache_info_clear(&vi_in);
 		goto bos_label;
-	} else {
-		(void)fclose(fp_in);
-		fp_in = NULL;
 	}
 
 	state = WRITE_FINISH;
+	if (oggsink_close(&sink) == -1)
+		goto cleanup_label;
 	if (fp_out != stdout && fclose(fp_out) != 0)
 		goto cleanup_label;
 	fp_out = NULL;
@@ -271,14 +820,14 @@ cleanup_label:
 	}
 	if (state >= START_READING) {
 		vorbis_comment_clear(&vc_in);
-		vorbis_info_clear(&vi_in);
+		vorbiscache_info_clear(&vi_in);
 	}
-	ogg_sync_clear(&oy_in);
+	oggsource_close(&src_in);
 	if (fp_out != stdout && fp_out != NULL)
 		(void)fclose(fp_out);
-	if (fp_in != NULL)
-		(void)fclose(fp_in);
 	ogg_packet_clear(&my_vc_packet);
+	oggindex_writer_clear(&index);
+	free(sink.buf);
 
 	return (state == DONE_SUCCESS ? 0 : -1);
 }
@@ -288,31 +837,56 @@ int
 main(int argc, char **argv)
 {
 	const char *path_in, *path_out;
-	struct OggVorbis_File vf;
+	struct input_headers in;
 	struct vorbis_comment *vc;
-	int i;
+	struct save_opts opts;
+	char *path_tmp;
+	int i, inplace;
 
-	if (argc == 2) {
-		path_in  = argv[1];
+	(void)memset(&opts, 0, sizeof(opts));
+	opts.padding = DEFAULT_PADDING;
+	inplace = 0;
+	while ((i = getopt(argc, argv, "iP:ps")) != -1) {
+		switch (i) {
+		case 'i':
+			inplace = 1;
+			break;
+		case 'P':
+			opts.padding = strtoul(optarg, NULL, 10);
+			break;
+		case 'p':
+			opts.passthrough = 1;
+			break;
+		case 's':
+			opts.skeleton = 1;
+			break;
+		default:
+			goto usage_label;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (argc == 1 && (inplace || !opts.skeleton)) {
+		path_in  = argv[0];
 		path_out = NULL;
-	} else if (argc == 3) {
-		path_in  = argv[1];
-		path_out = argv[2];
+	} else if (argc == 2 && !inplace) {
+		path_in  = argv[0];
+		path_out = argv[1];
 	} else {
-		(void)fprintf(stderr, "usage: %s file [output]\n", argv[0]);
+usage_label:
+		(void)fprintf(stderr, "usage: vorbis_comment [-p] [-P padding] file [output]\n");
+		(void)fprintf(stderr, "       vorbis_comment -s [-p] [-P padding] file output\n");
+		(void)fprintf(stderr, "       vorbis_comment -i [-ps] [-P padding] file\n");
 		return (EXIT_FAILURE);
 	}
 
-	/* try to read path_in as an ogg/vorbis file */
-	if ((i = ov_fopen(path_in, &vf) != 0)) {
+	/* try to read path_in as an ogg/vorbis file, and get its comments */
+	if (read_headers(path_in, &in) != 0) {
 		(void)fprintf(stderr, "%s: can't open as ogg/vorbis file.\n", path_in);
 		return (EXIT_FAILURE);
 	}
-	/* get the vorbis comments */
-	if ((vc = ov_comment(&vf, -1)) == NULL) {
-		(void)fprintf(stderr, "ov_comment\n");
-		return (EXIT_FAILURE);
-	}
+	vc = &in.vc;
 
 	/* change something */
 	vorbis_comment_add(vc, "test=42");
@@ -321,13 +895,37 @@ main(int argc, char **argv)
 	for (i = 0; i < vc->comments; i++)
 		(void)fprintf(stderr, "%s\n", vc->user_comments[i]);
 
+	if (inplace) {
+		/* first try to only rewrite the comment header pages */
+		switch (opts.skeleton ? 1 : update_in_place(path_in, &in, vc)) {
+		case 0:
+			clear_headers(&in);
+			return (EXIT_SUCCESS);
+		case 1:
+			break; /* doesn't fit, rewrite the whole file */
+		default:
+			(void)fprintf(stderr, "update_in_place failed.\n");
+			return (EXIT_FAILURE);
+		}
+		if ((path_tmp = malloc(strlen(path_in) + sizeof(".tmp"))) == NULL) {
+			(void)fprintf(stderr, "malloc\n");
+			return (EXIT_FAILURE);
+		}
+		(void)sprintf(path_tmp, "%s.tmp", path_in);
+		path_out = path_tmp;
+	}
+
 	/* now save the modified comments (and copy audio data) into path_out */
-	if (save_it(path_in, vc, path_out) == -1) {
+	if (save_it(&in, vc, path_out, &opts) == -1) {
 		(void)fprintf(stderr, "save_it failed.\n");
 		return (EXIT_FAILURE);
 	}
+	if (inplace && rename(path_out, path_in) != 0) {
+		(void)fprintf(stderr, "%s: can't rename to %s.\n", path_out, path_in);
+		return (EXIT_FAILURE);
+	}
 
 	/* cleanup */
-	ov_clear(&vf);
+	clear_headers(&in);
 	return (EXIT_SUCCESS);
 }
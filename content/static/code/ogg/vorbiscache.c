@@ -0,0 +1,199 @@
+/*
+ * vorbiscache.c
+ *
+ * Process wide cache of parsed Vorbis setup headers, see vorbiscache.h.
+ */
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+#include "oggcrc.h"
+#include "vorbiscache.h"
+
+#ifdef _WIN32
+static SRWLOCK cache_lock = SRWLOCK_INIT;
+#define	LOCK()		AcquireSRWLockExclusive(&cache_lock)
+#define	UNLOCK()	ReleaseSRWLockExclusive(&cache_lock)
+#else
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+#define	LOCK()		(void)pthread_mutex_lock(&cache_lock)
+#define	UNLOCK()	(void)pthread_mutex_unlock(&cache_lock)
+#endif
+
+/* a parsed setup header, and what it was parsed from. */
+struct setup {
+	vorbis_info	info;		/* owns the codec setup */
+	unsigned char	*packet;	/* NULL when the slot is free */
+	long	bytes;
+	ogg_uint32_t	crc;
+	int	channels;
+	long	blocksize[2];
+	int	refs;			/* vorbis_info pointing at it */
+	int	warm;			/* decode tables built */
+	unsigned long	used;
+};
+
+static struct setup cache[VORBISCACHE_SIZE];
+static unsigned long cache_clock;
+
+
+/**
+ * find the entry sharing its codec setup with vi. Called locked.
+ *
+ * return the entry or NULL.
+ */
+static struct setup *
+find_info(const vorbis_info *vi)
+{
+	int i;
+
+	if (vi->codec_setup == NULL)
+		return (NULL);
+	for (i = 0; i < VORBISCACHE_SIZE; i++)
+		if (cache[i].packet != NULL &&
+		    cache[i].info.codec_setup == vi->codec_setup)
+			return (&cache[i]);
+	return (NULL);
+}
+
+
+/**
+ * like vorbis_synthesis_headerin(), but take the codec setup from the cache
+ * when op is a setup header parsed before, and put it in otherwise.
+ *
+ * return 0 on success and a libvorbis error code on error.
+ */
+int
+vorbiscache_headerin(vorbis_info *vi, vorbis_comment *vc, ogg_packet *op)
+{
+	struct setup *e, *slot;
+	vorbis_info own;
+	unsigned char *copy;
+	ogg_uint32_t crc;
+	long bs0, bs1;
+	int i, ret;
+
+	/* only a setup header that would be accepted goes through the cache */
+	if (op->bytes < 7 || op->packet[0] != 5 ||
+	    memcmp(op->packet + 1, "vorbis", 6) != 0 || vi->rate == 0 ||
+	    vc->vendor == NULL)
+		return (vorbis_synthesis_headerin(vi, vc, op));
+
+	/* the setup is parsed against the channels and blocksizes */
+	crc = oggcrc_update(0, op->packet, op->bytes);
+	bs0 = vorbis_info_blocksize(vi, 0);
+	bs1 = vorbis_info_blocksize(vi, 1);
+	LOCK();
+	/* a second setup header would be unpacked into the shared one */
+	if (find_info(vi) != NULL) {
+		UNLOCK();
+		return (OV_EBADHEADER);
+	}
+	for (i = 0; i < VORBISCACHE_SIZE; i++) {
+		e = &cache[i];
+		if (e->packet != NULL && e->crc == crc && e->bytes == op->bytes &&
+		    e->channels == vi->channels && e->blocksize[0] == bs0 &&
+		    e->blocksize[1] == bs1 &&
+		    memcmp(e->packet, op->packet, op->bytes) == 0) {
+			e->refs++;
+			e->used = ++cache_clock;
+			/* drop the codec setup the id header began */
+			(void)memset(&own, 0, sizeof(vorbis_info));
+			own.codec_setup = vi->codec_setup;
+			vi->codec_setup = e->info.codec_setup;
+			UNLOCK();
+			vorbis_info_clear(&own);
+			return (0);
+		}
+	}
+	UNLOCK();
+
+	if ((ret = vorbis_synthesis_headerin(vi, vc, op)) != 0)
+		return (ret);
+	/* a file we cannot cache is still a file we can read */
+	if ((copy = malloc(op->bytes)) == NULL)
+		return (0);
+	(void)memcpy(copy, op->packet, op->bytes);
+
+	LOCK();
+	slot = NULL;
+	for (i = 0; i < VORBISCACHE_SIZE; i++) {
+		e = &cache[i];
+		if (e->packet == NULL) {
+			slot = e;
+			break;
+		}
+		if (e->refs == 0 && (slot == NULL || e->used < slot->used))
+			slot = e;
+	}
+	if (slot == NULL) {
+		UNLOCK();
+		free(copy);
+		return (0);
+	}
+	if (slot->packet != NULL) {
+		vorbis_info_clear(&slot->info);
+		free(slot->packet);
+	}
+	slot->info = *vi;
+	slot->packet = copy;
+	slot->bytes = op->bytes;
+	slot->crc = crc;
+	slot->channels = vi->channels;
+	slot->blocksize[0] = bs0;
+	slot->blocksize[1] = bs1;
+	slot->refs = 1;
+	slot->warm = 0;
+	slot->used = ++cache_clock;
+	UNLOCK();
+	return (0);
+}
+
+
+/**
+ * like vorbis_synthesis_init(). The first decoder of a cached setup builds
+ * its decode tables, it does so alone.
+ *
+ * return 0 on success and non-zero on error.
+ */
+int
+vorbiscache_synthesis_init(vorbis_dsp_state *vd, vorbis_info *vi)
+{
+	struct setup *e;
+	int ret;
+
+	LOCK();
+	e = find_info(vi);
+	if (e == NULL || e->warm) {
+		UNLOCK();
+		return (vorbis_synthesis_init(vd, vi));
+	}
+	if ((ret = vorbis_synthesis_init(vd, vi)) == 0)
+		e->warm = 1;
+	UNLOCK();
+	return (ret);
+}
+
+
+/**
+ * like vorbis_info_clear(). A cached setup stays in the cache for the next
+ * file.
+ */
+void
+vorbiscache_info_clear(vorbis_info *vi)
+{
+	struct setup *e;
+
+	LOCK();
+	if ((e = find_info(vi)) != NULL)
+		e->refs--;
+	UNLOCK();
+	if (e != NULL)
+		(void)memset(vi, 0, sizeof(vorbis_info));
+	else
+		vorbis_info_clear(vi);
+}
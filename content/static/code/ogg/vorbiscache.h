@@ -0,0 +1,45 @@
+/*
+ * vorbiscache.h
+ *
+ * Process wide cache of parsed Vorbis setup headers.
+ *
+ * The setup header holds every codebook, and unpacking it is most of the
+ * work of opening a short file. Files from the same encoder at the same
+ * quality carry the same setup packet, so the tools going through many
+ * files (oggfix -d, the daemon) parse it once: vorbiscache_headerin() is a
+ * drop-in vorbis_synthesis_headerin() which, for a setup packet seen
+ * before with the same channel count and blocksizes, points vi at the
+ * codec setup parsed then instead of unpacking it again. The public fields
+ * of vi (rate, bitrates, ...) always come from the file's own id header.
+ *
+ * A vorbis_info filled this way is shared and read-only: release it with
+ * vorbiscache_info_clear(), not vorbis_info_clear(), and start a decoder on
+ * it with vorbiscache_synthesis_init(), since libvorbis builds the decode
+ * tables into the codec setup the first time. All three may be called from
+ * several threads. At most VORBISCACHE_SIZE setups are kept, the least
+ * recently used one that is not in use goes first.
+ *
+ * Compile vorbiscache.c and oggcrc.c along with the tool using it.
+ */
+#ifndef VORBISCACHE_H
+#define	VORBISCACHE_H
+
+#include "ogg/ogg.h"
+#include "vorbis/codec.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define	VORBISCACHE_SIZE	16
+
+int	vorbiscache_headerin(vorbis_info *vi, vorbis_comment *vc,
+	    ogg_packet *op);
+int	vorbiscache_synthesis_init(vorbis_dsp_state *vd, vorbis_info *vi);
+void	vorbiscache_info_clear(vorbis_info *vi);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* VORBISCACHE_H */